@@ -22,6 +22,7 @@
 #include <Uefi.h>
 
 /* Package headers */
+#include <multiboot2.h>
 #include <vm.h>
 
 /* Application headers */
@@ -30,23 +31,44 @@
 #include <Hardware.h>
 #include <Util.h>
 
-#define ATTR_CACHED 0
-#define ATTR_DEVICE 1
+/* Memory attribute indices, and what arch_init() puts in MAIR for them:
+ * normal write-back read/write-allocate, and device nGnRE.  EDK2's own
+ * tables use indices 0-3, and are live until we switch, so we stay clear of
+ * them. */
+#define ATTR_CACHED 4
+#define ATTR_DEVICE 5
 
-struct page_tables {
-    size_t nL1;
+#define MAIR_NORMAL_WB      0xff
+#define MAIR_DEVICE_nGnRE   0x04
+#define MAIR_ATTR(i, attr)  ((uint64_t)(attr) << (8 * (i)))
+#define MAIR_MASK(i)        MAIR_ATTR(i, 0xff)
 
-    union aarch64_descriptor *L0_table;
-    union aarch64_descriptor **L1_tables;
+struct page_tables {
+    /* The translation granule, as log2 of its size, and the level of the
+     * root table, which depends on it. */
+    size_t granule_bits;
+    size_t root_level;
+    union aarch64_descriptor *root_table;
+
+    /* The CPU's physical address size, which bounds the 1-1 map. */
+    size_t pa_bits;
+
+    /* The root of the high-half mapping.  Its entries point to the same
+     * tables as those of the 1-1 root. */
+    union aarch64_descriptor *high_table;
+
+    /* All tables are allocated from this pool, sized beforehand. */
+    char *pool;
+    size_t pool_tables, pool_used;
 };
 
 void *
 get_root_table(struct hagfish_config *cfg) {
     ASSERT(cfg);
     ASSERT(cfg->tables);
-    ASSERT(cfg->tables->L0_table);
+    ASSERT(cfg->tables->root_table);
 
-    return cfg->tables->L0_table;
+    return cfg->tables->root_table;
 }
 
 void
@@ -72,37 +94,241 @@ dump_table(uint64_t vbase, uint64_t *table, size_t level) {
     }
 }
 
-#define BLOCK_16G (ARMv8_HUGE_PAGE_SIZE * 16ULL)
-#define BLOCK_16G_MASK (ARMv8_HUGE_PAGE_SIZE * 16ULL)
+#define GRANULE(t)         (1ULL << (t)->granule_bits)
+#define LEVEL_SHIFT(t, l)  ARMv8_LEVEL_SHIFT((t)->granule_bits, (l))
+#define LEVEL_SIZE(t, l)   ARMv8_LEVEL_SIZE((t)->granule_bits, (l))
+#define ENTRIES(t)         ARMv8_TABLE_ENTRIES((t)->granule_bits)
+
+/* The size of the virtual regions that we configure, and so of the 1-1
+ * map. */
+#define VA_BITS 48
+
+/* The most that we'll spend on the tables that map devices.  That's enough
+ * to map a 44-bit physical address space (as most servers have) as device
+ * memory with any granule: 32 tables of 1GB blocks with 4kB, 4 of 512MB
+ * blocks with 64kB, or 256 of 32MB blocks (4MB) with 16kB.  A full 48 bits
+ * takes 512 tables with 4kB, and 64 with 64kB, but 4096 (64MB) with 16kB. */
+#define DEVICE_TABLES_MAX (8 * 1024 * 1024)
+
+/* The attributes of every block and page that we map: accessed, so that we
+ * don't get a fault, inner shareable - coherent (it's ignored for devices),
+ * and EL1+ only. */
+#define LEAF_ATTRIBUTES (ARMv8_DESC_AF | ARMv8_DESC_SH(3) | ARMv8_DESC_VALID)
+
+static union aarch64_descriptor *
+table_alloc(struct page_tables *tables) {
+    union aarch64_descriptor *table;
+
+    ASSERT(tables->pool_used < tables->pool_tables);
+    table= (union aarch64_descriptor *)
+        (tables->pool + tables->pool_used * GRANULE(tables));
+    tables->pool_used++;
+    memset(table, 0, GRANULE(tables));
+
+    return table;
+}
 
+/* Without 52-bit addressing, only the 4kB granule has 1GB (L1) blocks.  The
+ * others have 32MB or 512MB L2 blocks, and pages at L3. */
+static BOOLEAN
+leaf_allowed(struct page_tables *tables, size_t level) {
+    return level >= 2 ||
+           (level == 1 && tables->granule_bits == ARMv8_GRANULE_4K_BITS);
+}
 
-static EFI_STATUS
-page_table_set_attr(struct hagfish_config *cfg, uint64_t start, uint64_t end, uint64_t attr) {
-    uint64_t base = ROUNDDOWN(start, ARMv8_HUGE_PAGE_SIZE)
-            / ARMv8_HUGE_PAGE_SIZE;
+static BOOLEAN
+is_table(union aarch64_descriptor *desc, size_t level) {
+    return level < 3 &&
+           (desc->raw & (ARMv8_DESC_VALID | ARMv8_DESC_TABLE)) ==
+           (ARMv8_DESC_VALID | ARMv8_DESC_TABLE);
+}
 
-    uint64_t last = COVER(end, ARMv8_HUGE_PAGE_SIZE);
+static union aarch64_descriptor *
+next_table(union aarch64_descriptor *desc) {
+    return (union aarch64_descriptor *)(desc->raw & ARMv8_DESC_ADDRESS_MASK);
+}
 
-    DebugPrint(DEBUG_VERBOSE, "region type %d %p -> %p\n", attr,
-               base * ARMv8_HUGE_PAGE_SIZE,
-               last * ARMv8_HUGE_PAGE_SIZE);
-    while (base < last) {
-        size_t table_number = base >> ARMv8_BLOCK_BITS;
-        size_t table_index = base & ARMv8_BLOCK_MASK;
-        union aarch64_descriptor *desc =
-                &cfg->tables->L1_tables[table_number][table_index];
-       DebugPrint(DEBUG_VERBOSE, "Setting desc at %p number = %d index = %d\n", desc, table_number, table_index);
-        desc->block_l1.attrindex = attr;
+static void
+set_table(union aarch64_descriptor *desc, union aarch64_descriptor *table) {
+    desc->raw= (uint64_t)table | ARMv8_DESC_TABLE | ARMv8_DESC_VALID;
+}
+
+/* A block (L1 or L2) or page (L3) mapping of 'addr'. */
+static void
+set_leaf(union aarch64_descriptor *desc, size_t level, uint64_t addr,
+         int attr) {
+    desc->raw= addr | ARMv8_DESC_ATTRINDEX(attr) | LEAF_ATTRIBUTES;
+    if(level == 3) desc->raw|= ARMv8_DESC_TABLE;
+}
 
-        base++;
+/* Map [start, end) with 'attr', in 'table' at 'level'.  Each piece of the
+ * range that covers a whole entry gets a block or page, if the granule
+ * allows one at this level.  Any other entry is split into a next-level
+ * table first, which inherits the old block's attributes. */
+static void
+map_range(struct page_tables *tables, union aarch64_descriptor *table,
+          size_t level, uint64_t start, uint64_t end, int attr) {
+    uint64_t size= LEVEL_SIZE(tables, level);
+
+    while(start < end) {
+        uint64_t block= ROUNDDOWN(start, size);
+        uint64_t next= MIN(block + size, end);
+        union aarch64_descriptor *desc=
+            &table[(start >> LEVEL_SHIFT(tables, level)) &
+                   (ENTRIES(tables) - 1)];
+
+        if(start == block && next == block + size &&
+           leaf_allowed(tables, level)) {
+            ASSERT(!is_table(desc, level));
+            set_leaf(desc, level, block, attr);
+        }
+        else {
+            ASSERT(level < 3);
+            if(!is_table(desc, level)) {
+                union aarch64_descriptor *sub= table_alloc(tables);
+
+                if(desc->raw & ARMv8_DESC_VALID) {
+                    map_range(tables, sub, level + 1, block, block + size,
+                              ARMv8_DESC_ATTRINDEX_OF(desc->raw));
+                }
+                set_table(desc, sub);
+            }
+            map_range(tables, next_table(desc), level + 1, start, next, attr);
+        }
+
+        start= next;
     }
+}
 
-    return EFI_SUCCESS;
+/* How many adjacent, aligned entries with the same attributes can share a
+ * TLB entry, if marked contiguous. */
+static size_t
+contiguous_entries(struct page_tables *tables, size_t level) {
+    switch(tables->granule_bits) {
+        case ARMv8_GRANULE_16K_BITS:
+            return level == 3 ? 128 : 32;
+        case ARMv8_GRANULE_64K_BITS:
+            return 32;
+        default:
+            return 16;
+    }
 }
 
+/* Set the contiguous hint on each aligned run of leaf entries that map
+ * adjacent memory with the same attributes, throughout the tree. */
+static void
+set_contiguous(struct page_tables *tables, union aarch64_descriptor *table,
+               size_t level) {
+    size_t run= contiguous_entries(tables, level);
+    size_t i, j;
+
+    for(i= 0; i < ENTRIES(tables); i+= run) {
+        BOOLEAN all_same= leaf_allowed(tables, level);
+
+        for(j= i; j < i + run; j++) {
+            if(is_table(&table[j], level)) {
+                set_contiguous(tables, next_table(&table[j]), level + 1);
+                all_same= FALSE;
+            }
+            else if(!(table[j].raw & ARMv8_DESC_VALID) ||
+                    ARMv8_DESC_ATTRINDEX_OF(table[j].raw) !=
+                    ARMv8_DESC_ATTRINDEX_OF(table[i].raw)) {
+                all_same= FALSE;
+            }
+        }
+
+        if(all_same) {
+            for(j= i; j < i + run; j++)
+                table[j].raw|= ARMv8_DESC_CONTIGUOUS;
+        }
+    }
+}
+
+/* The highest address that the kernel needs mapped, if we can't map
+ * everything: the end of the memory map (which includes the MMIO regions that
+ * the firmware knows of), or the GIC or a UART, if they're beyond that. */
+static uint64_t
+mapped_top(struct hagfish_config *cfg) {
+    size_t mmap_n_desc= mmap_size / mmap_d_size;
+    uint64_t top= 0;
+    size_t i;
+
+    for(i= 0; i < mmap_n_desc; i++) {
+        EFI_MEMORY_DESCRIPTOR *desc=
+            (EFI_MEMORY_DESCRIPTOR *)(mmap + i * mmap_d_size);
+
+        top= MAX(top, desc->PhysicalStart + desc->NumberOfPages * PAGE_4k);
+    }
+
+    if(cfg->madt) {
+        uint64_t *its= (uint64_t *)&cfg->madt->cpus[cfg->madt->num_cpus];
+
+        top= MAX(top, cfg->madt->gicd_base + PAGE_2M);
+        for(i= 0; i < cfg->madt->num_cpus; i++)
+            top= MAX(top, cfg->madt->cpus[i].gicr_base + PAGE_2M);
+        for(i= 0; i < cfg->madt->num_its; i++)
+            top= MAX(top, its[i] + PAGE_2M);
+    }
+
+    for(i= 0; i < cfg->nuarts; i++)
+        top= MAX(top, cfg->uart_base[i] + PAGE_2M);
+
+    return top;
+}
+
+/* The tables needed above the first level with blocks, to map [0, top). */
+static size_t
+device_tables(struct page_tables *tables, uint64_t top, size_t first_block) {
+    size_t n= 0, level;
+
+    for(level= tables->root_level + 1; level <= first_block; level++)
+        n+= COVER(top, LEVEL_SIZE(tables, level - 1));
+
+    return n;
+}
+
+/* The configured granule, if the CPU supports it, or 4kB. */
+static size_t
+choose_granule(struct hagfish_config *cfg) {
+    switch(cfg->granule) {
+        case 0:
+        case 1 << ARMv8_GRANULE_4K_BITS:
+            return ARMv8_GRANULE_4K_BITS;
+        case 1 << ARMv8_GRANULE_16K_BITS:
+            if(arch_granule_supported(cfg->granule))
+                return ARMv8_GRANULE_16K_BITS;
+            break;
+        case 1 << ARMv8_GRANULE_64K_BITS:
+            if(arch_granule_supported(cfg->granule))
+                return ARMv8_GRANULE_64K_BITS;
+            break;
+    }
+
+    DebugPrint(DEBUG_WARN,
+               "Warning: %dB granule not supported, using 4kB.\n",
+               cfg->granule);
+    return ARMv8_GRANULE_4K_BITS;
+}
+
+/* Build the kernel's initial 1-1 map of physical memory, from the memory
+ * map.  The CPU's whole physical address space is mapped as device memory,
+ * with the largest blocks that the granule allows, as MMIO that the kernel
+ * needs, such as its console UART, needn't be in the memory map.  RAM is then
+ * mapped cacheable over it.  Where a RAM region doesn't start or end on a
+ * block boundary, that block is split into a table of smaller blocks, and if
+ * need be, those into pages, so that each page gets the right attributes
+ * with the fewest tables.  With a granule larger than 4kB, a page that's
+ * only partly RAM stays a device.  If mapping everything would take too many
+ * tables (with 16kB and 48 bits), the window stops at the top of what we
+ * know of: the memory map, the GIC and the UARTs.
+ *
+ * Each RAM region splits at most one block at each level at each end, so we
+ * can size a single pool for all of the tables up front. */
 EFI_STATUS
 build_page_tables(struct hagfish_config *cfg) {
     EFI_STATUS status= EFI_SUCCESS;
+    struct page_tables *tables;
+    size_t i, first_block;
 
     status= update_ram_regions(cfg);
     if(EFI_ERROR(status)) {
@@ -117,178 +343,132 @@ build_page_tables(struct hagfish_config *cfg) {
         goto build_page_tables_fail;
     }
 
-    cfg->tables= calloc(1, sizeof(struct page_tables));
+    tables= cfg->tables= calloc(1, sizeof(struct page_tables));
     if(!cfg->tables) {
         DebugPrint(DEBUG_ERROR, "calloc: %a\n", strerror(errno));
         status= EFI_OUT_OF_RESOURCES;
         goto build_page_tables_fail;
     }
 
-    /* Map up to the highest RAM address supplied by EFI.  XXX - this is a
-     * heuristic, and may fail.  Unless there's a more clever way to do
-     * discovery, we might need to bite the bullet and map all 48 bits (2MB of
-     * kernel page tables!).  All we really need is that the kernel gets all
-     * RAM, and the debug serial port - it shouldn't actually touch anything
-     * else. */
-    uint64_t first_address, last_address;
-    first_address= 0;
-
-    /*
-    last_address= list->regions[list->nregions-1].base
-                + list->regions[list->nregions-1].npages * PAGE_4k - 1;
-
-        XXX - workaround to get it going on the cavium machines
-    */
-
-    last_address = ((1UL << 48) - 1);
-
-    DebugPrint(DEBUG_INFO, "Kernel physical window from %llx to %llx\n",
-               first_address, last_address);
-
-    /* We will map in aligned 16G blocks, as each requires only one TLB
-     * entry. */
-    uint64_t window_start, window_length;
-    window_start= first_address & ~BLOCK_16G;
-    window_length= ROUNDUP(last_address - window_start, BLOCK_16G);
-
-    DebugPrint(DEBUG_INFO, "Mapping 16GB blocks from %llx to %llx\n",
-               window_start, window_start + window_length - 1);
+    /* The root is the level that translates the top address bit. */
+    tables->granule_bits= choose_granule(cfg);
+    for(tables->root_level= 3;
+        LEVEL_SHIFT(tables, tables->root_level) +
+        ARMv8_TABLE_BITS(tables->granule_bits) < VA_BITS;
+        tables->root_level--);
+
+    for(first_block= 1; !leaf_allowed(tables, first_block); first_block++);
+
+    tables->pa_bits= arch_pa_bits();
+    uint64_t pa_top= 1ULL << tables->pa_bits;
+    uint64_t last_address= pa_top;
+    if(device_tables(tables, last_address, first_block) * GRANULE(tables) >
+       DEVICE_TABLES_MAX) {
+        last_address= ROUNDUP(mapped_top(cfg), PAGE_1G);
+        if(last_address > pa_top) {
+            DebugPrint(DEBUG_WARN,
+                       "Warning: not mapping physical memory above %d bits.\n",
+                       tables->pa_bits);
+            last_address= pa_top;
+        }
+        DebugPrint(DEBUG_WARN,
+                   "Warning: not mapping devices above %llx with a %dkB "
+                   "granule.\n", last_address - 1, GRANULE(tables) / 1024);
+    }
 
-    cfg->tables->L0_table= allocate_pages(1, EfiBarrelfishBootPageTable);
-    if(!cfg->tables->L0_table) {
-        DebugPrint(DEBUG_ERROR, "Failed to allocate L0 page table.\n");
+    /* The two roots, the tables that the device mapping needs above the
+     * first level with blocks, and then one table per split at each end of
+     * each RAM region. */
+    tables->pool_tables= 2 + device_tables(tables, last_address, first_block);
+    tables->pool_tables+= 2 * (3 - first_block) * list->nregions;
+
+    tables->pool= allocate_aligned_pages(
+        tables->pool_tables * GRANULE(tables) / PAGE_4k, GRANULE(tables),
+        EfiBarrelfishBootPageTable);
+    if(!tables->pool) {
+        DebugPrint(DEBUG_ERROR, "Failed to allocate %d page tables.\n",
+                   tables->pool_tables);
+        status= EFI_OUT_OF_RESOURCES;
         goto build_page_tables_fail;
     }
-    memset(cfg->tables->L0_table, 0, PAGE_4k);
 
-    /* Count the number of L1 tables (512GB) blocks required to cover the
-     * physical mapping window. */
-    cfg->tables->nL1= 0;
-    uint64_t L1base= window_start & ~ARMv8_TOP_TABLE_SIZE;
-    uint64_t L1addr;
-    for(L1addr= window_start & ~ARMv8_TOP_TABLE_SIZE;
-        L1addr < window_start + window_length;
-        L1addr+= ARMv8_TOP_TABLE_SIZE) {
-        cfg->tables->nL1++;
+    DebugPrint(DEBUG_INFO,
+               "Kernel physical window from 0 to %llx, %dkB granule\n",
+               last_address - 1, GRANULE(tables) / 1024);
+
+    /* Everything's a device, unless we know otherwise. */
+    tables->root_table= table_alloc(tables);
+    map_range(tables, tables->root_table, tables->root_level,
+              0, last_address, ATTR_DEVICE);
+
+    for(i= 0; i < list->nregions; i++) {
+        uint64_t base= ROUNDUP(list->regions[i].base, GRANULE(tables));
+        uint64_t end= ROUNDDOWN(list->regions[i].base +
+                                list->regions[i].npages * PAGE_4k,
+                                GRANULE(tables));
+
+        end= MIN(end, last_address);
+        if(base < end) {
+            map_range(tables, tables->root_table, tables->root_level,
+                      base, end, ATTR_CACHED);
+        }
     }
 
-    DebugPrint(DEBUG_INFO, "Allocating %d L1 tables\n", cfg->tables->nL1);
+    set_contiguous(tables, tables->root_table, tables->root_level);
 
-    /* ALlocate the L1 table pointers. */
-    cfg->tables->L1_tables=
-        calloc(cfg->tables->nL1, sizeof(union aarch64_descriptor *));
-    if(!cfg->tables->L1_tables) {
-        DebugPrint(DEBUG_ERROR,
-                   "Failed to allocate L1 page table pointers.\n");
-        goto build_page_tables_fail;
-    }
+    /* The kernel window is the same map, KERNEL_OFFSET higher.  There are no
+     * blocks at the root level, so a copy of the root shares everything
+     * below it. */
+    tables->high_table= table_alloc(tables);
+    memcpy(tables->high_table, tables->root_table, GRANULE(tables));
 
-    /* Allocate the L1 tables. */
-    for (size_t i = 0; i < cfg->tables->nL1; i++) {
-        cfg->tables->L1_tables[i]=
-            allocate_pages(1, EfiBarrelfishBootPageTable);
-        if(!cfg->tables->L1_tables[i]) {
-            DebugPrint(DEBUG_ERROR, "Failed to allocate L1 page tables.\n");
-            goto build_page_tables_fail;
-        }
-        memset(cfg->tables->L1_tables[i], 0, PAGE_4k);
-
-        /* Map the L1 into the L0. */
-        size_t L0_index= (L1base >> ARMv8_TOP_TABLE_BITS) + i;
-        cfg->tables->L0_table[L0_index].d.base=
-            (uint64_t)cfg->tables->L1_tables[i] >> ARMv8_BASE_PAGE_BITS;
-        cfg->tables->L0_table[L0_index].d.mb1=   1; /* Page table */
-        cfg->tables->L0_table[L0_index].d.valid= 1;
-    }
-
-    /* Install the 1GB block mappings. */
-    uint64_t firstblock = window_start / ARMv8_HUGE_PAGE_SIZE;
-    uint64_t nblocks = window_length / ARMv8_HUGE_PAGE_SIZE;
-    for (uint64_t block = firstblock; block < firstblock + nblocks; block++) {
-        size_t table_number= block >> ARMv8_BLOCK_BITS;
-        size_t table_index= block & ARMv8_BLOCK_MASK;
-        union aarch64_descriptor *desc =
-            &cfg->tables->L1_tables[table_number][table_index];
-
-        // We first map all block non-contiguous but later set the bit
-        // if possible
-        desc->block_l1.contiguous= 0;
-        desc->block_l1.base= block;
-        /* Mark the accessed flag, so we don't get a fault. */
-        desc->block_l1.af= 1;
-        /* Outer shareable - coherent. */
-        desc->block_l1.sh= 3;
-        /* EL1+ only. */
-        desc->block_l1.ap= 0;
-        // device memory by default
-        desc->block_l1.attrindex= ATTR_DEVICE;
-        /* A block. */
-        desc->block_l1.mb0= 0;
-        desc->block_l1.valid= 1;
-    }
-
-    // set all memory regions to cached
-    size_t mmap_n_desc = mmap_size / mmap_d_size;
-    for (size_t i = 0; i < mmap_n_desc; i++) {
-        EFI_MEMORY_DESCRIPTOR *desc = (void *) (mmap + i * mmap_d_size);
-        /* We're only looking for MMIO. */
-        if (desc->Type != EfiMemoryMappedIO
-                && desc->Type != EfiMemoryMappedIOPortSpace) {
-            page_table_set_attr(cfg, desc->PhysicalStart, desc->PhysicalStart + PAGE_4k * desc->NumberOfPages, ATTR_CACHED);
-        }
-    }
+    /* Give back the tables we didn't need. */
+    free_pages(tables->pool + tables->pool_used * GRANULE(tables),
+               (tables->pool_tables - tables->pool_used) *
+               GRANULE(tables) / PAGE_4k);
+    tables->pool_tables= tables->pool_used;
 
-    // set the contiguous bit if possible
-    for (uint64_t block = firstblock; block < firstblock + nblocks; block += 16) {
-        BOOLEAN all_same = TRUE;
-        uint64_t attr;
-        for (uint64_t offset = 0; offset < 16; offset++) {
-            size_t table_number = (block + offset) >> ARMv8_BLOCK_BITS;
-            size_t table_index = (block + offset) & ARMv8_BLOCK_MASK;
-            union aarch64_descriptor *desc =
-                &cfg->tables->L1_tables[table_number][table_index];
-            if (offset == 0) {
-                attr = desc->block_l1.attrindex;
-            } else if (attr != desc->block_l1.attrindex) {
-                all_same = FALSE;
-                break;
-            }
-        }
-        if (all_same) {
-            // all entries in current block have the same attrindex value
-            // so we can set the contiguous bit
-            for (uint64_t offset = 0; offset < 16; offset++) {
-                size_t table_number = (block + offset) >> ARMv8_BLOCK_BITS;
-                size_t table_index = (block + offset) & ARMv8_BLOCK_MASK;
-                union aarch64_descriptor *desc =
-                    &cfg->tables->L1_tables[table_number][table_index];
-                desc->block_l1.contiguous = 1;
-            }
-        }
-    }
+    DebugPrint(DEBUG_INFO, "Built the kernel page tables in %d tables.\n",
+               tables->pool_used);
+
+    arch_handoff_range(tables->pool, tables->pool_used * GRANULE(tables),
+                       HANDOFF_CLEAN);
 
     return EFI_SUCCESS;
 
 build_page_tables_fail:
     if(cfg->tables) {
-        if(cfg->tables->L1_tables) {
-            size_t i;
-            for(i= 0; i < cfg->tables->nL1; i++) {
-                if(cfg->tables->L1_tables[i])
-                    FreePages(cfg->tables->L1_tables[i], 1);
-            }
-            free(cfg->tables->L1_tables);
+        if(cfg->tables->pool) {
+            free_pages(cfg->tables->pool, cfg->tables->pool_tables *
+                                          GRANULE(cfg->tables) / PAGE_4k);
         }
-        if(cfg->tables->L0_table) FreePages(cfg->tables->L0_table, 1);
         free(cfg->tables);
+        cfg->tables= NULL;
     }
 
     return status;
 }
 
+/* Describe the tables for the kernel. */
+void
+fill_page_tables_tag(struct hagfish_config *cfg,
+                     struct multiboot_tag_page_tables *tag) {
+    ASSERT(cfg->tables);
+
+    tag->granule= GRANULE(cfg->tables);
+    tag->root_level= cfg->tables->root_level;
+    tag->ttbr0= (uint64_t)cfg->tables->root_table;
+    tag->ttbr1= (uint64_t)cfg->tables->high_table;
+    tag->kernel_offset= KERNEL_OFFSET;
+    tag->mair= 0;
+    tag->pa_bits= cfg->tables->pa_bits;
+    tag->flags= 0;
+    tag->attr_cached= ATTR_CACHED;
+    tag->attr_device= ATTR_DEVICE;
+}
+
 void
 free_page_table_bookkeeping(struct page_tables *tables) {
-    free(tables->L1_tables);
     free(tables);
 }
 
@@ -324,10 +504,10 @@ describe_tcr(UINTN tcr) {
         case TCR_TG0_4KB:
             DebugPrint(DEBUG_INFO, "4kB\n");
             break;
-        case 1:
+        case TCR_TG0_64KB:
             DebugPrint(DEBUG_INFO, "64kB\n");
             break;
-        case 2:
+        case TCR_TG0_16KB:
             DebugPrint(DEBUG_INFO, "16kB\n");
             break;
         default:
@@ -396,6 +576,154 @@ describe_tcr(UINTN tcr) {
     return EFI_SUCCESS;
 }
 
+/* The virtual count, which is what the kernel will see at EL1.  The ISB
+ * stops it being read early. */
+uint64_t
+arch_counter(void) {
+    uint64_t cnt;
+
+    __asm__ volatile("isb; mrs %0, cntvct_el0" : "=r"(cnt) :: "memory");
+    return cnt;
+}
+
+uint64_t
+arch_counter_frequency(void) {
+    uint64_t frq;
+
+    __asm__ volatile("mrs %0, cntfrq_el0" : "=r"(frq));
+    return frq;
+}
+
+#define ID_AA64DFR0_PMUVER(x) (((x) >> 8) & 0xf)
+#define PMCR_E                (1 << 0)
+#define PMCR_P                (1 << 1)
+#define PMCR_C                (1 << 2)
+#define PMCR_N(x)             (((x) >> 11) & 0x1f)
+#define PMU_COUNT_EL2         (1 << 27) /* PMEVTYPER/PMCCFILTR NSH */
+#define PMU_INST_RETIRED      0x08
+#define PMCNTEN_CYCLES        (1U << 31)
+#define PMCNTEN_EVENT0        (1U << 0)
+
+/* Start the cycle counter, and event counter 0 counting retired instructions.
+ * We only touch the PMU at EL2: at EL1, a hypervisor may trap it. */
+BOOLEAN
+arch_pmu_start(void) {
+    uint64_t dfr0, pmcr;
+
+    if(ArmReadCurrentEL() != AARCH64_EL2) return FALSE;
+
+    __asm__ volatile("mrs %0, id_aa64dfr0_el1" : "=r"(dfr0));
+    if(ID_AA64DFR0_PMUVER(dfr0) == 0 || ID_AA64DFR0_PMUVER(dfr0) == 0xf)
+        return FALSE;
+
+    __asm__ volatile("mrs %0, pmcr_el0" : "=r"(pmcr));
+    if(PMCR_N(pmcr) == 0) return FALSE;
+
+    __asm__ volatile("msr pmccfiltr_el0, %0" :: "r"((uint64_t)PMU_COUNT_EL2));
+    __asm__ volatile("msr pmselr_el0, xzr; isb");
+    __asm__ volatile("msr pmxevtyper_el0, %0"
+                     :: "r"((uint64_t)(PMU_COUNT_EL2 | PMU_INST_RETIRED)));
+    __asm__ volatile("msr pmcntenset_el0, %0"
+                     :: "r"((uint64_t)(PMCNTEN_CYCLES | PMCNTEN_EVENT0)));
+    __asm__ volatile("msr pmcr_el0, %0; isb"
+                     :: "r"(pmcr | PMCR_E | PMCR_P | PMCR_C) : "memory");
+
+    return TRUE;
+}
+
+void
+arch_pmu_read(uint64_t *cycles, uint64_t *instructions) {
+    __asm__ volatile("isb; mrs %0, pmccntr_el0" : "=r"(*cycles) :: "memory");
+    __asm__ volatile("mrs %0, pmevcntr0_el0" : "=r"(*instructions));
+}
+
+/* The affinity fields of this core's MPIDR_EL1, as found in the MADT. */
+#define MPIDR_AFFINITY_MASK 0xff00ffffffULL
+
+uint64_t
+arch_boot_mpidr(void) {
+    uint64_t mpidr;
+
+    __asm__ volatile("mrs %0, mpidr_el1" : "=r"(mpidr));
+    return mpidr & MPIDR_AFFINITY_MASK;
+}
+
+#define CLIDR_CTYPE(x, level) (((x) >> (3 * ((level) - 1))) & 0x7)
+#define CLIDR_CTYPE_NONE      0
+#define CLIDR_CTYPE_INSTR     1
+#define CLIDR_CTYPE_DATA      2
+#define CLIDR_CTYPE_SEPARATE  3
+#define CLIDR_CTYPE_UNIFIED   4
+#define CLIDR_MAX_LEVEL       7
+#define CSSELR_INSTR          1
+#define CCSIDR_LINESIZE(x)    (1U << (((x) & 0x7) + 4))
+#define CCSIDR_WAYS(x)        ((((x) >> 3) & 0x3ff) + 1)
+#define CCSIDR_SETS(x)        ((((x) >> 13) & 0x7fff) + 1)
+
+static void
+read_cache_geometry(struct multiboot_topology_cache *cache, uint32_t level,
+                    uint32_t type) {
+    uint64_t csselr= (level - 1) << 1, ccsidr;
+
+    if(type == MULTIBOOT_CACHE_INSTRUCTION) csselr|= CSSELR_INSTR;
+
+    __asm__ volatile("msr csselr_el1, %1; isb; mrs %0, ccsidr_el1"
+                     : "=r"(ccsidr) : "r"(csselr));
+
+    cache->level= level;
+    cache->type= type;
+    cache->line_size= CCSIDR_LINESIZE(ccsidr);
+    cache->ways= CCSIDR_WAYS(ccsidr);
+    cache->sets= CCSIDR_SETS(ccsidr);
+    cache->size= cache->line_size * cache->ways * cache->sets;
+    cache->flags= MULTIBOOT_CACHE_FROM_CPU | MULTIBOOT_CACHE_BOOT_CORE;
+}
+
+/* Describe this core's caches, from CLIDR_EL1 and CCSIDR_EL1.  Returns the
+ * number found, which may be more than 'max'. */
+size_t
+arch_cache_geometry(struct multiboot_topology_cache *caches, size_t max) {
+    uint64_t clidr;
+    uint32_t level;
+    size_t n= 0;
+
+    __asm__ volatile("mrs %0, clidr_el1" : "=r"(clidr));
+
+    for(level= 1; level <= CLIDR_MAX_LEVEL; level++) {
+        switch(CLIDR_CTYPE(clidr, level)) {
+            case CLIDR_CTYPE_NONE:
+                return n;
+            case CLIDR_CTYPE_INSTR:
+                if(n < max) read_cache_geometry(&caches[n], level,
+                                                MULTIBOOT_CACHE_INSTRUCTION);
+                n++;
+                break;
+            case CLIDR_CTYPE_DATA:
+                if(n < max) read_cache_geometry(&caches[n], level,
+                                                MULTIBOOT_CACHE_DATA);
+                n++;
+                break;
+            case CLIDR_CTYPE_SEPARATE:
+                if(n < max) read_cache_geometry(&caches[n], level,
+                                                MULTIBOOT_CACHE_INSTRUCTION);
+                n++;
+                if(n < max) read_cache_geometry(&caches[n], level,
+                                                MULTIBOOT_CACHE_DATA);
+                n++;
+                break;
+            case CLIDR_CTYPE_UNIFIED:
+                if(n < max) read_cache_geometry(&caches[n], level,
+                                                MULTIBOOT_CACHE_UNIFIED);
+                n++;
+                break;
+            default:
+                return n;
+        }
+    }
+
+    return n;
+}
+
 EFI_STATUS
 arch_probe(void) {
     EFI_STATUS status;
@@ -433,25 +761,267 @@ arch_probe(void) {
     return EFI_SUCCESS;
 }
 
+#define ID_AA64MMFR0_TGRAN4(x)  (((x) >> 28) & 0xf)
+#define ID_AA64MMFR0_TGRAN64(x) (((x) >> 24) & 0xf)
+#define ID_AA64MMFR0_TGRAN16(x) (((x) >> 20) & 0xf)
+#define ID_AA64MMFR0_PARANGE(x) ((x) & 0xf)
+
+/* The physical address sizes that ID_AA64MMFR0_EL1.PARange and TCR's PS and
+ * IPS fields encode.  52 bits needs a different descriptor format, so we
+ * stop at 48. */
+#define PA_RANGE_MAX 5
+static const size_t pa_range_bits[PA_RANGE_MAX + 1]= {
+    32, 36, 40, 42, 44, 48
+};
+
+/* The physical address size of this core. */
+size_t
+arch_pa_bits(void) {
+    uint64_t mmfr0;
+
+    __asm__ volatile("mrs %0, id_aa64mmfr0_el1" : "=r"(mmfr0));
+
+    return pa_range_bits[MIN(ID_AA64MMFR0_PARANGE(mmfr0), PA_RANGE_MAX)];
+}
+
+/* The TCR encoding of a physical address size. */
+static UINTN
+pa_range(size_t pa_bits) {
+    UINTN i;
+
+    for(i= 0; i < PA_RANGE_MAX && pa_range_bits[i] < pa_bits; i++);
+    return i;
+}
+
+/* Does this core support the given translation granule, in bytes? */
+BOOLEAN
+arch_granule_supported(size_t granule) {
+    uint64_t mmfr0;
+
+    __asm__ volatile("mrs %0, id_aa64mmfr0_el1" : "=r"(mmfr0));
+
+    switch(granule) {
+        case 1 << ARMv8_GRANULE_4K_BITS:
+            /* 0 is 4kB, 1 is 4kB with 52-bit addresses, 0xf is none. */
+            return ID_AA64MMFR0_TGRAN4(mmfr0) <= 1;
+        case 1 << ARMv8_GRANULE_16K_BITS:
+            /* 0 is none, here. */
+            return ID_AA64MMFR0_TGRAN16(mmfr0) == 1 ||
+                   ID_AA64MMFR0_TGRAN16(mmfr0) == 2;
+        case 1 << ARMv8_GRANULE_64K_BITS:
+            return ID_AA64MMFR0_TGRAN64(mmfr0) == 0;
+        default:
+            return FALSE;
+    }
+}
+
+/* The ranges that arch_init() cleans by address, rather than cleaning the
+ * whole cache by set and way.  If there are too many, it does the latter. */
+#define HANDOFF_RANGES_MAX 64
+
+struct handoff_range {
+    uint64_t base, size;
+    int flags;
+};
+
+static struct handoff_range handoff_ranges[HANDOFF_RANGES_MAX];
+static size_t handoff_nranges;
+static BOOLEAN handoff_overflow;
+
+void
+arch_handoff_range(void *base, size_t size, int flags) {
+    if(size == 0) return;
+
+    if(handoff_nranges == HANDOFF_RANGES_MAX) {
+        handoff_overflow= TRUE;
+        return;
+    }
+
+    handoff_ranges[handoff_nranges].base= (uint64_t)base;
+    handoff_ranges[handoff_nranges].size= size;
+    handoff_ranges[handoff_nranges].flags= flags;
+    handoff_nranges++;
+}
+
+#define CTR_IMINLINE(x) (4ULL << ((x) & 0xf))
+#define CTR_DMINLINE(x) (4ULL << (((x) >> 16) & 0xf))
+#define CTR_DIC         (1ULL << 29)
+
+/* Clean (or clean and invalidate) [base, base + size) to the point of
+ * coherency, a line at a time.  The caller issues the barrier. */
+static void
+clean_range(uint64_t base, uint64_t size, int flags, uint64_t dline) {
+    uint64_t a;
+
+    for(a= ROUNDDOWN(base, dline); a < base + size; a+= dline) {
+        if(flags & HANDOFF_INVALIDATE)
+            __asm__ volatile("dc civac, %0" :: "r"(a) : "memory");
+        else
+            __asm__ volatile("dc cvac, %0" :: "r"(a) : "memory");
+    }
+}
+
+/* Clean (or clean and invalidate) each handoff range to the point of
+ * coherency, so that the kernel sees it with its caches off, then
+ * invalidate the instruction cache over the executable ones, unless the
+ * CPU keeps it coherent itself. */
+static void
+sync_handoff_ranges(void) {
+    uint64_t ctr, dline, iline, a;
+    size_t i;
+
+    __asm__ volatile("mrs %0, ctr_el0" : "=r"(ctr));
+    dline= CTR_DMINLINE(ctr);
+    iline= CTR_IMINLINE(ctr);
+
+    for(i= 0; i < handoff_nranges; i++) {
+        struct handoff_range *r= &handoff_ranges[i];
+
+        clean_range(r->base, r->size, r->flags, dline);
+    }
+    __asm__ volatile("dsb sy" ::: "memory");
+
+    if(ctr & CTR_DIC) return;
+
+    for(i= 0; i < handoff_nranges; i++) {
+        struct handoff_range *r= &handoff_ranges[i];
+
+        if(!(r->flags & HANDOFF_EXECUTE)) continue;
+
+        for(a= ROUNDDOWN(r->base, iline); a < r->base + r->size; a+= iline)
+            __asm__ volatile("ic ivau, %0" :: "r"(a) : "memory");
+    }
+    __asm__ volatile("dsb ish" ::: "memory");
+}
+
+/* Clean and invalidate data that we've written for the kernel since
+ * arch_init() cleaned the handoff ranges, and that are in one of them. */
+void
+arch_handoff_sync(void *base, size_t size) {
+    uint64_t ctr;
+
+    __asm__ volatile("mrs %0, ctr_el0" : "=r"(ctr));
+    clean_range((uint64_t)base, size, HANDOFF_INVALIDATE, CTR_DMINLINE(ctr));
+    __asm__ volatile("dsb sy" ::: "memory");
+}
+
+/* The upper (TTBR1) region's half of TCR, which only exists in the EL1
+ * layout.  EL2 uses that layout too, with VHE. */
+#define TCR_T1SZ(x)              ((UINTN)(x) << 16)
+#define TCR_TTBR1_WALK(x)        ((UINTN)(x) << 16) /* SH0/RGN0 -> SH1/RGN1 */
+#ifndef TCR_TG1_4KB
+#define TCR_TG1_16KB             (1ULL << 30)
+#define TCR_TG1_4KB              (2ULL << 30)
+#define TCR_TG1_64KB             (3ULL << 30)
+#endif
+#define TCR_PS(x)                ((UINTN)(x) << 16) /* EL2 without VHE */
+#define TCR_IPS(x)               ((UINTN)(x) << 32)
+
+#define HCR_EL2_E2H              (1ULL << 34)
+
+static uint64_t
+read_mair(void) {
+    uint64_t mair;
+
+    if(ArmReadCurrentEL() == AARCH64_EL1)
+        __asm__ volatile("mrs %0, mair_el1" : "=r"(mair));
+    else
+        __asm__ volatile("mrs %0, mair_el2" : "=r"(mair));
+
+    return mair;
+}
+
+/* Install the tables described by 'tag': the 1-1 map in TTBR0 and, where the
+ * current translation regime has one, the kernel window in TTBR1.  Unless
+ * 'full_clean' is set, only the handoff ranges are cleaned from the cache. */
 void
-arch_init(void *L0_table) {
-    /* Configure a 48b physical address space, with a 4kB translation granule,
-     * and non-coherent non-shared table access, in a 48b virtual region. */
-    /* XXX - Revisit the coherence/caching decision. */
-    UINTN newtcr= TCR_PS_256TB | TCR_TG0_4KB | TCR_SH_NON_SHAREABLE
-                | TCR_RGN_OUTER_NON_CACHEABLE | TCR_RGN_INNER_NON_CACHEABLE
-                | (64 - 48) /* T0SZ */;
+arch_init(struct multiboot_tag_page_tables *tag, BOOLEAN full_clean) {
+    UINTN tg0, tg1, newtcr;
+    BOOLEAN high_half;
+
+    switch(tag->granule) {
+        case 1 << ARMv8_GRANULE_16K_BITS:
+            tg0= TCR_TG0_16KB;
+            tg1= TCR_TG1_16KB;
+            break;
+        case 1 << ARMv8_GRANULE_64K_BITS:
+            tg0= TCR_TG0_64KB;
+            tg1= TCR_TG1_64KB;
+            break;
+        default:
+            tg0= TCR_TG0_4KB;
+            tg1= TCR_TG1_4KB;
+            break;
+    }
+
+    /* Table walks are inner shareable, and write-back cacheable, as are the
+     * tables themselves, so a walk can hit in the cache, and sees the tables
+     * coherently on every core. */
+    UINTN walk= TCR_SH_INNER_SHAREABLE
+              | TCR_RGN_OUTER_WRITE_BACK_ALLOC | TCR_RGN_INNER_WRITE_BACK_ALLOC;
+
+    /* Our tables only use two attribute indices, which the firmware
+     * doesn't, so we set those, and leave the firmware's alone: its current
+     * mappings of our code, stack and devices use them until we switch
+     * tables. */
+    uint64_t mair= (read_mair() & ~(MAIR_MASK(ATTR_CACHED) |
+                                    MAIR_MASK(ATTR_DEVICE)))
+                 | MAIR_ATTR(ATTR_CACHED, MAIR_NORMAL_WB)
+                 | MAIR_ATTR(ATTR_DEVICE, MAIR_DEVICE_nGnRE);
+
+    /* EL1, and EL2 with VHE, have two 48b virtual regions, and the physical
+     * address size in a different field.  EL2 without VHE has only the
+     * lower. */
+    if(ArmReadCurrentEL() == AARCH64_EL1) high_half= TRUE;
+    else {
+        uint64_t hcr;
+
+        __asm__ volatile("mrs %0, hcr_el2" : "=r"(hcr));
+        high_half= (hcr & HCR_EL2_E2H) != 0;
+    }
+
+    /* Configure the physical address space that the tables were built
+     * for, with their granule, in 48b virtual regions. */
+    if(high_half) {
+        newtcr= TCR_IPS(pa_range(tag->pa_bits)) | tg0 | walk
+              | (64 - 48) /* T0SZ */
+              | tg1 | TCR_TTBR1_WALK(walk) | TCR_T1SZ(64 - 48);
+    }
+    else {
+        newtcr= TCR_PS(pa_range(tag->pa_bits)) | tg0 | walk
+              | (64 - 48) /* T0SZ */;
+    }
+
+    /* Tell the kernel what we're about to install, before we clean the
+     * tag along with the rest of the Multiboot data. */
+    tag->mair= mair;
+    if(high_half) tag->flags|= MULTIBOOT_PAGE_TABLES_HIGH_HALF;
 
     /* We don't want an interrupt handler to fire during the table switch. */
     ArmDisableInterrupts();
 
-    /* Clean the data cache, to ensure that all table entries are in RAM.
-     * Note that we just set table walks to uncached.  This drains the write
-     * buffer and does a store barrier internally. */
-    ArmCleanDataCache();
-
-    /* Switch the table root and translation configuration. */
-    ArmSetTTBR0(L0_table);
+    /* Clean what we've written for the kernel.  The walker now sees the
+     * tables through the cache, so this is for the kernel image and data
+     * that other cores will read with their MMUs (and so caches) off.
+     * Either way ends with a barrier, which also makes the table writes
+     * visible to the walker.  A set/way clean of every cache level takes
+     * milliseconds on a big system cache, and can miss system caches
+     * altogether, so it's only a fallback. */
+    full_clean= full_clean || handoff_overflow;
+    if(full_clean) ArmCleanDataCache();
+    else sync_handoff_ranges();
+
+    /* Switch the memory attributes, table roots and translation
+     * configuration.  TTBR1_EL2 only exists with VHE, so we use its
+     * encoding.  Stale attributes in the TLB go with the invalidate below. */
+    ArmSetMAIR(mair);
+    ArmSetTTBR0((void *)tag->ttbr0);
+    if(high_half) {
+        if(ArmReadCurrentEL() == AARCH64_EL1)
+            __asm__ volatile("msr ttbr1_el1, %0" :: "r"(tag->ttbr1));
+        else
+            __asm__ volatile("msr s3_4_c2_c0_1, %0" :: "r"(tag->ttbr1));
+    }
     ArmSetTCR(newtcr);
 
     /* XXX - on the cavium machines the MMU wasn't enabled, so enable it now */
@@ -460,9 +1030,11 @@ arch_init(void *L0_table) {
     /* Invalidate the TLB, to flush the old table's mappings. */
     ArmInvalidateTlb();
 
-    /* Invalidate the instruction cache, and perform a barrier to ensure that
-     * all instructions from this point on are fetched via the new mappings. */
-    ArmInvalidateInstructionCache();
+    /* The new mappings translate our code to the same addresses, so after a
+     * range-based clean, the kernel's text has already been invalidated from
+     * the instruction cache.  Perform a barrier to ensure that all
+     * instructions from this point on are fetched via the new mappings. */
+    if(full_clean) ArmInvalidateInstructionCache();
     ArmInstructionSynchronizationBarrier();
 
     /* Interrupts are now safe again. */
@@ -7,6 +7,8 @@
  * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
  */
 
+#include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 
 /* EDK headers */
@@ -19,11 +21,18 @@
 
 #include <Library/BaseLib.h>
 #include <Library/BaseMemoryLib.h>
+
+/* Package headers */
+#include <multiboot2.h>
+
 /* Application headers */
 #include <Config.h>
 #include <Acpi.h>
+#include <Util.h>
 
 #include <IndustryStandard/Acpi.h>
+#include <IndustryStandard/DebugPort2Table.h>
+#include <IndustryStandard/SerialPortConsoleRedirectionTable.h>
 
 #include <Library/BaseLib.h>
 
@@ -192,16 +201,13 @@ static void acpi_dump_madt_entry(EFI_ACPI_6_0_MADT_COMMON_ELEMENT *elm)
 
 void *
 acpi_allocate_pages(EFI_PHYSICAL_ADDRESS memory, size_t n, EFI_MEMORY_TYPE type) {
-    EFI_STATUS status;
-    if(n == 0) return NULL;
+    void *p= allocate_pages_at(memory, n, type);
 
-    status = gBS->AllocatePages(AllocateAddress, type, n, &memory);
-    if(EFI_ERROR(status)) {
-        DebugPrint(DEBUG_ERROR, "AllocatePages: %r\n", status);
-        return NULL;
-    }
+    if(!p && n > 0)
+        DebugPrint(DEBUG_ERROR, "Couldn't allocate %d pages at 0x%p\n",
+                   n, memory);
 
-    return (void *)memory;
+    return p;
 }
 
 static void *acpi_get_table_xsdt(EFI_ACPI_COMMON_HEADER *hdr, uint32_t sig)
@@ -297,9 +303,147 @@ static void *acpi_get_madt_table(struct hagfish_config *cfg)
 }
 
 
+static int
+compare_parked_page(const void *a, const void *b) {
+    const EFI_PHYSICAL_ADDRESS *pa= a, *pb= b;
+
+    if(*pa < *pb) return -1;
+    if(*pa > *pb) return 1;
+    return 0;
+}
+
+/* Mark the parked-address pages as EfiACPIReclaimMemory, so that nothing of
+ * ours lands on them.  The pages are sorted and runs of adjacent pages are
+ * reserved with a single call, rather than one per CPU.  If a run can't be
+ * reserved whole (part of it already has a type), its pages are tried one
+ * at a time. */
+static void
+acpi_reserve_parked_pages(EFI_PHYSICAL_ADDRESS *pages, size_t npages) {
+    size_t i, j, k;
+
+    qsort(pages, npages, sizeof(EFI_PHYSICAL_ADDRESS), compare_parked_page);
+
+    for(i= 0; i < npages; i= j) {
+        EFI_PHYSICAL_ADDRESS memory= pages[i];
+        size_t n= 1;
+
+        /* Extend the run, skipping pages shared by several CPUs. */
+        for(j= i + 1; j < npages; j++) {
+            if(pages[j] == memory + (n - 1) * PAGE_4k) continue;
+            if(pages[j] != memory + n * PAGE_4k) break;
+            n++;
+        }
+
+        DebugPrint(DEBUG_INFO,
+                   "ACPI: marking %d pages at 0x%p as EfiACPIReclaimMemory\n",
+                   n, memory);
+        if(allocate_pages_at(memory, n, EfiACPIReclaimMemory)) continue;
+
+        for(k= 0; k < n; k++) {
+            if(!allocate_pages_at(memory + k * PAGE_4k, 1,
+                                  EfiACPIReclaimMemory)) {
+                DebugPrint(DEBUG_ERROR, "Couldn't mark 0x%p as reclaimable\n",
+                           memory + k * PAGE_4k);
+            }
+        }
+    }
+}
+
+/* Walk the MADT, either counting the enabled GICCs, ITSs and parked pages,
+ * or, if 'madt_tag' is non-NULL, filling them in.  Returns FALSE if the table
+ * is corrupt. */
+static BOOLEAN
+acpi_walk_madt(EFI_ACPI_6_0_MULTIPLE_APIC_DESCRIPTION_TABLE_HEADER *madt,
+               struct multiboot_tag_madt *madt_tag, size_t *ncpus,
+               size_t *nits, EFI_PHYSICAL_ADDRESS *pages, size_t *npages) {
+    void *table_end = ((uint8_t *)madt) + madt->Header.Length;
+    void *p = ((uint8_t *)madt) + 44;
+    uint64_t *its_bases=
+        madt_tag ? (uint64_t *)&madt_tag->cpus[madt_tag->num_cpus] : NULL;
+
+    *ncpus= 0;
+    *nits= 0;
+    *npages= 0;
+
+    while(p < table_end) {
+        EFI_ACPI_6_0_MADT_COMMON_ELEMENT *elm = p;
+    //    acpi_dump_madt_entry(p);
+        switch(elm->Type) {
+        case EFI_ACPI_6_0_GIC :
+        {
+            EFI_ACPI_6_0_GIC_STRUCTURE *gicc = p;
+
+            if (gicc->ParkingProtocolVersion && gicc->ParkedAddress) {
+                if(pages) {
+                    pages[*npages]=
+                        gicc->ParkedAddress & ~((uint64_t)PAGE_4k - 1);
+                }
+                (*npages)++;
+            }
+
+            if(!(gicc->Flags & EFI_ACPI_6_0_GIC_ENABLED)) break;
+
+            if(madt_tag) {
+                struct multiboot_madt_cpu *cpu= &madt_tag->cpus[*ncpus];
+
+                cpu->mpidr= gicc->MPIDR;
+                cpu->gicr_base= gicc->GICRBaseAddress;
+                cpu->parked_address=
+                    gicc->ParkingProtocolVersion ? gicc->ParkedAddress : 0;
+                cpu->acpi_uid= gicc->AcpiProcessorUid;
+                cpu->flags= gicc->Flags;
+                cpu->parking_version= gicc->ParkingProtocolVersion;
+            }
+            (*ncpus)++;
+            break;
+        }
+        case EFI_ACPI_6_0_GICD :
+        {
+            EFI_ACPI_6_0_GIC_DISTRIBUTOR_STRUCTURE *gicd = p;
+            if(madt_tag) madt_tag->gicd_base= gicd->PhysicalBaseAddress;
+            break;
+        }
+        case EFI_ACPI_6_0_GIC_ITS :
+        {
+            EFI_ACPI_6_0_GIC_ITS_STRUCTURE *gicits = p;
+            if(its_bases) its_bases[*nits]= gicits->PhysicalBaseAddress;
+            (*nits)++;
+            break;
+        }
+        case EFI_ACPI_6_0_GIC_MSI_FRAME :
+        case EFI_ACPI_6_0_GICR :
+            DebugPrint(DEBUG_INFO, "ACPI: MADT table skipping entry: %u\n",
+                                   elm->Type);
+            break;
+        default:
+            DebugPrint(DEBUG_ERROR, "ACPI: MADT table contained unexpected entry: %u\n",
+                       elm->Type);
+            break;
+        }
+
+        if (elm->Length == 0) {
+            DebugPrint(DEBUG_ERROR, "ACPI: MADT table contained corrupted element: %u\n",
+                       elm->Type);
+            return FALSE;
+        }
+
+        p += elm->Length;
+    }
+
+    return TRUE;
+}
+
+/* Digest the MADT into cfg->madt, for the kernel, and reserve the parked
+ * pages.  The table is walked twice: once to size the digest, and once to
+ * fill it. */
 EFI_STATUS acpi_parse_madt(struct hagfish_config *cfg)
 {
     EFI_ACPI_6_0_MULTIPLE_APIC_DESCRIPTION_TABLE_HEADER *madt;
+    EFI_PHYSICAL_ADDRESS *pages;
+    size_t ncpus, nits, npages, size;
+    BOOLEAN valid;
+
+    cfg->madt= NULL;
 
     madt = acpi_get_madt_table(cfg);
     if (!madt) {
@@ -321,53 +465,734 @@ EFI_STATUS acpi_parse_madt(struct hagfish_config *cfg)
         return EFI_CRC_ERROR;
     }
 
-    void *table_end = ((uint8_t *)madt) + madt->Header.Length;
-    void *p = ((uint8_t *)madt) + 44;
+    /* Size. */
+    valid= acpi_walk_madt(madt, NULL, &ncpus, &nits, NULL, &npages);
+
+    pages= malloc((npages + 1) * sizeof(EFI_PHYSICAL_ADDRESS));
+    if(!pages) {
+        DebugPrint(DEBUG_ERROR, "malloc: %a\n", strerror(errno));
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    /* A corrupt table isn't passed on, but the parked pages before the bad
+     * element may still be in use, so reserve them. */
+    if(!valid) {
+        acpi_walk_madt(madt, NULL, &ncpus, &nits, pages, &npages);
+        acpi_reserve_parked_pages(pages, npages);
+        free(pages);
+        return EFI_SUCCESS;
+    }
+
+    /* Padded, as the emitter copies the tag whole. */
+    size= ROUNDUP(sizeof(struct multiboot_tag_madt)
+                  + ncpus * sizeof(struct multiboot_madt_cpu)
+                  + nits * sizeof(uint64_t), MULTIBOOT_TAG_ALIGN);
+    cfg->madt= calloc(1, size);
+    if(!cfg->madt) {
+        DebugPrint(DEBUG_ERROR, "calloc: %a\n", strerror(errno));
+        free(pages);
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    /* Fill. */
+    cfg->madt->type= MULTIBOOT_TAG_TYPE_MADT;
+    cfg->madt->size= size;
+    cfg->madt->num_cpus= ncpus;
+    cfg->madt->num_its= nits;
+    acpi_walk_madt(madt, cfg->madt, &ncpus, &nits, pages, &npages);
+
+    DebugPrint(DEBUG_INFO, "ACPI: %d enabled CPUs, %d ITSs, GICD at 0x%p\n",
+               ncpus, nits, cfg->madt->gicd_base);
+
+    acpi_reserve_parked_pages(pages, npages);
+    free(pages);
+
+    return EFI_SUCCESS;
+}
+
+/* The most cache levels CLIDR_EL1 can describe, instruction and data. */
+#define BOOT_CORE_CACHES 14
+
+/* Guards against a loop in a corrupt table. */
+#define PPTT_MAX_DEPTH 16
+
+struct pptt_state {
+    EFI_ACPI_DESCRIPTION_HEADER *pptt;
+    struct multiboot_tag_topology *tag;
+    struct multiboot_topology_cache *caches;
+    UINT32 *cache_offsets;      /* The PPTT node of each of caches[]. */
+    size_t max_caches;
+    struct multiboot_topology_cache geometry[BOOT_CORE_CACHES];
+    size_t ngeometry;
+};
+
+/* Return the node at 'offset', if it lies within the table. */
+static void *
+pptt_node(EFI_ACPI_DESCRIPTION_HEADER *pptt, UINT32 offset, UINT8 type) {
+    EFI_ACPI_6_0_MADT_COMMON_ELEMENT *elm;
+
+    if(offset < sizeof(EFI_ACPI_DESCRIPTION_HEADER) ||
+       offset + sizeof(EFI_ACPI_6_0_MADT_COMMON_ELEMENT) > pptt->Length)
+        return NULL;
+
+    elm= (void *)((uint8_t *)pptt + offset);
+    if(elm->Type != type || offset + elm->Length > pptt->Length) return NULL;
+
+    if(type == ACPI_PPTT_PROCESSOR) {
+        ACPI_PPTT_PROCESSOR_NODE *node= (void *)elm;
+        if(elm->Length < sizeof(ACPI_PPTT_PROCESSOR_NODE) ||
+           elm->Length < sizeof(ACPI_PPTT_PROCESSOR_NODE)
+                         + node->NumberOfPrivateResources * sizeof(UINT32))
+            return NULL;
+    }
+    else if(elm->Length < sizeof(ACPI_PPTT_CACHE_NODE)) return NULL;
+
+    return elm;
+}
+
+/* Call 'fn' on each node, stopping early if it returns TRUE.  Returns the
+ * offset of the node that stopped the walk, or 0. */
+static UINT32
+pptt_walk(EFI_ACPI_DESCRIPTION_HEADER *pptt,
+          BOOLEAN (*fn)(EFI_ACPI_6_0_MADT_COMMON_ELEMENT *, UINT32, void *),
+          void *arg) {
+    UINT32 offset= sizeof(EFI_ACPI_DESCRIPTION_HEADER);
+
+    while(offset + sizeof(EFI_ACPI_6_0_MADT_COMMON_ELEMENT) <= pptt->Length) {
+        EFI_ACPI_6_0_MADT_COMMON_ELEMENT *elm=
+            (void *)((uint8_t *)pptt + offset);
+
+        if(elm->Length == 0) {
+            DebugPrint(DEBUG_ERROR, "ACPI: PPTT contained corrupted element\n");
+            return 0;
+        }
+        if(fn(elm, offset, arg)) return offset;
+
+        offset+= elm->Length;
+    }
+
+    return 0;
+}
+
+static BOOLEAN
+pptt_count_cache(EFI_ACPI_6_0_MADT_COMMON_ELEMENT *elm, UINT32 offset,
+                 void *arg) {
+    if(elm->Type == ACPI_PPTT_CACHE) (*(size_t *)arg)++;
+    return FALSE;
+}
+
+static BOOLEAN
+pptt_is_child(EFI_ACPI_6_0_MADT_COMMON_ELEMENT *elm, UINT32 offset,
+              void *arg) {
+    return elm->Type == ACPI_PPTT_PROCESSOR &&
+           ((ACPI_PPTT_PROCESSOR_NODE *)elm)->Parent == *(UINT32 *)arg;
+}
+
+struct pptt_leaf_search {
+    EFI_ACPI_DESCRIPTION_HEADER *pptt;
+    UINT32 uid;
+};
+
+/* Is this the leaf node for the processor?  Tables from before ACPI 6.3
+ * don't have the leaf flag, so we check for children instead. */
+static BOOLEAN
+pptt_is_leaf(EFI_ACPI_6_0_MADT_COMMON_ELEMENT *elm, UINT32 offset,
+             void *arg) {
+    struct pptt_leaf_search *search= arg;
+    ACPI_PPTT_PROCESSOR_NODE *node= (void *)elm;
+
+    if(elm->Type != ACPI_PPTT_PROCESSOR) return FALSE;
+    if(!(node->Flags & ACPI_PPTT_ID_VALID)) return FALSE;
+    if(node->AcpiProcessorId != search->uid) return FALSE;
+
+    return (node->Flags & ACPI_PPTT_LEAF) ||
+           pptt_walk(search->pptt, pptt_is_child, &offset) == 0;
+}
+
+/* Find or add the cache at 'offset', returning its index. */
+static UINT32
+pptt_add_cache(struct pptt_state *st, ACPI_PPTT_CACHE_NODE *node,
+               UINT32 offset, UINT32 level) {
+    struct multiboot_topology_cache *cache;
+    size_t i;
+
+    for(i= 0; i < st->tag->num_caches; i++) {
+        if(st->cache_offsets[i] == offset) return i;
+    }
+    if(st->tag->num_caches == st->max_caches)
+        return MULTIBOOT_TOPOLOGY_UNKNOWN;
+
+    cache= &st->caches[st->tag->num_caches];
+    st->cache_offsets[st->tag->num_caches]= offset;
+
+    cache->level= level;
+    cache->type= MULTIBOOT_CACHE_UNIFIED;
+    if(node->Flags & ACPI_PPTT_TYPE_VALID) {
+        if(ACPI_PPTT_CACHE_TYPE(node->Attributes) == ACPI_PPTT_CACHE_DATA)
+            cache->type= MULTIBOOT_CACHE_DATA;
+        else if(ACPI_PPTT_CACHE_TYPE(node->Attributes) ==
+                ACPI_PPTT_CACHE_INSTR)
+            cache->type= MULTIBOOT_CACHE_INSTRUCTION;
+    }
+    if(node->Flags & ACPI_PPTT_SIZE_VALID) cache->size= node->Size;
+    if(node->Flags & ACPI_PPTT_SETS_VALID) cache->sets= node->NumberOfSets;
+    if(node->Flags & ACPI_PPTT_WAYS_VALID) cache->ways= node->Associativity;
+    if(node->Flags & ACPI_PPTT_LINE_SIZE_VALID)
+        cache->line_size= node->LineSize;
+
+    /* Fill any gaps from the boot core's matching cache. */
+    for(i= 0; i < st->ngeometry; i++) {
+        struct multiboot_topology_cache *g= &st->geometry[i];
+
+        if(g->level != cache->level || g->type != cache->type) continue;
+
+        if(!cache->size || !cache->sets || !cache->ways ||
+           !cache->line_size)
+            cache->flags|= MULTIBOOT_CACHE_FROM_CPU;
+        if(!cache->size) cache->size= g->size;
+        if(!cache->sets) cache->sets= g->sets;
+        if(!cache->ways) cache->ways= g->ways;
+        if(!cache->line_size) cache->line_size= g->line_size;
+        break;
+    }
+
+    return st->tag->num_caches++;
+}
+
+/* Record a cache for a CPU, unless it's already there. */
+static void
+cpu_add_cache(struct multiboot_topology_cpu *cpu, UINT32 index) {
+    size_t i;
+
+    if(index == MULTIBOOT_TOPOLOGY_UNKNOWN) return;
+
+    for(i= 0; i < MULTIBOOT_TOPOLOGY_MAX_CACHES; i++) {
+        if(cpu->caches[i] == index) return;
+        if(cpu->caches[i] == MULTIBOOT_TOPOLOGY_UNKNOWN) {
+            cpu->caches[i]= index;
+            return;
+        }
+    }
+}
+
+/* Walk from the leaf to the root, collecting the caches private to each
+ * node.  A node's caches start one level above the deepest found below it,
+ * and each continues through its next-level chain. */
+static void
+pptt_cpu_caches(struct pptt_state *st, struct multiboot_topology_cpu *cpu,
+                ACPI_PPTT_PROCESSOR_NODE *node) {
+    UINT32 base= 0;
+    size_t depth, i;
+
+    for(depth= 0; node && depth < PPTT_MAX_DEPTH; depth++) {
+        UINT32 top= base;
+
+        for(i= 0; i < node->NumberOfPrivateResources; i++) {
+            UINT32 offset= node->PrivateResources[i];
+            UINT32 level= base + 1;
+            size_t chain;
+
+            for(chain= 0; chain < PPTT_MAX_DEPTH; chain++) {
+                ACPI_PPTT_CACHE_NODE *cache=
+                    pptt_node(st->pptt, offset, ACPI_PPTT_CACHE);
+                if(!cache) break;
+
+                cpu_add_cache(cpu, pptt_add_cache(st, cache, offset, level));
+                if(level > top) top= level;
+
+                offset= cache->NextLevelOfCache;
+                level++;
+            }
+        }
+
+        base= top;
+        node= node->Parent ?
+            pptt_node(st->pptt, node->Parent, ACPI_PPTT_PROCESSOR) : NULL;
+    }
+}
+
+/* Place the CPU in its thread, core, cluster and package. */
+static void
+pptt_cpu_topology(struct pptt_state *st, struct multiboot_topology_cpu *cpu,
+                  UINT32 uid) {
+    struct pptt_leaf_search search= { st->pptt, uid };
+    ACPI_PPTT_PROCESSOR_NODE *leaf, *node;
+    UINT32 offset;
+    size_t depth;
+
+    offset= pptt_walk(st->pptt, pptt_is_leaf, &search);
+    leaf= offset ? pptt_node(st->pptt, offset, ACPI_PPTT_PROCESSOR) : NULL;
+    if(!leaf) return;
+
+    pptt_cpu_caches(st, cpu, leaf);
+
+    /* A thread's core is its parent. */
+    node= leaf;
+    if(leaf->Flags & ACPI_PPTT_THREAD) {
+        cpu->flags|= MULTIBOOT_TOPOLOGY_THREAD;
+        offset= leaf->Parent;
+        node= pptt_node(st->pptt, offset, ACPI_PPTT_PROCESSOR);
+        if(!node) return;
+    }
+    cpu->core= offset;
+
+    /* The cluster is the level above the core, unless that's the package. */
+    for(depth= 0; depth < PPTT_MAX_DEPTH; depth++) {
+        if(node->Flags & ACPI_PPTT_PHYSICAL_PACKAGE) {
+            cpu->package= offset;
+            break;
+        }
+        if(!node->Parent) break;
+
+        offset= node->Parent;
+        node= pptt_node(st->pptt, offset, ACPI_PPTT_PROCESSOR);
+        if(!node) break;
+
+        if(depth == 0 && !(node->Flags & ACPI_PPTT_PHYSICAL_PACKAGE))
+            cpu->cluster= offset;
+    }
+}
+
+/* Build the topology tag for the CPUs in the MADT digest, from the PPTT and
+ * the boot core's cache geometry.  Without a PPTT, we still pass on the
+ * latter. */
+EFI_STATUS
+acpi_parse_pptt(struct hagfish_config *cfg)
+{
+    struct pptt_state st;
+    size_t ncpus, ncaches, i, j;
+
+    cfg->topology= NULL;
+    if(!cfg->madt) return EFI_NOT_FOUND;
+
+    memset(&st, 0, sizeof(st));
+    st.ngeometry= arch_cache_geometry(st.geometry, BOOT_CORE_CACHES);
+    if(st.ngeometry > BOOT_CORE_CACHES) st.ngeometry= BOOT_CORE_CACHES;
+
+    st.pptt= acpi_get_table(cfg, ACPI_PPTT_SIGNATURE);
+    if(st.pptt && acpu_table_checksum(st.pptt, st.pptt->Length)) {
+        DebugPrint(DEBUG_ERROR, "ACPI: PPTT has invalid checksum!\n");
+        st.pptt= NULL;
+    }
+
+    ncaches= 0;
+    if(st.pptt) pptt_walk(st.pptt, pptt_count_cache, &ncaches);
+    else ncaches= st.ngeometry;
+
+    ncpus= cfg->madt->num_cpus;
+    st.tag= calloc(1, ROUNDUP(sizeof(struct multiboot_tag_topology)
+                + ncpus * sizeof(struct multiboot_topology_cpu)
+                + ncaches * sizeof(struct multiboot_topology_cache),
+                MULTIBOOT_TAG_ALIGN));
+    st.cache_offsets= malloc((ncaches + 1) * sizeof(UINT32));
+    if(!st.tag || !st.cache_offsets) {
+        DebugPrint(DEBUG_ERROR, "malloc: %a\n", strerror(errno));
+        if(st.tag) free(st.tag);
+        if(st.cache_offsets) free(st.cache_offsets);
+        return EFI_OUT_OF_RESOURCES;
+    }
+    st.tag->num_cpus= ncpus;
+    st.max_caches= ncaches;
+    st.caches= (struct multiboot_topology_cache *)&st.tag->cpus[ncpus];
+
+    for(i= 0; i < ncpus; i++) {
+        struct multiboot_topology_cpu *cpu= &st.tag->cpus[i];
+
+        cpu->mpidr= cfg->madt->cpus[i].mpidr;
+        cpu->package= MULTIBOOT_TOPOLOGY_UNKNOWN;
+        cpu->cluster= MULTIBOOT_TOPOLOGY_UNKNOWN;
+        cpu->core= MULTIBOOT_TOPOLOGY_UNKNOWN;
+        for(j= 0; j < MULTIBOOT_TOPOLOGY_MAX_CACHES; j++)
+            cpu->caches[j]= MULTIBOOT_TOPOLOGY_UNKNOWN;
+
+        if(st.pptt) pptt_cpu_topology(&st, cpu, cfg->madt->cpus[i].acpi_uid);
+    }
+
+    if(!st.pptt) {
+        memcpy(st.caches, st.geometry,
+               ncaches * sizeof(struct multiboot_topology_cache));
+        st.tag->num_caches= ncaches;
+    }
+
+    st.tag->type= MULTIBOOT_TAG_TYPE_TOPOLOGY;
+    st.tag->size= ROUNDUP(sizeof(struct multiboot_tag_topology)
+                + ncpus * sizeof(struct multiboot_topology_cpu)
+                + st.tag->num_caches * sizeof(struct multiboot_topology_cache),
+                MULTIBOOT_TAG_ALIGN);
+
+    DebugPrint(DEBUG_INFO, "ACPI: topology of %d CPUs, %d caches%a\n",
+               ncpus, st.tag->num_caches, st.pptt ? "" : " (no PPTT)");
+
+    free(st.cache_offsets);
+    cfg->topology= st.tag;
+    return EFI_SUCCESS;
+}
+
+/* The most NUMA nodes for which we'll pass distance matrices. */
+#define NUMA_MAX_NODES 64
+
+struct srat_state {
+    size_t nmemory;
+    UINT32 max_node;
+    struct multiboot_numa_memory *memory;  /* NULL if counting. */
+};
+
+/* Walk the SRAT, either counting the enabled memory ranges and finding the
+ * highest node, or also filling in the ranges.  Returns FALSE if the table
+ * is corrupt. */
+static BOOLEAN
+acpi_walk_srat(EFI_ACPI_6_0_SYSTEM_RESOURCE_AFFINITY_TABLE_HEADER *srat,
+               struct srat_state *st) {
+    void *table_end = ((uint8_t *)srat) + srat->Header.Length;
+    void *p = ((uint8_t *)srat) + sizeof(*srat);
+
+    st->nmemory= 0;
+    st->max_node= 0;
 
     while(p < table_end) {
         EFI_ACPI_6_0_MADT_COMMON_ELEMENT *elm = p;
-    //    acpi_dump_madt_entry(p);
+
         switch(elm->Type) {
-        case EFI_ACPI_6_0_GIC :
+        case EFI_ACPI_6_0_MEMORY_AFFINITY :
         {
-            EFI_ACPI_6_0_GIC_STRUCTURE *gicc = p;
-            EFI_STATUS status;
-            if (gicc->ParkingProtocolVersion && gicc->ParkedAddress) {
-                DebugPrint(DEBUG_INFO, "ACPI: marking page 0x%p as EfiACPIReclaimMemory\n",
-                            gicc->ParkedAddress);
-                EFI_PHYSICAL_ADDRESS memory = gicc->ParkedAddress;
-                status = gBS->AllocatePages(AllocateAddress, EfiACPIReclaimMemory, 1, &memory);
-                if(EFI_ERROR(status)) {
-                    DebugPrint(DEBUG_ERROR, "AllocatePages: %r\n", status);
-                }
-            }
+            EFI_ACPI_6_0_MEMORY_AFFINITY_STRUCTURE *mem = p;
+
+            if(!(mem->Flags & EFI_ACPI_6_0_MEMORY_ENABLED)) break;
 
+            if(st->memory) {
+                struct multiboot_numa_memory *m= &st->memory[st->nmemory];
+
+                m->base= ((uint64_t)mem->AddressBaseHigh << 32)
+                       | mem->AddressBaseLow;
+                m->size= ((uint64_t)mem->LengthHigh << 32) | mem->LengthLow;
+                m->node= mem->ProximityDomain;
+                if(mem->Flags & EFI_ACPI_6_0_MEMORY_HOT_PLUGGABLE)
+                    m->flags|= MULTIBOOT_NUMA_HOTPLUG;
+                if(mem->Flags & EFI_ACPI_6_0_MEMORY_NONVOLATILE)
+                    m->flags|= MULTIBOOT_NUMA_NONVOLATILE;
+            }
+            st->nmemory++;
+            st->max_node= MAX(st->max_node, mem->ProximityDomain);
             break;
         }
-        case EFI_ACPI_6_0_GICD :
-        case EFI_ACPI_6_0_GIC_MSI_FRAME :
-        case EFI_ACPI_6_0_GICR :
-        case EFI_ACPI_6_0_GIC_ITS :
-            DebugPrint(DEBUG_INFO, "ACPI: MADT table skipping entry: %u\n",
-                                   elm->Type);
+        case EFI_ACPI_6_0_GICC_AFFINITY :
+        {
+            EFI_ACPI_6_0_GICC_AFFINITY_STRUCTURE *gicc = p;
+
+            if(gicc->Flags & EFI_ACPI_6_0_GICC_ENABLED)
+                st->max_node= MAX(st->max_node, gicc->ProximityDomain);
             break;
+        }
         default:
-            DebugPrint(DEBUG_ERROR, "ACPI: MADT table contained unexpected entry: %u\n",
-                       elm->Type);
             break;
         }
 
         if (elm->Length == 0) {
-            DebugPrint(DEBUG_ERROR, "ACPI: MADT table contained corrupted element: %u\n");
-            return EFI_SUCCESS;
+            DebugPrint(DEBUG_ERROR, "ACPI: SRAT contained corrupted element: %u\n",
+                       elm->Type);
+            return FALSE;
+        }
+
+        p += elm->Length;
+    }
+
+    return TRUE;
+}
+
+/* The node of the CPU with this ACPI UID. */
+static UINT32
+srat_cpu_node(EFI_ACPI_6_0_SYSTEM_RESOURCE_AFFINITY_TABLE_HEADER *srat,
+              UINT32 uid) {
+    void *table_end = ((uint8_t *)srat) + srat->Header.Length;
+    void *p = ((uint8_t *)srat) + sizeof(*srat);
+
+    while(p < table_end) {
+        EFI_ACPI_6_0_MADT_COMMON_ELEMENT *elm = p;
+
+        if(elm->Type == EFI_ACPI_6_0_GICC_AFFINITY) {
+            EFI_ACPI_6_0_GICC_AFFINITY_STRUCTURE *gicc = p;
+
+            if((gicc->Flags & EFI_ACPI_6_0_GICC_ENABLED) &&
+               gicc->AcpiProcessorUid == uid)
+                return gicc->ProximityDomain;
         }
 
+        /* acpi_walk_srat() has already checked the lengths. */
         p += elm->Length;
     }
 
+    return MULTIBOOT_NUMA_UNKNOWN;
+}
+
+/* Copy the SLIT distances, if there's a usable table. */
+static BOOLEAN
+slit_distances(struct hagfish_config *cfg, uint8_t *distances,
+               size_t nnodes) {
+    EFI_ACPI_6_0_SYSTEM_LOCALITY_DISTANCE_INFORMATION_TABLE_HEADER *slit;
+    uint8_t *entries;
+    size_t n, i;
+
+    slit= acpi_get_table(cfg,
+            EFI_ACPI_6_0_SYSTEM_LOCALITY_INFORMATION_TABLE_SIGNATURE);
+    if(!slit) return FALSE;
+
+    n= slit->NumberOfSystemLocalities;
+    if(acpu_table_checksum(slit, slit->Header.Length) ||
+       n > NUMA_MAX_NODES ||
+       slit->Header.Length < sizeof(*slit) + n * n) {
+        DebugPrint(DEBUG_ERROR, "ACPI: SLIT is invalid, ignoring it.\n");
+        return FALSE;
+    }
+
+    entries= (uint8_t *)(slit + 1);
+    n= MIN(n, nnodes);
+    for(i= 0; i < n; i++) {
+        memcpy(distances + i * nnodes,
+               entries + i * slit->NumberOfSystemLocalities, n);
+    }
+
+    return TRUE;
+}
+
+/* Fill in the memory access latencies, if the HMAT gives them. */
+static BOOLEAN
+hmat_latencies(struct hagfish_config *cfg, uint32_t *latencies,
+               size_t nnodes) {
+    EFI_ACPI_DESCRIPTION_HEADER *hmat;
+    ACPI_HMAT_LOCALITY_STRUCTURE *best= NULL;
+    uint8_t *p, *table_end;
+    size_t i, j;
+
+    hmat= acpi_get_table(cfg, ACPI_HMAT_SIGNATURE);
+    if(!hmat) return FALSE;
+    if(acpu_table_checksum(hmat, hmat->Length)) {
+        DebugPrint(DEBUG_ERROR, "ACPI: HMAT has invalid checksum!\n");
+        return FALSE;
+    }
+
+    /* Find the memory latency structure, preferring access latency to read
+     * latency. */
+    table_end= (uint8_t *)hmat + hmat->Length;
+    p= (uint8_t *)hmat + sizeof(EFI_ACPI_DESCRIPTION_HEADER) + sizeof(UINT32);
+    while(p + sizeof(ACPI_HMAT_STRUCTURE) <= table_end) {
+        ACPI_HMAT_STRUCTURE *elm= (void *)p;
+        ACPI_HMAT_LOCALITY_STRUCTURE *loc= (void *)p;
+
+        if(elm->Length < sizeof(ACPI_HMAT_STRUCTURE) ||
+           p + elm->Length > table_end) {
+            DebugPrint(DEBUG_ERROR, "ACPI: HMAT contained corrupted element\n");
+            return FALSE;
+        }
+
+        if(elm->Type == ACPI_HMAT_LOCALITY &&
+           elm->Length >= sizeof(ACPI_HMAT_LOCALITY_STRUCTURE) &&
+           ACPI_HMAT_HIERARCHY(loc->Flags) == ACPI_HMAT_MEMORY &&
+           elm->Length >= sizeof(ACPI_HMAT_LOCALITY_STRUCTURE)
+               + ((UINT64)loc->NumberOfInitiators + loc->NumberOfTargets)
+                 * sizeof(UINT32)
+               + (UINT64)loc->NumberOfInitiators * loc->NumberOfTargets
+                 * sizeof(UINT16)) {
+            if(loc->DataType == ACPI_HMAT_ACCESS_LATENCY) best= loc;
+            else if(loc->DataType == ACPI_HMAT_READ_LATENCY && !best)
+                best= loc;
+        }
+
+        p+= elm->Length;
+    }
+    if(!best) return FALSE;
+
+    UINT32 *initiators= (UINT32 *)(best + 1);
+    UINT32 *targets= initiators + best->NumberOfInitiators;
+    UINT16 *entries= (UINT16 *)(targets + best->NumberOfTargets);
+
+    for(i= 0; i < best->NumberOfInitiators; i++) {
+        if(initiators[i] >= nnodes) continue;
+
+        for(j= 0; j < best->NumberOfTargets; j++) {
+            uint64_t ps= (uint64_t)entries[i * best->NumberOfTargets + j]
+                       * best->EntryBaseUnit;
 
+            if(targets[j] >= nnodes) continue;
+            latencies[initiators[i] * nnodes + targets[j]]=
+                MIN(ps, (uint64_t)MAX_UINT32);
+        }
+    }
+
+    return TRUE;
+}
+
+/* Build the NUMA tag from the SRAT, SLIT and HMAT, and steer the kernel's
+ * own allocations to the boot core's node. */
+EFI_STATUS
+acpi_parse_srat(struct hagfish_config *cfg)
+{
+    EFI_ACPI_6_0_SYSTEM_RESOURCE_AFFINITY_TABLE_HEADER *srat;
+    struct multiboot_tag_numa *tag;
+    struct srat_state st;
+    size_t ncpus, nnodes, size, i;
+    uint64_t boot_mpidr;
+
+    cfg->numa= NULL;
+
+    srat= acpi_get_table(cfg,
+            EFI_ACPI_6_0_SYSTEM_RESOURCE_AFFINITY_TABLE_SIGNATURE);
+    if(!srat) return EFI_NOT_FOUND;
+
+    if(acpu_table_checksum(srat, srat->Header.Length)) {
+        DebugPrint(DEBUG_ERROR, "ACPI: SRAT has invalid checksum!\n");
+        return EFI_CRC_ERROR;
+    }
+
+    /* Size. */
+    st.memory= NULL;
+    if(!acpi_walk_srat(srat, &st)) return EFI_CRC_ERROR;
+
+    ncpus= cfg->madt ? cfg->madt->num_cpus : 0;
+    nnodes= (size_t)st.max_node + 1;
+
+    size= sizeof(struct multiboot_tag_numa)
+        + st.nmemory * sizeof(struct multiboot_numa_memory);
+    size_t cpu_nodes_offset= size;
+    size+= ROUNDUP(ncpus * sizeof(uint32_t), sizeof(uint64_t));
+    size_t distances_offset= size;
+    size_t latencies_offset= 0;
+    if(nnodes <= NUMA_MAX_NODES) {
+        size+= ROUNDUP(nnodes * nnodes, sizeof(uint64_t));
+        latencies_offset= size;
+        size+= nnodes * nnodes * sizeof(uint32_t);
+    }
+
+    /* Padded, as the emitter copies the tag whole. */
+    tag= calloc(1, ROUNDUP(size, MULTIBOOT_TAG_ALIGN));
+    if(!tag) {
+        DebugPrint(DEBUG_ERROR, "calloc: %a\n", strerror(errno));
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    /* Fill. */
+    st.memory= tag->memory;
+    acpi_walk_srat(srat, &st);
+
+    tag->type= MULTIBOOT_TAG_TYPE_NUMA;
+    tag->num_nodes= nnodes;
+    tag->num_memory= st.nmemory;
+    tag->num_cpus= ncpus;
+    tag->boot_node= MULTIBOOT_NUMA_UNKNOWN;
+    tag->cpu_nodes_offset= cpu_nodes_offset;
+
+    uint32_t *cpu_nodes= (uint32_t *)((uint8_t *)tag + cpu_nodes_offset);
+    boot_mpidr= arch_boot_mpidr();
+    for(i= 0; i < ncpus; i++) {
+        cpu_nodes[i]= srat_cpu_node(srat, cfg->madt->cpus[i].acpi_uid);
+        if(cfg->madt->cpus[i].mpidr == boot_mpidr)
+            tag->boot_node= cpu_nodes[i];
+    }
+
+    /* Drop the matrices we couldn't fill. */
+    if(latencies_offset) {
+        if(slit_distances(cfg, (uint8_t *)tag + distances_offset, nnodes))
+            tag->distances_offset= distances_offset;
+        if(hmat_latencies(cfg, (uint32_t *)((uint8_t *)tag + latencies_offset),
+                          nnodes))
+            tag->latencies_offset= latencies_offset;
+        else size= latencies_offset;
+        if(!tag->distances_offset && !tag->latencies_offset)
+            size= distances_offset;
+    }
+    tag->size= ROUNDUP(size, MULTIBOOT_TAG_ALIGN);
+
+    /* Place the kernel on the boot core's node. */
+    if(tag->boot_node != MULTIBOOT_NUMA_UNKNOWN) {
+        for(i= 0; i < tag->num_memory; i++) {
+            struct multiboot_numa_memory *m= &tag->memory[i];
+
+            if(m->node != tag->boot_node) continue;
+            if(m->flags & (MULTIBOOT_NUMA_HOTPLUG | MULTIBOOT_NUMA_NONVOLATILE))
+                continue;
+            prefer_memory_range(m->base, m->size);
+        }
+    }
+
+    DebugPrint(DEBUG_INFO,
+               "ACPI: %d NUMA nodes, %d memory ranges, boot node %d\n",
+               nnodes, tag->num_memory, tag->boot_node);
+
+    cfg->numa= tag;
     return EFI_SUCCESS;
+}
+
+/* Remember a UART's registers, if they're memory-mapped. */
+static void
+add_uart(struct hagfish_config *cfg,
+         EFI_ACPI_5_0_GENERIC_ADDRESS_STRUCTURE *gas) {
+    if(gas->AddressSpaceId != EFI_ACPI_6_0_SYSTEM_MEMORY || !gas->Address)
+        return;
+    if(cfg->nuarts == HAGFISH_UARTS_MAX) return;
+
+    cfg->uart_base[cfg->nuarts++]= gas->Address;
+}
+
+/* Find the console and debug UARTs, from the SPCR and DBG2, so that they're
+ * mapped for the kernel even if they're not in the memory map. */
+EFI_STATUS
+acpi_parse_uarts(struct hagfish_config *cfg) {
+    EFI_ACPI_SERIAL_PORT_CONSOLE_REDIRECTION_TABLE *spcr;
+    EFI_ACPI_DEBUG_PORT_2_DESCRIPTION_TABLE *dbg2;
+    size_t i, j;
 
+    cfg->nuarts= 0;
+
+    spcr= acpi_get_table(cfg,
+            EFI_ACPI_6_0_SERIAL_PORT_CONSOLE_REDIRECTION_TABLE_SIGNATURE);
+    if(spcr) {
+        if(acpu_table_checksum(spcr, spcr->Header.Length) ||
+           spcr->Header.Length < sizeof(*spcr)) {
+            DebugPrint(DEBUG_ERROR, "ACPI: SPCR is invalid, ignoring it.\n");
+        }
+        else add_uart(cfg, &spcr->BaseAddress);
+    }
+
+    dbg2= acpi_get_table(cfg, EFI_ACPI_6_0_DEBUG_PORT_2_TABLE_SIGNATURE);
+    if(dbg2) {
+        uint8_t *table_end= (uint8_t *)dbg2 + dbg2->Header.Length;
+        uint8_t *p= (uint8_t *)dbg2 + dbg2->OffsetDbgDeviceInfo;
+
+        if(acpu_table_checksum(dbg2, dbg2->Header.Length)) {
+            DebugPrint(DEBUG_ERROR, "ACPI: DBG2 has invalid checksum!\n");
+            p= table_end;
+        }
+
+        for(i= 0; i < dbg2->NumberDbgDeviceInfo &&
+                  p + sizeof(EFI_ACPI_DBG2_DEBUG_DEVICE_INFORMATION_STRUCT)
+                      <= table_end; i++) {
+            EFI_ACPI_DBG2_DEBUG_DEVICE_INFORMATION_STRUCT *dev= (void *)p;
+            EFI_ACPI_5_0_GENERIC_ADDRESS_STRUCTURE *gas=
+                (void *)(p + dev->BaseAddressRegisterOffset);
+
+            if(dev->Length < sizeof(*dev) || p + dev->Length > table_end ||
+               dev->BaseAddressRegisterOffset
+                   + (size_t)dev->NumberofGenericAddressRegisters
+                     * sizeof(*gas) > dev->Length) {
+                DebugPrint(DEBUG_ERROR,
+                           "ACPI: DBG2 contained corrupted element\n");
+                break;
+            }
+
+            if(dev->PortType == EFI_ACPI_DBG2_PORT_TYPE_SERIAL) {
+                for(j= 0; j < dev->NumberofGenericAddressRegisters; j++)
+                    add_uart(cfg, &gas[j]);
+            }
+
+            p+= dev->Length;
+        }
+    }
+
+    if(cfg->nuarts == 0) return EFI_NOT_FOUND;
+
+    for(i= 0; i < cfg->nuarts; i++)
+        DebugPrint(DEBUG_INFO, "ACPI: UART at %llx\n", cfg->uart_base[i]);
+
+    return EFI_SUCCESS;
 }
 
 EFI_STATUS
@@ -20,8 +20,92 @@ typedef struct {
     UINT8   Length;
 } EFI_ACPI_6_0_MADT_COMMON_ELEMENT;
 
+/* The PPTT (ACPI 6.2) isn't in our EDK headers either. */
+#define ACPI_PPTT_SIGNATURE SIGNATURE_32('P', 'P', 'T', 'T')
+
+#define ACPI_PPTT_PROCESSOR 0
+#define ACPI_PPTT_CACHE     1
+
+/* Processor node flags. */
+#define ACPI_PPTT_PHYSICAL_PACKAGE (1 << 0)
+#define ACPI_PPTT_ID_VALID         (1 << 1)
+#define ACPI_PPTT_THREAD           (1 << 2)
+#define ACPI_PPTT_LEAF             (1 << 3)
+
+/* Cache node flags. */
+#define ACPI_PPTT_SIZE_VALID       (1 << 0)
+#define ACPI_PPTT_SETS_VALID       (1 << 1)
+#define ACPI_PPTT_WAYS_VALID       (1 << 2)
+#define ACPI_PPTT_TYPE_VALID       (1 << 4)
+#define ACPI_PPTT_LINE_SIZE_VALID  (1 << 6)
+
+#define ACPI_PPTT_CACHE_TYPE(attr) (((attr) >> 2) & 0x3)
+#define ACPI_PPTT_CACHE_DATA       0
+#define ACPI_PPTT_CACHE_INSTR      1
+
+#pragma pack(1)
+typedef struct {
+    UINT8   Type;
+    UINT8   Length;
+    UINT16  Reserved;
+    UINT32  Flags;
+    UINT32  Parent;
+    UINT32  AcpiProcessorId;
+    UINT32  NumberOfPrivateResources;
+    UINT32  PrivateResources[0];
+} ACPI_PPTT_PROCESSOR_NODE;
+
+typedef struct {
+    UINT8   Type;
+    UINT8   Length;
+    UINT16  Reserved;
+    UINT32  Flags;
+    UINT32  NextLevelOfCache;
+    UINT32  Size;
+    UINT32  NumberOfSets;
+    UINT8   Associativity;
+    UINT8   Attributes;
+    UINT16  LineSize;
+} ACPI_PPTT_CACHE_NODE;
+#pragma pack()
+
+/* Nor is the HMAT (ACPI 6.2). */
+#define ACPI_HMAT_SIGNATURE SIGNATURE_32('H', 'M', 'A', 'T')
+
+#define ACPI_HMAT_LOCALITY           1
+#define ACPI_HMAT_HIERARCHY(flags)   ((flags) & 0xf)
+#define ACPI_HMAT_MEMORY             0
+#define ACPI_HMAT_ACCESS_LATENCY     0
+#define ACPI_HMAT_READ_LATENCY       1
+
+#pragma pack(1)
+typedef struct {
+    UINT16  Type;
+    UINT16  Reserved;
+    UINT32  Length;
+} ACPI_HMAT_STRUCTURE;
+
+/* Followed by the initiator and target proximity domains (UINT32), and a
+ * UINT16 matrix of entries, in units of EntryBaseUnit picoseconds. */
+typedef struct {
+    UINT16  Type;
+    UINT16  Reserved;
+    UINT32  Length;
+    UINT8   Flags;
+    UINT8   DataType;
+    UINT16  Reserved1;
+    UINT32  NumberOfInitiators;
+    UINT32  NumberOfTargets;
+    UINT32  Reserved2;
+    UINT64  EntryBaseUnit;
+} ACPI_HMAT_LOCALITY_STRUCTURE;
+#pragma pack()
+
 
 EFI_STATUS acpi_find_root_table(struct hagfish_config *cfg);
 EFI_STATUS acpi_parse_madt(struct hagfish_config *cfg);
+EFI_STATUS acpi_parse_pptt(struct hagfish_config *cfg);
+EFI_STATUS acpi_parse_srat(struct hagfish_config *cfg);
+EFI_STATUS acpi_parse_uarts(struct hagfish_config *cfg);
 
 #endif /* __HAGFISH_ACPI_H */
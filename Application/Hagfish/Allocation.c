@@ -16,23 +16,264 @@
 
 /* Application headers */
 #include <Allocation.h>
+#include <Memory.h>
+#include <Util.h>
 
-void *
-allocate_pages(size_t n, EFI_MEMORY_TYPE type) {
+/* The memory local to the boot core, if we know it. */
+static struct {
+    EFI_PHYSICAL_ADDRESS base;
+    UINT64 size;
+} preferred[PREFERRED_RANGES_MAX];
+static size_t npreferred;
+
+/* Prefer this range for the kernel's own regions. */
+void
+prefer_memory_range(EFI_PHYSICAL_ADDRESS base, UINT64 size) {
+    if(npreferred == PREFERRED_RANGES_MAX || size == 0) return;
+
+    preferred[npreferred].base= base;
+    preferred[npreferred].size= size;
+    npreferred++;
+}
+
+/* The regions the kernel touches constantly.  Module images are only read
+ * once, so can go anywhere. */
+static BOOLEAN
+type_is_hot(EFI_MEMORY_TYPE type) {
+    switch((EFI_BARRELFISH_MEMORY_TYPE)type) {
+        case EfiBarrelfishCPUDriver:
+        case EfiBarrelfishCPUDriverStack:
+        case EfiBarrelfishMultibootData:
+        case EfiBarrelfishBootPageTable:
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
+
+/* Try to allocate within one of the preferred ranges.  AllocateMaxAddress
+ * allocates from the top down, so if the result lies below the range, the
+ * range is full. */
+static void *
+allocate_preferred_pages(size_t n, EFI_MEMORY_TYPE type) {
     EFI_STATUS status;
     EFI_PHYSICAL_ADDRESS memory;
+    size_t i;
 
-    if(n == 0) return NULL;
+    for(i= 0; i < npreferred; i++) {
+        if(preferred[i].size < n * EFI_PAGE_SIZE) continue;
+
+        memory= preferred[i].base + preferred[i].size - 1;
+        status= gBS->AllocatePages(AllocateMaxAddress, type, n, &memory);
+        if(EFI_ERROR(status)) continue;
+
+        if(memory >= preferred[i].base) {
+            memory_map_note(memory, n, type);
+            return (void *)memory;
+        }
+
+        gBS->FreePages(memory, n);
+    }
+
+    return NULL;
+}
+
+/* Get n pages directly from the firmware. */
+static void *
+reserve_pages(size_t n, EFI_MEMORY_TYPE type) {
+    EFI_STATUS status;
+    EFI_PHYSICAL_ADDRESS memory;
+
+    if(npreferred > 0 && type_is_hot(type)) {
+        void *p= allocate_preferred_pages(n, type);
+        if(p) return p;
+    }
 
     status = gBS->AllocatePages(AllocateAnyPages, type, n, &memory);
     if(EFI_ERROR(status)) {
         DebugPrint(DEBUG_ERROR, "AllocatePages: %r\n", status);
         return NULL;
     }
+    memory_map_note(memory, n, type);
+
+    return (void *)memory;
+}
+
+/* Get n pages from the firmware, aligned to 'align', by over-allocating and
+ * returning the excess at either end. */
+static void *
+reserve_aligned_pages(size_t n, size_t align, EFI_MEMORY_TYPE type) {
+    size_t extra= align / PAGE_4k - 1;
+    char *p, *base;
+    size_t head;
+
+    p= reserve_pages(n + extra, type);
+    if(!p) return NULL;
+
+    base= (char *)ROUNDUP((uint64_t)p, align);
+    head= (base - p) / PAGE_4k;
+    free_pages(p, head);
+    free_pages(base + n * PAGE_4k, extra - head);
+
+    return base;
+}
+
+/* Each Barrelfish memory type is allocated from its own arena: a chunk of at
+ * least ARENA_CHUNK_PAGES, 2MiB-aligned, that we reserve from the firmware in
+ * one go and hand out in order.  Each chunk is a single descriptor in the
+ * memory map, where each allocation would otherwise be at least one. */
+#define ARENA_TYPES (EfiBarrelfishMaxMemType - EfiBarrelfishFirstMemType)
+
+static struct {
+    char *next, *end;
+} arenas[ARENA_TYPES];
+static size_t arena_allocations, arena_chunks;
+
+/* The firmware's descriptor count before we took the first chunk. */
+static size_t arena_descriptors_before;
+
+/* The number of descriptors in the firmware's map, or 0 if it won't say. */
+static size_t
+firmware_descriptors(void) {
+    UINTN size, d_size;
+
+    if(EFI_ERROR(measure_memory_map(&size, &d_size)) || d_size == 0)
+        return 0;
+    return size / d_size;
+}
+
+/* Give the unused end of the type's current chunk back to the firmware. */
+static void
+release_arena(size_t i) {
+    if(arenas[i].next < arenas[i].end)
+        free_pages(arenas[i].next, (arenas[i].end - arenas[i].next) / PAGE_4k);
+    arenas[i].next= arenas[i].end= NULL;
+}
+
+/* Allocate n pages, aligned to 'align', which must be a power of two and at
+ * least PAGE_4k e.g. PAGE_2M or PAGE_1G, to allow block mappings. */
+void *
+allocate_aligned_pages(size_t n, size_t align, EFI_MEMORY_TYPE type) {
+    size_t i= type - EfiBarrelfishFirstMemType;
+    char *base;
+
+    if(n == 0) return NULL;
+    ASSERT(align >= PAGE_4k && (align & (align - 1)) == 0);
+
+    if((UINT32)type < EfiBarrelfishFirstMemType ||
+       (UINT32)type >= EfiBarrelfishMaxMemType)
+        return reserve_aligned_pages(n, align, type);
+
+    base= (char *)ROUNDUP((uint64_t)arenas[i].next, align);
+    if(!arenas[i].end || base + n * PAGE_4k > arenas[i].end) {
+        size_t chunk= ROUNDUP(n, ARENA_CHUNK_PAGES);
+
+        if(arena_chunks == 0) arena_descriptors_before= firmware_descriptors();
+        base= reserve_aligned_pages(chunk, MAX(align, PAGE_2M), type);
+        if(!base) {
+            /* Memory is tight, so don't insist on a whole chunk. */
+            arena_allocations++;
+            return reserve_aligned_pages(n, align, type);
+        }
+
+        release_arena(i);
+        arenas[i].end= base + chunk * PAGE_4k;
+        arena_chunks++;
+    }
+    else if(base > arenas[i].next) {
+        /* Don't hold on to the alignment padding. */
+        free_pages(arenas[i].next, (base - arenas[i].next) / PAGE_4k);
+    }
+
+    arenas[i].next= base + n * PAGE_4k;
+    arena_allocations++;
+
+    return base;
+}
+
+void *
+allocate_pages(size_t n, EFI_MEMORY_TYPE type) {
+    return allocate_aligned_pages(n, PAGE_4k, type);
+}
+
+/* Return the unused ends of all arenas to the firmware.  This must be done
+ * after the last allocation, but before we take the final memory map, so
+ * that it doesn't show the spare pages as belonging to Barrelfish. */
+void
+release_arenas(void) {
+    size_t i;
+
+    for(i= 0; i < ARENA_TYPES; i++) release_arena(i);
+
+    DebugPrint(DEBUG_INFO,
+               "%d allocations from %d arena chunks, "
+               "%d memory descriptors before, %d after.\n",
+               arena_allocations, arena_chunks, arena_descriptors_before,
+               firmware_descriptors());
+}
+
+/* Allocate n pages at a fixed physical address, failing quietly if any of
+ * them are already in use. */
+void *
+allocate_pages_at(EFI_PHYSICAL_ADDRESS base, size_t n, EFI_MEMORY_TYPE type) {
+    EFI_STATUS status;
+    EFI_PHYSICAL_ADDRESS memory= base;
+
+    if(n == 0) return NULL;
+
+    status= gBS->AllocatePages(AllocateAddress, type, n, &memory);
+    if(EFI_ERROR(status)) {
+        DebugPrint(DEBUG_INFO, "AllocatePages(%lx): %r\n", base, status);
+        return NULL;
+    }
+    memory_map_note(memory, n, type);
 
     return (void *)memory;
 }
 
+/* Free pages from allocate_pages() or allocate_pages_at(), or any part of
+ * them. */
+void
+free_pages(void *base, size_t n) {
+    EFI_STATUS status;
+    EFI_PHYSICAL_ADDRESS memory= (EFI_PHYSICAL_ADDRESS)base;
+
+    if(n == 0) return;
+
+    status= gBS->FreePages(memory, n);
+    if(EFI_ERROR(status)) {
+        DebugPrint(DEBUG_ERROR, "FreePages: %r\n", status);
+        return;
+    }
+    memory_map_note(memory, n, EfiConventionalMemory);
+}
+
+/* Change the EFI memory type of a range of pages that we already own, by
+ * handing them back to the firmware and immediately reclaiming the same
+ * frames with the new type.  The range may be part of a larger allocation. */
+EFI_STATUS
+retype_pages(void *base, size_t n, EFI_MEMORY_TYPE type) {
+    EFI_STATUS status;
+    EFI_PHYSICAL_ADDRESS memory= (EFI_PHYSICAL_ADDRESS)base;
+
+    if(n == 0) return EFI_SUCCESS;
+
+    status= gBS->FreePages(memory, n);
+    if(EFI_ERROR(status)) {
+        DebugPrint(DEBUG_ERROR, "FreePages: %r\n", status);
+        return status;
+    }
+
+    status= gBS->AllocatePages(AllocateAddress, type, n, &memory);
+    if(EFI_ERROR(status)) {
+        DebugPrint(DEBUG_ERROR, "AllocatePages: %r\n", status);
+        return status;
+    }
+    memory_map_note(memory, n, type);
+
+    return EFI_SUCCESS;
+}
+
 void *
 allocate_pool(size_t size, EFI_MEMORY_TYPE type) {
     EFI_STATUS status;
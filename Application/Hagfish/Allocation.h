@@ -29,7 +29,20 @@ typedef enum {
     EfiBarrelfishMaxMemType
 } EFI_BARRELFISH_MEMORY_TYPE;
 
+/* The most memory ranges allocate_pages() will try first. */
+#define PREFERRED_RANGES_MAX 16
+
+/* The smallest chunk that a memory type's arena reserves at once. */
+#define ARENA_CHUNK_PAGES 512
+
+void prefer_memory_range(EFI_PHYSICAL_ADDRESS base, UINT64 size);
 void *allocate_pages(size_t n, EFI_MEMORY_TYPE type);
+void *allocate_aligned_pages(size_t n, size_t align, EFI_MEMORY_TYPE type);
+void release_arenas(void);
+void *allocate_pages_at(EFI_PHYSICAL_ADDRESS base, size_t n,
+                        EFI_MEMORY_TYPE type);
+void free_pages(void *base, size_t n);
+EFI_STATUS retype_pages(void *base, size_t n, EFI_MEMORY_TYPE type);
 void *allocate_pool(size_t size, EFI_MEMORY_TYPE type);
 void *allocate_zero_pool(size_t size, EFI_MEMORY_TYPE type);
 
@@ -183,7 +183,43 @@ parse_config(char *buf, size_t size) {
 
                 memcpy(arg, buf+astart, alen);
                 arg[alen]= '\0';
-                cfg->stack_size= strtoul(arg, NULL, 10);
+                cfg->stack_size= AsciiStrDecimalToUintn(arg);
+            }
+            else if(!strncmp("granule", buf+tstart, 7)) {
+                char arg[10];
+                size_t astart, alen;
+
+                cursor= skip_whitespace(buf, size, cursor, FALSE);
+                if(!istoken(buf[cursor])) {
+                    DebugPrint(DEBUG_ERROR, "Expected granule size\n");
+                    goto parse_fail;
+                }
+                astart= cursor;
+
+                cursor= get_token(buf, size, cursor);
+                alen= cursor - astart;
+                ASSERT(alen <= size - cursor);
+
+                if(alen > 9) {
+                    DebugPrint(DEBUG_ERROR, "Granule size field too long\n");
+                    goto parse_fail;
+                }
+
+                memcpy(arg, buf+astart, alen);
+                arg[alen]= '\0';
+                cfg->granule= AsciiStrDecimalToUintn(arg);
+            }
+            else if(!strncmp("timing", buf+tstart, 6)) {
+                cfg->timing= 1;
+                cursor= find_eol(buf, size, cursor);
+            }
+            else if(!strncmp("reclaim", buf+tstart, 7)) {
+                cfg->reclaim_boot_services= 1;
+                cursor= find_eol(buf, size, cursor);
+            }
+            else if(!strncmp("fullclean", buf+tstart, 9)) {
+                cfg->full_clean= 1;
+                cursor= find_eol(buf, size, cursor);
             }
             else if(!strncmp("bootdriver", buf+tstart, 10)) {
                 if(cfg->boot_driver) {
@@ -300,6 +336,11 @@ free_bookkeeping(struct hagfish_config *cfg) {
     /* The configuration file itself. */
     if(cfg->buf) free(cfg->buf);
 
+    /* The ACPI digests, which have been copied into the multiboot info. */
+    if(cfg->madt) free(cfg->madt);
+    if(cfg->topology) free(cfg->topology);
+    if(cfg->numa) free(cfg->numa);
+
     /* The memory region list. */
     if(cfg->ram_regions) free_region_list(cfg->ram_regions);
 
@@ -26,6 +26,9 @@
  * the configuration file. */
 #define DEFAULT_STACK_SIZE 16384
 
+/* The most UARTs that we'll map for the kernel from the SPCR and DBG2. */
+#define HAGFISH_UARTS_MAX 4
+
 extern const char *hagfish_config_fmt;
 
 struct component_config {
@@ -49,6 +52,20 @@ struct hagfish_config {
     EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER *acpi2_header;
     EFI_ACPI_1_0_ROOT_SYSTEM_DESCRIPTION_POINTER *acpi1_header;
 
+    /* The MADT digest, built by acpi_parse_madt(). */
+    struct multiboot_tag_madt *madt;
+
+    /* The CPU and cache topology, built by acpi_parse_pptt(). */
+    struct multiboot_tag_topology *topology;
+
+    /* The NUMA affinity map, built by acpi_parse_srat(). */
+    struct multiboot_tag_numa *numa;
+
+    /* The MMIO bases of the console and debug UARTs, from the SPCR and
+     * DBG2, found by acpi_parse_uarts(). */
+    uint64_t uart_base[HAGFISH_UARTS_MAX];
+    size_t nuarts;
+
     /* The multiboot information structure. */
     void *multiboot;
 
@@ -56,13 +73,21 @@ struct hagfish_config {
      * to be filled in after all allocation is finished. */
     struct multiboot_tag_efi_mmap *mmap_tag;
     void *mmap_start;
+    struct multiboot_tag_free_memory *free_memory_tag;
+    size_t free_memory_max; /* Ranges reserved in free_memory_tag. */
+    size_t mmap_max; /* Bytes reserved in mmap_tag. */
+    struct multiboot_tag_timestamps *timestamps_tag;
+    struct multiboot_tag_page_tables *page_tables_tag;
+    struct multiboot_tag_mmap_stats *mmap_stats_tag;
 
     /* The list of physical memory regions. */
     struct region_list *ram_regions;
     struct region_list *device_regions;
 
-    /* The kernel's initial page tables. */
+    /* The kernel's initial page tables, and the requested translation
+     * granule in bytes (0 for the default, 4kB). */
     struct page_tables *tables;
+    size_t granule;
 
     /* The boot driver */
     struct component_config *boot_driver;
@@ -73,9 +98,19 @@ struct hagfish_config {
     struct component_config *cpu_driver;
     struct region_list *cpu_driver_segments;
     void *cpu_driver_entry;
+    struct multiboot_tag_symtab_64 *kernel_symbols;
     void *kernel_stack;
     size_t stack_size;
 
+    /* Print the boot phase timings before exiting boot services. */
+    int timing;
+
+    /* Pass boot services memory to the kernel as conventional memory. */
+    int reclaim_boot_services;
+
+    /* Clean the whole data cache at handoff, not just what we wrote. */
+    int full_clean;
+
     /* The additional modules. */
     struct component_config *first_module, *last_module;
 };
@@ -9,7 +9,6 @@
  */
 
 #include <errno.h>
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
@@ -54,6 +53,9 @@
 #include <Util.h>
 #include <Loader.h>
 #include <Acpi.h>
+#include <Multiboot.h>
+#include <Symbols.h>
+#include <Timestamp.h>
 
 #define roundpage(x) COVER((x), PAGE_4k)
 
@@ -118,510 +120,350 @@ load_component(struct hagfish_loader *loader, struct component_config *cmp,
     return 1;
 }
 
+/* Collect the loadable program headers, which appear in order of virtual
+ * address.  Returns how many there are. */
+static size_t
+collect_loads(const Elf64_View *elf, const Elf64_Phdr **loads) {
+    size_t i, n;
 
-#define ROUND_UP(x, y) (((x) + ((y) - 1)) & ~((y) - 1))
-
-#define ALIGN(x) ROUND_UP((x), sizeof(uintptr_t))
-
-/* Allocate and fill the Multiboot information structure.  The memory map is
- * preallocated, but left empty until all allocations are finished. */
-void *
-create_multiboot_info(struct hagfish_config *cfg,
-                      struct hagfish_loader *loader) {
-    UINTN size, npages;
-    struct component_config *cmp;
-    void *cursor;
-
-    /* Calculate the boot information size. */
-    /* Fixed header */
-    size= ALIGN(sizeof(struct multiboot_header));
-
-    /* CPU Driver entry point*/
-    size+= ALIGN(sizeof(struct multiboot_tag_efi64));
-
-    /* cpu driver command line */
-    size+= ALIGN(sizeof(struct multiboot_tag_string)
-         + cfg->cpu_driver->args_len+1);
-    /* DCHP ack packet */
-    size+= ALIGN(sizeof(struct multiboot_tag_network)
-         + sizeof(EFI_PXE_BASE_CODE_PACKET));
-    /* ACPI 1.0 header */
-    if(cfg->acpi1_header) {
-        size+= ALIGN(sizeof(struct multiboot_tag_old_acpi)
-             + sizeof(EFI_ACPI_1_0_ROOT_SYSTEM_DESCRIPTION_POINTER));
+    for(i= 0, n= 0; i < elf->ev_phnum; i++) {
+        if(elf->ev_phdr[i].p_type == PT_LOAD) loads[n++]= &elf->ev_phdr[i];
     }
-    /* ACPI 2.0+ header */
-    if(cfg->acpi2_header) {
-        size+= ALIGN(sizeof(struct multiboot_tag_new_acpi)
-             + sizeof(EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER));
-    }
-    /* Boot driver module tag, including command line and ELF image */
-    size+= ALIGN(sizeof(struct multiboot_tag_module_64)
-         + cfg->boot_driver->args_len+1 + cfg->boot_driver->image_size);
-    /* CPU driver module tag, including command line and ELF image */
-    size+= ALIGN(sizeof(struct multiboot_tag_module_64)
-             + cfg->cpu_driver->args_len+1 + cfg->cpu_driver->image_size);
-    /* All other modules */
-    for(cmp= cfg->first_module; cmp; cmp= cmp->next) {
-        size+= ALIGN(sizeof(struct multiboot_tag_module_64)
-             + cmp->args_len+1 + cmp->image_size);
-    }
-    /* EFI memory map */
-    size+= ALIGN(sizeof(struct multiboot_tag_efi_mmap)
-         + MEM_MAP_SIZE);
-
-    /* Round up to a page size and allocate. */
-    npages= roundpage(size);
-    cfg->multiboot= allocate_pages(npages, EfiBarrelfishMultibootData);
-    if(!cfg->multiboot) {
-        DebugPrint(DEBUG_ERROR, "allocate_pages: failed\n");
-        return NULL;
-    }
-    memset(cfg->multiboot, 0, npages * PAGE_4k);
-    AsciiPrint("Allocated %d pages for %dB multiboot info at %p.\n",
-               npages, size, cfg->multiboot);
-
-    cursor= cfg->multiboot;
-    {
-        //AsciiPrint("creating multiboot_header\n");
-        //AsciiPrint("%-10a:%016lx\n","addr",cursor);
-
-        struct multiboot_header *hdr = (struct multiboot_header *)cursor;
-        hdr->magic = MULTIBOOT2_BOOTLOADER_MAGIC;
-        hdr->architecture = MULTIBOOT_ARCHITECTURE_AARCH64;
-        hdr->header_length = size;
-        hdr->checksum = -(hdr->magic + hdr->architecture + hdr->header_length);
-        cursor+= ALIGN(sizeof(struct multiboot_header));
-        
-        //AsciiPrint("%-10a:%d\n","magic",hdr->magic);
-        //AsciiPrint("%-10a:%d\n","arch",hdr->architecture);
-        //AsciiPrint("%-10a:%d\n","len",hdr->header_length);
-        //AsciiPrint("%-10a:%08x\n\n","checksum",hdr->checksum);
-    }
-    /* Add the ELF section headers. */
 
-    {
-        //AsciiPrint("creating multiboot_tag_efi64\n");
-        //AsciiPrint("%-10a:%016lx\n","addr",cursor);
-        struct multiboot_tag_efi64 *efi=
-            (struct multiboot_tag_efi64 *)cursor;
-
-        efi->type = MULTIBOOT_TAG_TYPE_EFI64;
-        efi->size = ALIGN(sizeof(struct multiboot_tag_efi64));
-        efi->pointer = (uint64_t)cfg->cpu_driver_entry;
+    return n;
+}
 
-        cursor+= ALIGN(sizeof(struct multiboot_tag_efi64));
+/* Find the loadable segment that contains 'vaddr', by binary search.
+ * Returns nloads if there isn't one. */
+static size_t
+find_load(const Elf64_Phdr **loads, size_t nloads, Elf64_Addr vaddr) {
+    size_t lo= 0, hi= nloads;
 
-        //AsciiPrint("%-10a:%d\n","type",efi->type);
-        //AsciiPrint("%-10a:%d\n","size",efi->size);
-        //AsciiPrint("%-10a:%016lx\n\n","pointer",efi->pointer);
-    }
+    while(lo < hi) {
+        size_t mid= lo + (hi - lo) / 2;
 
-    /* Add the boot command line */
-    {
-        //AsciiPrint("creating multiboot_tag_string\n");
-        //AsciiPrint("%-10a:%016lx\n","addr",cursor);
-        struct multiboot_tag_string *bootcmd=
-            (struct multiboot_tag_string *)cursor;
-
-        bootcmd->type= MULTIBOOT_TAG_TYPE_CMDLINE;
-        bootcmd->size= ALIGN(sizeof(struct multiboot_tag_string)
-                     + cfg->cpu_driver->args_len+1);
-        ntstring(bootcmd->string,
-                 cfg->buf + cfg->cpu_driver->args_start,
-                 cfg->cpu_driver->args_len);
-
-        cursor+= ALIGN(sizeof(struct multiboot_tag_string)
-               + cfg->cpu_driver->args_len+1);
-
-        //AsciiPrint("%-10a:%d\n","type",bootcmd->type);
-        //AsciiPrint("%-10a:%d\n","size",bootcmd->size);
-        //AsciiPrint("%-10a:%a\n\n","cmdline",bootcmd->string);
+        if(loads[mid]->p_vaddr <= vaddr) lo= mid + 1;
+        else hi= mid;
     }
-    /* Add the boot command line */
 
-    /* Add the DHCP ack packet. */
-    {
-        //AsciiPrint("creating multiboot_network\n");
-        //AsciiPrint("%-10a:%016lx\n","addr",cursor);
-        loader->prepare_multiboot_fn(loader, &cursor);
-        //AsciiPrint("%-10a:%d\n","type",MULTIBOOT_TAG_TYPE_NETWORK);
-        //UINTN _size = ALIGN(sizeof(struct multiboot_tag_network) + sizeof(EFI_PXE_BASE_CODE_PACKET));
-
-        //AsciiPrint("%-10a:%d\n","size",_size);
-        //AsciiPrint("%-10a:%a\n\n","dhcpack","NULL");
-    }
-    /* Add the ACPI 1.0 header */
-    if(cfg->acpi1_header) {
-        //AsciiPrint("creating multiboot_tag_old_acpi\n");
-        //AsciiPrint("%-10a:%016lx\n","addr",cursor);
-        struct multiboot_tag_old_acpi *acpi=
-            (struct multiboot_tag_old_acpi *)cursor;
-
-        acpi->type= MULTIBOOT_TAG_TYPE_ACPI_OLD;
-        acpi->size= ALIGN(sizeof(struct multiboot_tag_old_acpi)
-                  + sizeof(EFI_ACPI_1_0_ROOT_SYSTEM_DESCRIPTION_POINTER));
-        memcpy(&acpi->rsdp[0], cfg->acpi1_header,
-               sizeof(EFI_ACPI_1_0_ROOT_SYSTEM_DESCRIPTION_POINTER));
-
-        cursor+= ALIGN(sizeof(struct multiboot_tag_old_acpi)
-               + sizeof(EFI_ACPI_1_0_ROOT_SYSTEM_DESCRIPTION_POINTER));
-        
-        //AsciiPrint("%-10a:%d\n","type",acpi->type);
-        //AsciiPrint("%-10a:%d\n","size",acpi->size);
-        //AsciiPrint("%-10a:%a\n\n","rsdp","NULL");
-    }
-    /* Add the ACPI 2.0+ header */
-    if(cfg->acpi2_header) {
-        //AsciiPrint("creating multiboot_tag_new_acpi\n");
-        //AsciiPrint("%-10a:%016lx\n","addr",cursor);
-        struct multiboot_tag_new_acpi *acpi=
-            (struct multiboot_tag_new_acpi *)cursor;
-
-        acpi->type= MULTIBOOT_TAG_TYPE_ACPI_NEW;
-        acpi->size= ALIGN(sizeof(struct multiboot_tag_new_acpi)
-                  + sizeof(EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER));
-        memcpy(&acpi->rsdp[0], cfg->acpi2_header,
-               sizeof(EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER));
-
-        cursor+= ALIGN(sizeof(struct multiboot_tag_new_acpi)
-               + sizeof(EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER));
-
-        //AsciiPrint("%-10a:%d\n","type",acpi->type);
-        //AsciiPrint("%-10a:%d\n","size",acpi->size);
-        //AsciiPrint("%-10a:%a\n\n","rsdp","NULL");
-    }
-    /* Add the boot driver module. */
-    {
-        //AsciiPrint("creating multiboot_tag_module_64\n");
-        //AsciiPrint("%-10a:%016lx\n","addr",cursor);
-        struct multiboot_tag_module_64 *kernel=
-            (struct multiboot_tag_module_64 *)cursor;
-
-        kernel->type= MULTIBOOT_TAG_TYPE_MODULE_64;
-        kernel->size= ALIGN(sizeof(struct multiboot_tag_module_64)
-                    + cfg->boot_driver->args_len+1  + cfg->boot_driver->image_size);
-        kernel->mod_start=
-            (multiboot_uint64_t)cfg->boot_driver->image_address;
-        kernel->mod_end=
-            (multiboot_uint64_t)(cfg->boot_driver->image_address +
-                                 (cfg->boot_driver->image_size - 1));
-        ntstring(kernel->cmdline,
-                 cfg->buf + cfg->boot_driver->args_start,
-                 cfg->boot_driver->args_len);
-
-        cursor+= ALIGN(sizeof(struct multiboot_tag_module_64)
-               + cfg->boot_driver->args_len+1 + cfg->boot_driver->image_size);
-
-        //AsciiPrint("%-10a:%a\n","kind","boot_driver");
-        //AsciiPrint("%-10a:%d\n","type",kernel->type);
-        //AsciiPrint("%-10a:%d\n","size",kernel->size);
-        //AsciiPrint("%-10a:%016lx\n","mod_start",kernel->mod_start);
-        //AsciiPrint("%-10a:%016lx\n","mod_end",kernel->mod_end);
-        //AsciiPrint("%-10a:%a\n\n","cmdline",kernel->cmdline);
-    }
-    /* Add the kernel module. */
-    {
-        //AsciiPrint("creating multiboot_tag_module_64\n");
-        //AsciiPrint("%-10a:%016lx\n","addr",cursor);
-        struct multiboot_tag_module_64 *kernel=
-            (struct multiboot_tag_module_64 *)cursor;
-
-        kernel->type= MULTIBOOT_TAG_TYPE_MODULE_64;
-        kernel->size= ALIGN(sizeof(struct multiboot_tag_module_64)
-                    + cfg->cpu_driver->args_len+1  + cfg->cpu_driver->image_size);
-        kernel->mod_start=
-            (multiboot_uint64_t)cfg->cpu_driver->image_address;
-        kernel->mod_end=
-            (multiboot_uint64_t)(cfg->cpu_driver->image_address +
-                                 (cfg->cpu_driver->image_size - 1));
-        ntstring(kernel->cmdline,
-                 cfg->buf + cfg->cpu_driver->args_start,
-                 cfg->cpu_driver->args_len);
-
-        cursor+= ALIGN(sizeof(struct multiboot_tag_module_64)
-               + cfg->cpu_driver->args_len+1 + cfg->cpu_driver->image_size);
-
-        //AsciiPrint("%-10a:%a\n","kind","cpu_driver");
-        //AsciiPrint("%-10a:%d\n","type",kernel->type);
-        //AsciiPrint("%-10a:%d\n","size",kernel->size);
-        //AsciiPrint("%-10a:%016lx\n","mod_start",kernel->mod_start);
-        //AsciiPrint("%-10a:%016lx\n","mod_end",kernel->mod_end);
-        //AsciiPrint("%-10a:%a\n\n","cmdline",kernel->cmdline);
-    }
-    /* Add the remaining modules */
-    for(cmp= cfg->first_module; cmp; cmp= cmp->next) {
-        //AsciiPrint("creating multiboot_tag_module_64\n");
-        //AsciiPrint("%-10a:%016lx\n","addr",cursor);
-        
-        struct multiboot_tag_module_64 *module=
-            (struct multiboot_tag_module_64 *)cursor;
-
-        module->type= MULTIBOOT_TAG_TYPE_MODULE_64;
-        module->size= ALIGN(sizeof(struct multiboot_tag_module_64)
-                    + cmp->args_len+1 + cmp->image_size);
-        module->mod_start=
-            (multiboot_uint64_t)cmp->image_address;
-        module->mod_end=
-            (multiboot_uint64_t)(cmp->image_address +
-                                 (cmp->image_size - 1));
-        ntstring(module->cmdline, cfg->buf + cmp->args_start, cmp->args_len);
-
-        cursor+= ALIGN(sizeof(struct multiboot_tag_module_64)
-               + cmp->args_len+1 + cmp->image_size);
-
-        //AsciiPrint("%-10a:%a\n","kind","other");
-        //AsciiPrint("%-10a:%d\n","type",module->type);
-        //AsciiPrint("%-10a:%d\n","size",module->size);
-        //AsciiPrint("%-10a:%016lx\n","mod_start",module->mod_start);
-        //AsciiPrint("%-10a:%016lx\n","mod_end",module->mod_end);
-        //AsciiPrint("%-10a:%a\n\n","cmdline",module->cmdline);
-    }
-    /* Record the position of the memory map, to be filled in after we've
-     * finished doing allocations. */
-    //AsciiPrint("creating multiboot_tag_efi_mmap\n");
-    //AsciiPrint("%-10a:%016lx\n","addr",cursor);
-    cfg->mmap_tag= (struct multiboot_tag_efi_mmap *)cursor;
-    cursor+= ALIGN(sizeof(struct multiboot_tag_efi_mmap));
-    cfg->mmap_start= cursor;
-    //AsciiPrint("%-10a:%016lx\n","mmap_addr",cursor);
-
-    return cfg->multiboot;
+    /* { lo is the first segment that starts above vaddr. } */
+    if(lo == 0 || vaddr - loads[lo-1]->p_vaddr >= loads[lo-1]->p_memsz)
+        return nloads;
+    return lo - 1;
 }
 
-void print_multiboot_layout(struct hagfish_config *cfg)
-{
-    void *cursor = cfg->multiboot;
-    AsciiPrint("multiboot_header ----------------------------\n");
-    {
-        struct multiboot_header *data = (struct multiboot_header*)cursor;
-        AsciiPrint("%-10a:%016lx\n","addr",data);
-        AsciiPrint("%-10a:%d\n","magic",data->magic);
-        AsciiPrint("%-10a:%d\n","arch",data->architecture);
-        AsciiPrint("%-10a:%d\n","len",data->header_length);
-        AsciiPrint("%-10a:%08x\n","checksum",data->checksum);
-        cursor+= ALIGN(sizeof(struct multiboot_header));
-    }
-    AsciiPrint("multiboot_tag_efi64--------------------------\n");
-    {
-        struct multiboot_tag_efi64 *data = (struct multiboot_tag_efi64*)cursor;
-        AsciiPrint("%-10a:%016lx\n","addr",data);
-        AsciiPrint("%-10a:%d\n","type",data->type);
-        AsciiPrint("%-10a:%d\n","size",data->size);
-        AsciiPrint("%-10a:%016lx\n","pointer",data->pointer);
-        cursor+= ALIGN(sizeof(struct multiboot_tag_efi64));
-    }
-    AsciiPrint("multiboot_tag_string-------------------------\n");
-    {
-        struct multiboot_tag_string *data = (struct multiboot_tag_string*)cursor;
-        AsciiPrint("%-10a:%016lx\n","addr",data);
-        AsciiPrint("%-10a:%d\n","type",data->type);
-        AsciiPrint("%-10a:%d\n","size",data->size);
-        AsciiPrint("%-10a:%a\n","cmdline",data->string);
-        cursor+= ALIGN(sizeof(struct multiboot_tag_string)
-               + cfg->cpu_driver->args_len+1);
-    }
-    AsciiPrint("multiboot_tag_network------------------------\n");
-    {
-        struct multiboot_tag_network *data = (struct multiboot_tag_network*)cursor;
-        AsciiPrint("%-10a:%016lx\n","addr",data);
-        AsciiPrint("%-10a:%d\n","type",data->type);
-        AsciiPrint("%-10a:%d\n","size",data->size);
-        AsciiPrint("%-10a:%a\n","dhcpack","NULL");
-        cursor += ALIGN(sizeof(struct multiboot_tag_network)
-         + sizeof(EFI_PXE_BASE_CODE_PACKET));
-    }
-    if(cfg->acpi1_header) {
-        AsciiPrint("multiboot_tag_old_acpi-----------------------\n");
-        struct multiboot_tag_old_acpi *data = 
-            (struct multiboot_tag_old_acpi *)cursor;
-        AsciiPrint("%-10a:%016lx\n","addr",data);
-        AsciiPrint("%-10a:%d\n","type",data->type);
-        AsciiPrint("%-10a:%d\n","size",data->size);
-        AsciiPrint("%-10a:%a\n","rsdp","NULL");
-        cursor+= ALIGN(sizeof(struct multiboot_tag_old_acpi)
-               + sizeof(EFI_ACPI_1_0_ROOT_SYSTEM_DESCRIPTION_POINTER));
-    }
-    if(cfg->acpi2_header){
-        AsciiPrint("multiboot_tag_new_acpi-----------------------\n");
-        struct multiboot_tag_new_acpi *data =
-            (struct multiboot_tag_new_acpi *)cursor;
-        AsciiPrint("%-10a:%016lx\n","addr",data);
-        AsciiPrint("%-10a:%d\n","type",data->type);
-        AsciiPrint("%-10a:%d\n","size",data->size);
-        AsciiPrint("%-10a:%a\n","dhcpack","rsdp");
-        cursor+= ALIGN(sizeof(struct multiboot_tag_new_acpi)
-               + sizeof(EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER));
-    }
-    AsciiPrint("multiboot_tag_module_64----------------------\n");
-    {
-        struct multiboot_tag_module_64 *data=
-            (struct multiboot_tag_module_64 *)cursor;
-        AsciiPrint("%-10a:%a\n","kind","boot_driver");
-        AsciiPrint("%-10a:%016lx\n","addr",data);
-        AsciiPrint("%-10a:%d\n","type",data->type);
-        AsciiPrint("%-10a:%d\n","size",data->size);
-        AsciiPrint("%-10a:%016lx\n","mod_start",data->mod_start);
-        AsciiPrint("%-10a:%016lx\n","mod_end",data->mod_end);
-        AsciiPrint("%-10a:%a\n","cmdline",data->cmdline);
-        cursor+= ALIGN(sizeof(struct multiboot_tag_module_64)
-               + cfg->boot_driver->args_len+1 + cfg->boot_driver->image_size);
-        
-        data = (struct multiboot_tag_module_64 *)cursor;
-        AsciiPrint("%-10a:%a\n","kind","cpu_driver");
-        AsciiPrint("%-10a:%016lx\n","addr",data);
-        AsciiPrint("%-10a:%d\n","type",data->type);
-        AsciiPrint("%-10a:%d\n","size",data->size);
-        AsciiPrint("%-10a:%016lx\n","mod_start",data->mod_start);
-        AsciiPrint("%-10a:%016lx\n","mod_end",data->mod_end);
-        AsciiPrint("%-10a:%a\n","cmdline",data->cmdline);
-        cursor+= ALIGN(sizeof(struct multiboot_tag_module_64)
-               + cfg->cpu_driver->args_len+1 + cfg->cpu_driver->image_size);
-        
-        struct component_config *cmp;
-        for(cmp= cfg->first_module; cmp; cmp = cmp->next){
-            data = (struct multiboot_tag_module_64 *)cursor;
-            AsciiPrint("%-10a:%a\n","kind","other");
-            AsciiPrint("%-10a:%016lx\n","addr",data);
-            AsciiPrint("%-10a:%d\n","type",data->type);
-            AsciiPrint("%-10a:%d\n","size",data->size);
-            AsciiPrint("%-10a:%016lx\n","mod_start",data->mod_start);
-            AsciiPrint("%-10a:%016lx\n","mod_end",data->mod_end);
-            AsciiPrint("%-10a:%a\n","cmdline",data->cmdline);
-            cursor+= ALIGN(sizeof(struct multiboot_tag_module_64)
-               + cmp->args_len+1 + cmp->image_size);
-        }
-    }
-    AsciiPrint("multiboot_tag_efi_mmap-----------------------\n");
-    {
-        struct multiboot_tag_efi_mmap *data=
-            (struct multiboot_tag_efi_mmap *)cursor;
-        AsciiPrint("%-10a:%016lx\n","addr",data);
-        AsciiPrint("%-10a:%d\n","type",data->type);
-        AsciiPrint("%-10a:%d\n","size",data->size);
-        AsciiPrint("%-10a:%d\n","descr_size",data->descr_size);
-        AsciiPrint("%-10a:%d\n","descr_ver",data->descr_vers);
-        AsciiPrint("%-10a:%016lx\n","mmap_addr",data->efi_mmap);
-        
-        AsciiPrint("efi_mmap_content-----------------------------\n");
-        print_meomry_map_addr((uint64_t)data->efi_mmap);
-    }
+/* How far the nth loadable segment has moved from where it was linked.  The
+ * region is page-aligned, but the segment keeps the page offset of its
+ * virtual address. */
+static Elf64_Sxword
+load_delta(struct region_list *segments, const Elf64_Phdr **loads,
+           size_t n) {
+    return segments->regions[n].base
+         + (loads[n]->p_vaddr & (PAGE_4k - 1)) - loads[n]->p_vaddr;
 }
 
+/* Apply the image's relocations to the loaded segments.  The nth region
+ * holds the nth loadable segment, and each may have moved by a different
+ * amount, so each relocation is applied within the segment that it targets,
+ * and its value is moved with the segment that it points into. */
 EFI_STATUS
-relocate_elf(struct region_list *segments, Elf *elf,
-             Elf64_Phdr *phdr, size_t phnum, size_t shnum, uint64_t kernel_offset) {
-    EFI_STATUS status;
-    size_t i;
+relocate_elf(struct region_list *segments, const Elf64_View *elf,
+             uint64_t kernel_offset) {
+    EFI_STATUS status= EFI_SUCCESS;
+    const Elf64_Phdr **loads;
+    size_t nloads, i;
 
     DebugPrint(DEBUG_INFO, "Relocating kernel image.\n");
 
+    loads= malloc((elf->ev_phnum + 1) * sizeof(*loads));
+    if(!loads) {
+        DebugPrint(DEBUG_ERROR, "malloc: %a\n", strerror(errno));
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    nloads= collect_loads(elf, loads);
+    if(nloads == 0 || nloads != segments->nregions) {
+        DebugPrint(DEBUG_ERROR, "No loadable segment to relocate.\n");
+        status= EFI_LOAD_ERROR;
+        goto relocate_elf_done;
+    }
+
     /* Search for relocaton sections. */
-    for(i= 0; i < shnum; i++) {
-        Elf_Scn *scn= elf_getscn(elf, i);
-        if(!scn) {
-            DebugPrint(DEBUG_ERROR, "elf_getscn: %a\n",
+    for(i= 0; i < elf->ev_shnum; i++) {
+        const Elf64_Shdr *shdr= elf64_view_getshdr(elf, i);
+        if(!shdr) {
+            DebugPrint(DEBUG_ERROR, "elf64_view_getshdr: %a\n",
                        elf_errmsg(elf_errno()));
-            return EFI_LOAD_ERROR;
+            status= EFI_LOAD_ERROR;
+            goto relocate_elf_done;
         }
 
-        Elf64_Shdr *shdr= elf64_getshdr(scn);
-        if(!shdr) {
-            DebugPrint(DEBUG_ERROR, "elf64_getshdr: %a\n",
+        if(shdr->sh_type != SHT_REL && shdr->sh_type != SHT_RELA) continue;
+
+        if(shdr->sh_info != 0) {
+            DebugPrint(DEBUG_ERROR,
+                "I expected global relocations, but got"
+                " section-specific ones.\n");
+            status= EFI_UNSUPPORTED;
+            goto relocate_elf_done;
+        }
+
+        if(shdr->sh_size == 0) continue;
+
+        if(shdr->sh_type == SHT_REL) {
+            DebugPrint(DEBUG_ERROR, "SHT_REL unimplemented.\n");
+            status= EFI_LOAD_ERROR;
+            goto relocate_elf_done;
+        }
+
+        size_t nrel;
+        const Elf64_Rela *rela= elf64_view_getrela(elf, shdr, &nrel);
+        if(!rela) {
+            DebugPrint(DEBUG_ERROR, "elf64_view_getrela: %a\n",
                        elf_errmsg(elf_errno()));
-            return EFI_LOAD_ERROR;
+            status= EFI_LOAD_ERROR;
+            goto relocate_elf_done;
         }
 
-        if(shdr->sh_type == SHT_REL ||
-           shdr->sh_type == SHT_RELA) {
-            if(shdr->sh_info != 0) {
+        /* Iterate through the relocations. */
+        size_t j;
+        for(j= 0; j < nrel; j++) {
+            const Elf64_Rela *rel= &rela[j];
+            Elf64_Addr offset= rel->r_offset;
+            Elf64_Xword sym= ELF64_R_SYM(rel->r_info);
+            Elf64_Xword type= ELF64_R_TYPE(rel->r_info);
+            Elf64_Sxword addend= rel->r_addend;
+
+            /* The target must lie wholly within a loaded segment. */
+            size_t n= find_load(loads, nloads, offset);
+            if(n == nloads ||
+               loads[n]->p_memsz - (offset - loads[n]->p_vaddr) <
+               sizeof(uint64_t)) {
                 DebugPrint(DEBUG_ERROR,
-                    "I expected global relocations, but got"
-                    " section-specific ones.\n");
-                return EFI_UNSUPPORTED;
+                           "Relocation at %lx is outside the loaded"
+                           " segments.\n", offset);
+                status= EFI_LOAD_ERROR;
+                goto relocate_elf_done;
             }
+            uint64_t *rel_target=
+                (void *)offset + load_delta(segments, loads, n);
+
+            /* A value past the end of every segment, e.g. _end, moves with
+             * the first. */
+            size_t v= find_load(loads, nloads, addend);
+            if(v == nloads) v= 0;
 
-            /* Hardcoded for one loadable segment.
-                XXX: seems to be not always the case for some ARMv8 builids.
-            */
-            //ASSERT(phnum == 1);
-
-            Elf64_Addr segment_elf_base= phdr[0].p_vaddr;
-            Elf64_Addr segment_load_base= segments->regions[0].base;
-            Elf64_Sxword segment_delta= segment_load_base - segment_elf_base;
-
-            /* Walk the section data descriptors. */
-            Elf_Data *reldata;
-            for(reldata= elf_getdata(scn, NULL);
-                reldata;
-                reldata= elf_getdata(scn, reldata)) {
-                size_t rsize;
-                if(shdr->sh_type == SHT_REL) rsize= sizeof(Elf64_Rel);
-                else                         rsize= sizeof(Elf64_Rela);
-
-                size_t nrel= reldata->d_size / rsize;
-
-                /* Iterate through the relocations. */
-                size_t i;
-                for(i= 0; i < nrel; i++) {
-                    void *reladdr= reldata->d_buf + i * rsize;
-                    Elf64_Addr offset;
-                    Elf64_Xword sym, type;
-                    Elf64_Sxword addend;
-
-                    if(shdr->sh_type == SHT_REL) {
+            switch(type) {
+                case R_AARCH64_RELATIVE:
+                    if(sym != 0) {
                         DebugPrint(DEBUG_ERROR,
-                                   "SHT_REL unimplemented.\n");
-                        return EFI_LOAD_ERROR;
+                                   "Relocation references a"
+                                   " dynamic symbol, which is"
+                                   " unsupported.\n");
+                        status= EFI_UNSUPPORTED;
+                        goto relocate_elf_done;
                     }
-                    else { /* SHT_RELA */
-                        Elf64_Rela *rel= reladdr;
 
-                        offset= rel->r_offset;
-                        sym= ELF64_R_SYM(rel->r_info);
-                        type= ELF64_R_TYPE(rel->r_info);
-                        addend= rel->r_addend;
-
-                        uint64_t *rel_target= (void *)offset + segment_delta;
-
-                        switch(type) {
-                            case R_AARCH64_RELATIVE:
-                                if(sym != 0) {
-                                    DebugPrint(DEBUG_ERROR,
-                                               "Relocation references a"
-                                               " dynamic symbol, which is"
-                                               " unsupported.\n");
-                                    return EFI_UNSUPPORTED;
-                                }
-
-                                /* Delta(S) + A */
-                                *rel_target= addend + segment_delta + kernel_offset;
+                    /* Delta(S) + A */
+                    *rel_target= addend + load_delta(segments, loads, v)
+                               + kernel_offset;
 
 #if 0
-                                AsciiPrint("REL %p -> %llx\n",
-                                           rel_target, *rel_target);
+                    AsciiPrint("REL %p -> %llx\n",
+                               rel_target, *rel_target);
 #endif
-                                break;
-
-                            default:
-                                DebugPrint(DEBUG_ERROR,
-                                           "Unsupported relocation type %d\n",
-                                           type);
-                                return EFI_UNSUPPORTED;
-                        }
-                    }
+                    break;
+
+                default:
+                    DebugPrint(DEBUG_ERROR,
+                               "Unsupported relocation type %d\n",
+                               type);
+                    status= EFI_UNSUPPORTED;
+                    goto relocate_elf_done;
+            }
 
 #if 0
-                    AsciiPrint("REL: offset %llx, addend %llx, type %d"
-                               ", symbol %d\n",
-                               offset, addend, type, sym);
+            AsciiPrint("REL: offset %llx, addend %llx, type %d"
+                       ", symbol %d\n",
+                       offset, addend, type, sym);
 #endif
-                }
+        }
+    }
+
+relocate_elf_done:
+    free(loads);
+    return status;
+}
+
+/* Can we load segment n where it is, in the downloaded image, rather than
+ * copying it out?  The image is page-aligned, so the file offset and the
+ * virtual address need to agree modulo the page size, and the whole segment,
+ * BSS included, must fit in the image's pages.  Relocating it and zeroing
+ * its BSS overwrites whatever else is in those pages, so they mustn't
+ * overlap those of any segment before it that's also loaded in place.
+ * in_place[] says which those are. */
+static int
+segment_in_place(struct component_config *component, const Elf64_View *elf,
+                 size_t n, const uint8_t *in_place) {
+    const Elf64_Phdr *phdr= elf->ev_phdr;
+    uint64_t image_end= roundpage(component->image_size) * PAGE_4k;
+    uint64_t start, end;
+    size_t i;
+
+    if((phdr[n].p_offset & (PAGE_4k - 1)) != (phdr[n].p_vaddr & (PAGE_4k - 1)))
+        return 0;
+
+    if(phdr[n].p_filesz > phdr[n].p_memsz ||
+       phdr[n].p_offset > image_end ||
+       phdr[n].p_memsz > image_end - phdr[n].p_offset)
+        return 0;
+
+    start= ROUNDDOWN(phdr[n].p_offset, PAGE_4k);
+    end= ROUNDUP(phdr[n].p_offset + phdr[n].p_memsz, PAGE_4k);
+    for(i= 0; i < n; i++) {
+        if(!in_place[i]) continue;
+
+        if(start < ROUNDUP(phdr[i].p_offset + phdr[i].p_memsz, PAGE_4k) &&
+           ROUNDDOWN(phdr[i].p_offset, PAGE_4k) < end)
+            return 0;
+    }
+
+    return 1;
+}
+
+/* Give back the pages of the downloaded image that no segment was loaded
+ * into, once we've stopped reading it. */
+static void
+free_image_gaps(void *image, size_t npages, struct region_list *segments) {
+    size_t p, run= 0, i;
+
+    for(p= 0; p <= npages; p++) {
+        uint64_t addr= (uint64_t)image + p * PAGE_4k;
+        BOOLEAN used= p == npages;
+
+        for(i= 0; !used && i < segments->nregions; i++) {
+            used= addr >= segments->regions[i].base &&
+                  addr - segments->regions[i].base <
+                  segments->regions[i].npages * PAGE_4k;
+        }
+
+        if(!used) {
+            run++;
+        }
+        else if(run > 0) {
+            free_pages((char *)image + (p - run) * PAGE_4k, run);
+            run= 0;
+        }
+    }
+}
+
+/* An image that has been prelinked for a fixed physical load address carries
+ * a note recording it: the physical address of its first loadable segment.
+ * Its relocations have already been applied for that address. */
+#define PRELINK_NOTE_NAME "Hagfish"
+#define PRELINK_NOTE_TYPE 1
+
+#define NOTE_ALIGN(x) ROUNDUP((x), 4)
+
+static int
+find_prelink_note(const Elf64_View *elf, uint64_t *base) {
+    size_t i;
+
+    for(i= 0; i < elf->ev_phnum; i++) {
+        const Elf64_Phdr *phdr= &elf->ev_phdr[i];
+        if(phdr->p_type != PT_NOTE) continue;
+        if(phdr->p_offset > elf->ev_size ||
+           phdr->p_filesz > elf->ev_size - phdr->p_offset) continue;
+
+        const unsigned char *note= elf->ev_image + phdr->p_offset;
+        const unsigned char *end= note + phdr->p_filesz;
+
+        while(end - note >= (ptrdiff_t)sizeof(Elf64_Nhdr)) {
+            const Elf64_Nhdr *nhdr= (const Elf64_Nhdr *)note;
+            const char *name= (const char *)(nhdr + 1);
+            const unsigned char *desc=
+                (const unsigned char *)name + NOTE_ALIGN(nhdr->n_namesz);
+
+            if(nhdr->n_namesz > (size_t)(end - note) ||
+               nhdr->n_descsz > (size_t)(end - note) ||
+               desc + NOTE_ALIGN(nhdr->n_descsz) > end) break;
+
+            if(nhdr->n_type == PRELINK_NOTE_TYPE &&
+               nhdr->n_namesz == sizeof(PRELINK_NOTE_NAME) &&
+               nhdr->n_descsz == sizeof(uint64_t) &&
+               !memcmp(name, PRELINK_NOTE_NAME,
+                       sizeof(PRELINK_NOTE_NAME))) {
+                memcpy(base, desc, sizeof(uint64_t));
+                return 1;
             }
+
+            note= desc + NOTE_ALIGN(nhdr->n_descsz);
         }
     }
 
-    return EFI_SUCCESS;
+    return 0;
+}
+
+/* Copy a segment into its pages, zeroing whatever isn't covered by the
+ * file. */
+static void
+copy_segment(void *p_buf, UINTN p_pageoff, UINTN p_pages,
+             const void *src, UINTN filesz) {
+    memset(p_buf, 0, p_pageoff);
+    memcpy(p_buf + p_pageoff, src, filesz);
+    memset(p_buf + p_pageoff + filesz, 0,
+           p_pages * PAGE_4k - p_pageoff - filesz);
+}
+
+/* Try to load every segment at a fixed physical address, with the first
+ * loadable segment at base and the rest at the same relative positions as
+ * in the image.  If any of the memory isn't free, release whatever we did
+ * get and leave the segment list empty. */
+static EFI_STATUS
+load_segments_fixed(struct component_config *component,
+                    const Elf64_View *elf, uint64_t base,
+                    struct region_list *segments) {
+    const Elf64_Phdr *phdr= elf->ev_phdr;
+    uint64_t first_vaddr= 0;
+    int first= 1;
+    size_t i;
+
+    for(i= 0; i < elf->ev_phnum; i++) {
+        if(phdr[i].p_type != PT_LOAD) continue;
+
+        if(first) {
+            first_vaddr= phdr[i].p_vaddr;
+            first= 0;
+        }
+
+        uint64_t target= base + (phdr[i].p_vaddr - first_vaddr);
+        UINTN p_pageoff= target & (PAGE_4k - 1);
+        UINTN p_pages= COVER(p_pageoff + phdr[i].p_memsz, PAGE_4k);
+
+        if(p_pageoff != (phdr[i].p_vaddr & (PAGE_4k - 1))) break;
+
+        void *p_buf= allocate_pages_at(target - p_pageoff, p_pages,
+                                       EfiBarrelfishCPUDriver);
+        if(!p_buf) break;
+
+        copy_segment(p_buf, p_pageoff, p_pages,
+                     component->image_address + phdr[i].p_offset,
+                     phdr[i].p_filesz);
+
+        segments->regions[segments->nregions].base= (uint64_t)p_buf;
+        segments->regions[segments->nregions].npages= p_pages;
+        segments->nregions++;
+    }
+
+    if(i == elf->ev_phnum) return EFI_SUCCESS;
+
+    for(i= 0; i < segments->nregions; i++) {
+        free_pages((void *)segments->regions[i].base,
+                   segments->regions[i].npages);
+    }
+    segments->nregions= 0;
+
+    return EFI_NOT_FOUND;
 }
 
 EFI_STATUS
@@ -631,37 +473,23 @@ prepare_component(struct hagfish_loader *loader, struct component_config *compon
     EFI_STATUS status;
     size_t i;
 
-    elf_version(EV_CURRENT);
-    Elf *img_elf= elf_memory(component->image_address, component->image_size);
-    if(!img_elf) {
-        DebugPrint(DEBUG_ERROR, "elf_memory: %a\n", elf_errmsg(elf_errno()));
-        return EFI_LOAD_ERROR;
-    }
-
-    const char *e_ident= elf_getident(img_elf, NULL);
-    if(!e_ident) {
-        DebugPrint(DEBUG_ERROR, "elf_getident: %a\n",
-                   elf_errmsg(elf_errno()));
-        return EFI_LOAD_ERROR;
-    }
-
-    if(e_ident[EI_CLASS] != ELFCLASS64 || e_ident[EI_DATA] != ELFDATA2LSB) {
+    /* The image is already in memory, so we just take a view of it, rather
+     * than having libelf translate it. */
+    Elf64_View img_elf;
+    if(elf64_view(&img_elf, component->image_address,
+                  component->image_size)) {
+        DebugPrint(DEBUG_ERROR, "elf64_view: %a\n", elf_errmsg(elf_errno()));
         DebugPrint(DEBUG_ERROR, "Error: Not a 64-bit little-endian ELF\n");
         return EFI_LOAD_ERROR;
     }
 
-    if(e_ident[EI_OSABI] != ELFOSABI_STANDALONE &&
-       e_ident[EI_OSABI] != ELFOSABI_NONE) {
+    const Elf64_Ehdr *ehdr= img_elf.ev_ehdr;
+
+    if(ehdr->e_ident[EI_OSABI] != ELFOSABI_STANDALONE &&
+       ehdr->e_ident[EI_OSABI] != ELFOSABI_NONE) {
         DebugPrint(DEBUG_WARN,
                    "Warning: Compiled for OS ABI %d.  Wrong compiler?\n",
-                   e_ident[EI_OSABI]);
-    }
-
-    Elf64_Ehdr *ehdr= elf64_getehdr(img_elf);
-    if(!ehdr) {
-        DebugPrint(DEBUG_ERROR, "elf64_getehdr: %a\n",
-                   elf_errmsg(elf_errno()));
-        return EFI_LOAD_ERROR;
+                   ehdr->e_ident[EI_OSABI]);
     }
 
     if(ehdr->e_type != ET_EXEC) {
@@ -678,22 +506,10 @@ prepare_component(struct hagfish_loader *loader, struct component_config *compon
     DebugPrint(DEBUG_INFO, "Unrelocated kernel entry point is %x\n",
                ehdr->e_entry);
 
-    size_t phnum;
-    status= elf_getphdrnum(img_elf, &phnum);
-    if(status) {
-        DebugPrint(DEBUG_ERROR, "elf64_getehdr: %a\n",
-                   elf_errmsg(elf_errno()));
-        return EFI_LOAD_ERROR;
-    }
+    size_t phnum= img_elf.ev_phnum;
+    const Elf64_Phdr *phdr= img_elf.ev_phdr;
     DebugPrint(DEBUG_LOADFILE, "Found %d program header(s)\n", phnum);
 
-    Elf64_Phdr *phdr= elf64_getphdr(img_elf);
-    if(!phdr) {
-        DebugPrint(DEBUG_ERROR, "elf64_getphdr: %a\n",
-                   elf_errmsg(elf_errno()));
-        return EFI_LOAD_ERROR;
-    }
-
     /* Count the loadable segments, to allocate the region list. */
     size_t nloadsegs= 0;
     for(i= 0; i < phnum; i++) {
@@ -703,7 +519,7 @@ prepare_component(struct hagfish_loader *loader, struct component_config *compon
     struct region_list *segments = malloc(sizeof(struct region_list) +
                                             nloadsegs * sizeof(struct ram_region));
     if(!segments) {
-        DebugPrint(DEBUG_ERROR, "malloc: %s\n", strerror(errno));
+        DebugPrint(DEBUG_ERROR, "malloc: %a\n", strerror(errno));
         return EFI_OUT_OF_RESOURCES;
     }
 
@@ -711,10 +527,82 @@ prepare_component(struct hagfish_loader *loader, struct component_config *compon
 
     segments->nregions= 0;
 
-    /* Load the CPU driver from its ELF image. */
-    int found_entry_point= 0;
-    void *entry_point;
+    /* Find where the first loadable segment was linked. */
+    const Elf64_Phdr *first_load= NULL;
     for(i= 0; i < phnum; i++) {
+        if(phdr[i].p_type == PT_LOAD) {
+            first_load= &phdr[i];
+            break;
+        }
+    }
+    if(!first_load) {
+        DebugPrint(DEBUG_ERROR, "No loadable segments.\n");
+        return EFI_LOAD_ERROR;
+    }
+
+    /* If the image was prelinked, try to put it where it expects to be, and
+     * skip relocation.  Otherwise try the address that it was linked for, in
+     * which case the relocation is at least position-independent. */
+    uint64_t fixed_base;
+    int prelinked= find_prelink_note(&img_elf, &fixed_base);
+    if(!prelinked) fixed_base= first_load->p_vaddr - kernel_offset;
+
+    int fixed= !EFI_ERROR(load_segments_fixed(component, &img_elf,
+                                              fixed_base, segments));
+    if(fixed) {
+        DebugPrint(DEBUG_INFO, "Loaded at fixed address %lx%a\n",
+                   fixed_base,
+                   prelinked ? ", prelinked" : "");
+    }
+    else if(prelinked) {
+        DebugPrint(DEBUG_INFO,
+                   "Prelink address %lx is in use, relocating.\n",
+                   fixed_base);
+        prelinked= 0;
+    }
+
+    /* Choose the segments to load in place, within the downloaded image. */
+    uint8_t *in_place= calloc(phnum + 1, sizeof(uint8_t));
+    if(!in_place) {
+        DebugPrint(DEBUG_ERROR, "calloc: %a\n", strerror(errno));
+        return EFI_OUT_OF_RESOURCES;
+    }
+    size_t nin_place= 0;
+    for(i= 0; !fixed && i < phnum; i++) {
+        if(phdr[i].p_type != PT_LOAD) continue;
+
+        in_place[i]= segment_in_place(component, &img_elf, i, in_place);
+        if(in_place[i]) nin_place++;
+    }
+
+    /* Those segments are relocated, and their BSS zeroed, over the image,
+     * but the module tag must refer to the image as it was loaded.  Keep a
+     * copy of it for that, and read everything else from the copy.  The
+     * pages of the original that don't end up in a segment are freed. */
+    void *image= component->image_address;
+    size_t image_pages= roundpage(component->image_size);
+    if(nin_place > 0) {
+        void *copy= allocate_pages(image_pages, EfiBarrelfishELFData);
+        if(!copy) {
+            DebugPrint(DEBUG_ERROR, "allocate_pages: failed\n");
+            free(in_place);
+            return EFI_OUT_OF_RESOURCES;
+        }
+        memcpy(copy, image, component->image_size);
+        component->image_address= copy;
+
+        if(elf64_view(&img_elf, copy, component->image_size)) {
+            DebugPrint(DEBUG_ERROR, "elf64_view: %a\n",
+                       elf_errmsg(elf_errno()));
+            free(in_place);
+            return EFI_LOAD_ERROR;
+        }
+        ehdr= img_elf.ev_ehdr;
+        phdr= img_elf.ev_phdr;
+    }
+
+    /* Load the CPU driver from its ELF image. */
+    for(i= 0; !fixed && i < phnum; i++) {
         DebugPrint(DEBUG_LOADFILE,
                    "Segment %d load address %p, file size %x, memory size %x",
                    i, phdr[i].p_vaddr, phdr[i].p_filesz, phdr[i].p_memsz);
@@ -722,45 +610,84 @@ prepare_component(struct hagfish_loader *loader, struct component_config *compon
         DebugPrint(DEBUG_LOADFILE, "\n");
         if(phdr[i].p_type != PT_LOAD) continue;
 
-        UINTN p_pages= COVER(phdr[i].p_memsz, PAGE_4k);
+        /* The segment is loaded at the same offset within its first page as
+         * its virtual address. */
+        UINTN p_pageoff= phdr[i].p_vaddr & (PAGE_4k - 1);
+        UINTN p_pages= COVER(p_pageoff + phdr[i].p_memsz, PAGE_4k);
         void *p_buf;
 
-        p_buf= allocate_pages(p_pages, EfiBarrelfishCPUDriver);
-        if(!p_buf) {
-            DebugPrint(DEBUG_ERROR, "allocate_pages: %r\n", status);
-            return EFI_OUT_OF_RESOURCES;
+        if(in_place[i]) {
+            /* Use the downloaded image directly, and hand the pages over to
+             * the CPU driver.  Only the BSS, and the rest of the segment's
+             * first and last pages, need zeroing. */
+            void *p_load= image + phdr[i].p_offset;
+            p_buf= p_load - p_pageoff;
+
+            status= retype_pages(p_buf, p_pages, EfiBarrelfishCPUDriver);
+            if(EFI_ERROR(status)) {
+                DebugPrint(DEBUG_ERROR, "retype_pages: %r\n", status);
+                free(in_place);
+                return EFI_OUT_OF_RESOURCES;
+            }
+            DebugPrint(DEBUG_LOADFILE, "Loading in place, %d pages at %p\n",
+                       p_pages, p_buf);
+
+            memset(p_buf, 0, p_pageoff);
+            memset(p_load + phdr[i].p_filesz, 0,
+                   p_pages * PAGE_4k - p_pageoff - phdr[i].p_filesz);
+        }
+        else {
+            p_buf= allocate_pages(p_pages, EfiBarrelfishCPUDriver);
+            if(!p_buf) {
+                DebugPrint(DEBUG_ERROR, "allocate_pages: failed\n");
+                free(in_place);
+                return EFI_OUT_OF_RESOURCES;
+            }
+            DebugPrint(DEBUG_LOADFILE, "Loading into %d pages at %p\n",
+                       p_pages, p_buf);
+
+            copy_segment(p_buf, p_pageoff, p_pages,
+                         component->image_address + phdr[i].p_offset,
+                         phdr[i].p_filesz);
         }
-        memset(p_buf, 0, p_pages * PAGE_4k);
-        DebugPrint(DEBUG_LOADFILE, "Loading into %d pages at %p\n",
-                   p_pages, p_buf);
 
-        segments->regions[i].base= (uint64_t)p_buf;
-        segments->regions[i].npages= p_pages;
+        segments->regions[segments->nregions].base= (uint64_t)p_buf;
+        segments->regions[segments->nregions].npages= p_pages;
         segments->nregions++;
+    }
+
+    if(nin_place > 0) free_image_gaps(image, image_pages, segments);
+    free(in_place);
 
-        memcpy(p_buf, component->image_address + phdr[i].p_offset,
-               phdr[i].p_filesz);
+    /* Find the entry point.  The nth region holds the nth loadable segment,
+     * at the same page offset as its virtual address. */
+    int found_entry_point= 0;
+    void *entry_point;
+    size_t n;
+    for(i= 0, n= 0; i < phnum; i++) {
+        if(phdr[i].p_type != PT_LOAD) continue;
 
         if(ehdr->e_entry >= phdr[i].p_vaddr &&
            ehdr->e_entry - phdr[i].p_vaddr < phdr[i].p_memsz) {
+            void *p_load= (void *)segments->regions[n].base
+                        + (phdr[i].p_vaddr & (PAGE_4k - 1));
             entry_point=
-                (cpu_driver_entry)(p_buf + (ehdr->e_entry - phdr[i].p_vaddr));
+                (cpu_driver_entry)(p_load + (ehdr->e_entry - phdr[i].p_vaddr));
             found_entry_point= 1;
+            break;
         }
+        n++;
     }
 
-    size_t shnum;
-    status= elf_getshdrnum(img_elf, &shnum);
-    if(status) {
-        DebugPrint(DEBUG_ERROR, "elf_getshdrnum: %a\n",
-                   elf_errmsg(elf_errno()));
-        return EFI_LOAD_ERROR;
+    if(prelinked) {
+        DebugPrint(DEBUG_INFO, "Image is prelinked, not relocating.\n");
     }
-
-    status= relocate_elf(segments, img_elf, phdr, phnum, shnum, kernel_offset);
-    if(EFI_ERROR(status)) {
-        DebugPrint(DEBUG_ERROR, "Relocation failed.\n");
-        return EFI_LOAD_ERROR;
+    else {
+        status= relocate_elf(segments, &img_elf, kernel_offset);
+        if(EFI_ERROR(status)) {
+            DebugPrint(DEBUG_ERROR, "Relocation failed.\n");
+            return EFI_LOAD_ERROR;
+        }
     }
 
     if(!found_entry_point) {
@@ -769,10 +696,19 @@ prepare_component(struct hagfish_loader *loader, struct component_config *compon
         return EFI_LOAD_ERROR;
     }
 
-    *ret_entry_point = entry_point + kernel_offset;
+    /* The relocated segments go to the kernel, and text needs the
+     * instruction cache invalidating. */
+    for(i= 0, n= 0; i < phnum; i++) {
+        if(phdr[i].p_type != PT_LOAD) continue;
 
-    /* Finished with the kernel ELF. */
-    elf_end(img_elf);
+        arch_handoff_range((void *)segments->regions[n].base,
+                           segments->regions[n].npages * PAGE_4k,
+                           (phdr[i].p_flags & PF_X) ? HANDOFF_EXECUTE
+                                                    : HANDOFF_CLEAN);
+        n++;
+    }
+
+    *ret_entry_point = entry_point + kernel_offset;
 
     return EFI_SUCCESS;
 }
@@ -802,16 +738,21 @@ prepare_cpu_driver(struct hagfish_config *cfg, struct hagfish_loader *loader)
         DebugPrint(DEBUG_ERROR, "Failed allocate kernel stack\n");
         return EFI_OUT_OF_RESOURCES;
     }
+    arch_handoff_range(cfg->kernel_stack,
+                       COVER(cfg->stack_size, PAGE_4k) * PAGE_4k,
+                       HANDOFF_INVALIDATE);
 
 
     EFI_STATUS status = prepare_component(loader, cfg->cpu_driver,
                                           &cfg->cpu_driver_segments,
                                           &cfg->cpu_driver_entry, KERNEL_OFFSET);
+    if(EFI_ERROR(status)) return status;
+
     DebugPrint(DEBUG_INFO,
                "Relocated CPU driver entry point is %lp, stack at %lp\n",
                cfg->cpu_driver_entry, cfg->kernel_stack);
 
-    return status;
+    return build_kernel_symbols(cfg, KERNEL_OFFSET);
 }
 
 EFI_LOADED_IMAGE_PROTOCOL *
@@ -1197,6 +1138,8 @@ UefiMain(IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE *SystemTable) {
 
     gBS->SetWatchdogTimer (0, 0, 0, NULL);
 
+    start_timestamps();
+
     //AsciiPrint("try_shell = %d\n", try_shell);
     AsciiPrint("Hagfish UEFI loader starting\n");
 
@@ -1236,6 +1179,7 @@ UefiMain(IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE *SystemTable) {
     /* Load and parse the configuration file. */
     struct hagfish_config *cfg= load_config(&loader);
     if(!cfg) return EFI_SUCCESS;
+    timestamp(MULTIBOOT_PHASE_CONFIG);
 
     /* looking for ACPI tables */
     status = acpi_find_root_table(cfg);
@@ -1244,9 +1188,28 @@ UefiMain(IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE *SystemTable) {
         if(EFI_ERROR(status)) {
             DebugPrint(DEBUG_ERROR, "ACPI: could not parse MADT. Info not available\n");
         }
+        else {
+            status = acpi_parse_pptt(cfg);
+            if(EFI_ERROR(status)) {
+                DebugPrint(DEBUG_ERROR, "ACPI: could not build the CPU topology.\n");
+            }
+        }
+
+        /* This also steers the kernel's allocations to the boot core's
+         * node, so must come before we load anything. */
+        status = acpi_parse_srat(cfg);
+        if(EFI_ERROR(status)) {
+            DebugPrint(DEBUG_INFO, "ACPI: no NUMA information.\n");
+        }
+
+        status = acpi_parse_uarts(cfg);
+        if(EFI_ERROR(status)) {
+            DebugPrint(DEBUG_INFO, "ACPI: no UART described.\n");
+        }
     } else {
         DebugPrint(DEBUG_ERROR, "ACPI: root tables not found.\n");
     }
+    timestamp(MULTIBOOT_PHASE_ACPI);
 
     /* Load the boot driver. */
     DebugPrint(DEBUG_INFO, "Loading the boot driver [");
@@ -1254,6 +1217,7 @@ UefiMain(IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE *SystemTable) {
         DebugPrint(DEBUG_ERROR, "\nFailed to load the kernel.\n");
         return EFI_SUCCESS;
     }
+    timestamp(MULTIBOOT_PHASE_LOAD_BOOT_DRIVER);
     DebugPrint(DEBUG_INFO, "].\n");
 
     /* Load the kernel. */
@@ -1262,6 +1226,7 @@ UefiMain(IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE *SystemTable) {
         DebugPrint(DEBUG_ERROR, "\nFailed to load the kernel.\n");
         return EFI_SUCCESS;
     }
+    timestamp(MULTIBOOT_PHASE_LOAD_CPU_DRIVER);
     DebugPrint(DEBUG_INFO, "].\n");
 
     /* Load the modules */
@@ -1276,6 +1241,7 @@ UefiMain(IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE *SystemTable) {
                 DebugPrint(DEBUG_ERROR, "Failed to load module.\n");
                 return EFI_SUCCESS;
             }
+            timestamp(MULTIBOOT_PHASE_LOAD_MODULE);
         }
     }
     DebugPrint(DEBUG_INFO, "].\n");
@@ -1286,6 +1252,7 @@ UefiMain(IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE *SystemTable) {
         DebugPrint(DEBUG_ERROR, "Failed to get RAM regions.\n");
         return EFI_SUCCESS;
     }
+    timestamp(MULTIBOOT_PHASE_RAM_REGIONS);
     print_ram_regions(cfg->ram_regions);
 
     /* Build the direct-mapped page tables for the kernel. */
@@ -1294,12 +1261,14 @@ UefiMain(IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE *SystemTable) {
         DebugPrint(DEBUG_ERROR, "Failed to create initial page table.\n");
         return EFI_SUCCESS;
     }
+    timestamp(MULTIBOOT_PHASE_PAGE_TABLES);
 
     status = prepare_boot_driver(cfg, &loader);
     if(EFI_ERROR(status)) {
         DebugPrint(DEBUG_ERROR, "Failed to prepare boot driver.\n");
         return EFI_SUCCESS;
     }
+    timestamp(MULTIBOOT_PHASE_PREPARE_BOOT_DRIVER);
 
     /* Load the CPU driver from its ELF image, and relocate it. */
     status= prepare_cpu_driver(cfg, &loader);
@@ -1307,12 +1276,14 @@ UefiMain(IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE *SystemTable) {
         DebugPrint(DEBUG_ERROR, "Failed to prepare CPU driver.\n");
         return EFI_SUCCESS;
     }
+    timestamp(MULTIBOOT_PHASE_PREPARE_CPU_DRIVER);
 
     /* Create the multiboot header. */
     if(!create_multiboot_info(cfg, &loader)) {
         DebugPrint(DEBUG_ERROR, "Failed to create multiboot structure.\n");
         return EFI_SUCCESS;
     }
+    timestamp(MULTIBOOT_PHASE_MULTIBOOT);
 
     /* Finished with loading. */
     status= loader.done_fn(&loader);
@@ -1334,13 +1305,26 @@ UefiMain(IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE *SystemTable) {
     void *multiboot= cfg->multiboot;
     void *kernel_stack= cfg->kernel_stack;
     size_t stack_size= cfg->stack_size;
-    void *root_table= get_root_table(cfg);
+    struct multiboot_tag_page_tables *page_tables_tag= cfg->page_tables_tag;
+    struct multiboot_tag_timestamps *timestamps_tag= cfg->timestamps_tag;
+    struct multiboot_tag_mmap_stats *mmap_stats_tag= cfg->mmap_stats_tag;
+    int reclaim_boot_services= cfg->reclaim_boot_services;
+    int full_clean= cfg->full_clean;
 
     ASSERT(kernel_entry);
     ASSERT(multiboot);
     ASSERT(kernel_stack);
     ASSERT(stack_size > 0);
-    ASSERT(root_table);
+    ASSERT(page_tables_tag);
+    ASSERT(timestamps_tag);
+    ASSERT(mmap_stats_tag);
+
+    /* We've made our last allocation, so return the spare arena pages. */
+    release_arenas();
+
+    /* This must happen while we can still print, and before we take the
+     * final memory map. */
+    if(cfg->timing) print_timestamps();
 
     /* Exit EFI boot services. */
     AsciiPrint("Terminating boot services and jumping to image at %p\n",
@@ -1354,46 +1338,33 @@ UefiMain(IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE *SystemTable) {
 
     /* The last thing we do is to grab the final memory map, including any
      * allocations and deallocations we've done, as per the UEFI spec
-     * recommendation.  This fills in the space we set aside in the multiboot
-     * structure. */
-    status = update_memory_map();
-    if(EFI_ERROR(status)) return EFI_SUCCESS;
-
-    // Relocate EFI's memory map to the kernel virtual address space.
-    status = relocate_memory_map();
-    if(EFI_ERROR(status)) {
-        DebugPrint(DEBUG_ERROR, "relocate memory map: %r\n", status);
-        return EFI_SUCCESS;
-    }
-    //print_memory_map(0);
-    //print_multiboot_layout(cfg);
-
-    /* Free all dynamically-allocated configuration that we're not passing to
-     * the CPU driver. */
-
-    /* Fill in the tag.  We can't use GetMemoryMap to fill these directly, as
-     * the multiboot specification requires them to be 32 bit, while EFI may
-     * return 64-bit values.  Note that 'mmap_tag' points *inside* the
-     * structure pointed to by 'multiboot'. */
-    cfg->mmap_tag->type= MULTIBOOT_TAG_TYPE_EFI_MMAP;
-    cfg->mmap_tag->size= sizeof(struct multiboot_tag_efi_mmap) + mmap_size;
-    cfg->mmap_tag->descr_size= mmap_d_size;
-    cfg->mmap_tag->descr_vers= mmap_d_ver;
-    memcpy(cfg->mmap_start, mmap, mmap_size);
-
-    //print_multiboot_layout(cfg);
-
-    status= gST->BootServices->ExitBootServices(
-        gImageHandle, mmap_key);
+     * recommendation, and exit boot services with it.  Everything that
+     * prints or allocates must happen before this. */
+    status= exit_boot_services(cfg->mmap_max);
     if(EFI_ERROR(status)) {
-        DebugPrint(DEBUG_ERROR, "ExitBootServices: ERROR %r, %x\n", status, mmap_key);
+        DebugPrint(DEBUG_ERROR, "ExitBootServices: ERROR %r, %x\n",
+                   status, mmap_key);
         return status;
     }
 
     /*** EFI boot services are now terminated, we're on our own. */
+    timestamp(MULTIBOOT_PHASE_EXIT_BOOT_SERVICES);
+
+    /* Relocate EFI's memory map to the kernel virtual address space, and
+     * fill in the memory map and free memory tags, in the space we set aside
+     * in the multiboot structure. */
+    relocate_memory_map(reclaim_boot_services, mmap_stats_tag);
+    complete_multiboot_info(cfg);
+    timestamp(MULTIBOOT_PHASE_MEMORY_MAP);
 
     /* Do MMU configuration, switch page tables. */
-    arch_init(root_table);
+    arch_init(page_tables_tag, full_clean);
+    timestamp(MULTIBOOT_PHASE_ARCH_INIT);
+
+    /* Hand the timestamps to the kernel.  arch_init() has already cleaned
+     * the Multiboot data, so clean the tag again. */
+    complete_timestamps(timestamps_tag);
+    arch_handoff_sync(timestamps_tag, timestamps_tag->size);
 
     /* Jump to the start of the loaded image - doesn't return.
 
@@ -23,8 +23,33 @@ struct page_tables;
 
 EFI_STATUS build_page_tables(struct hagfish_config *cfg);
 void *get_root_table(struct hagfish_config *cfg);
+struct multiboot_tag_page_tables;
+void fill_page_tables_tag(struct hagfish_config *cfg,
+                          struct multiboot_tag_page_tables *tag);
 EFI_STATUS arch_probe(void);
-void arch_init(void *root_table);
+BOOLEAN arch_granule_supported(size_t granule);
+size_t arch_pa_bits(void);
+void arch_init(struct multiboot_tag_page_tables *tag, BOOLEAN full_clean);
 void free_page_table_bookkeeping(struct page_tables *tables);
 
+/* Memory that arch_init() must make visible to the kernel. */
+#define HANDOFF_CLEAN       0
+#define HANDOFF_INVALIDATE  1 /* Clean and invalidate, rather than clean. */
+#define HANDOFF_EXECUTE     2 /* Invalidate the instruction cache too. */
+void arch_handoff_range(void *base, size_t size, int flags);
+void arch_handoff_sync(void *base, size_t size);
+
+/* Boot timing. */
+uint64_t arch_counter(void);
+uint64_t arch_counter_frequency(void);
+BOOLEAN arch_pmu_start(void);
+void arch_pmu_read(uint64_t *cycles, uint64_t *instructions);
+
+uint64_t arch_boot_mpidr(void);
+
+/* Cache geometry. */
+struct multiboot_topology_cache;
+size_t arch_cache_geometry(struct multiboot_topology_cache *caches,
+                           size_t max);
+
 #endif /* __HAGFISH_PAGE_TABLES_H */
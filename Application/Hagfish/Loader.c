@@ -10,13 +10,8 @@
 
 
 #include <errno.h>
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <fcntl.h>
-#include <unistd.h>
-#include <sys/stdint.h>
-#include <sys/stat.h>
 
 #include <Library/BaseLib.h>
 #include <Library/BaseMemoryLib.h>
@@ -25,6 +20,7 @@
 #include <Library/DevicePathLib.h>
 #include <Library/MemoryAllocationLib.h>
 #include <Library/PcdLib.h>
+#include <Library/PrintLib.h>
 #include <Library/UefiApplicationEntryPoint.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiLib.h>
@@ -37,6 +33,7 @@
 
 #include <Loader.h>
 #include <Config.h>
+#include <Multiboot.h>
 
 /* Check that the PXE client is in a usable state, with networking configured,
  * and find both our and the server's IP addresses. */
@@ -83,9 +80,9 @@ net_config(EFI_PXE_BASE_CODE_PROTOCOL *pxe,
 EFI_STATUS
 pxe_config_file_name(struct hagfish_loader *loader, char *config_file_name, UINT64 size) {
     EFI_IP_ADDRESS *my_ip = &loader->d.pxe.my_ip;
-    snprintf(config_file_name, size, hagfish_config_fmt,
-             my_ip->v4.Addr[0], my_ip->v4.Addr[1],
-             my_ip->v4.Addr[2], my_ip->v4.Addr[3]);
+    AsciiSPrint(config_file_name, size, hagfish_config_fmt,
+                my_ip->v4.Addr[0], my_ip->v4.Addr[1],
+                my_ip->v4.Addr[2], my_ip->v4.Addr[3]);
     return EFI_SUCCESS;
 }
 
@@ -160,20 +157,16 @@ pxe_done(struct hagfish_loader *loader) {
 }
 
 EFI_STATUS
-pxe_prepare_multiboot_fn(struct hagfish_loader *loader, void **cursor) {
+pxe_prepare_multiboot_fn(struct hagfish_loader *loader,
+                         struct multiboot_emitter *mb) {
     /* Add the DHCP ack packet. */
-    {
-        struct multiboot_tag_network *dhcp=
-            (struct multiboot_tag_network *)*cursor;
-
-        dhcp->type= MULTIBOOT_TAG_TYPE_NETWORK;
-        dhcp->size= sizeof(struct multiboot_tag_network)
-                  + sizeof(EFI_PXE_BASE_CODE_PACKET);
+    struct multiboot_tag_network *dhcp=
+        multiboot_emit(mb, MULTIBOOT_TAG_TYPE_NETWORK,
+                       sizeof(struct multiboot_tag_network)
+                       + sizeof(EFI_PXE_BASE_CODE_PACKET));
+    if(dhcp) {
         memcpy(&dhcp->dhcpack, &loader->d.pxe.pxe->Mode->DhcpAck,
                sizeof(EFI_PXE_BASE_CODE_PACKET));
-
-        *cursor+= sizeof(struct multiboot_tag_network)
-               + sizeof(EFI_PXE_BASE_CODE_PACKET);
     }
     return EFI_SUCCESS;
 }
@@ -222,7 +215,7 @@ EFI_STATUS fs_size_fn(struct hagfish_loader *loader, char *path, UINT64 *size) {
     }
 
     fileInfoSize = sizeof(EFI_FILE_INFO) + 100; // NAMELEN = 100
-    fileInfo = (EFI_FILE_INFO *) calloc(0, fileInfoSize);
+    fileInfo = (EFI_FILE_INFO *) calloc(1, fileInfoSize);
 
     // Open file first
     status = volumeRoot->Open(volumeRoot, &file, path_unicode,
@@ -299,18 +292,13 @@ EFI_STATUS fs_read_fn(struct hagfish_loader *loader, char *path, UINT64 *size,
     return EFI_SUCCESS;
 }
 
-#define ROUND_UP(x, y) (((x) + ((y) - 1)) & ~((y) - 1))
-#define ALIGN(x) ROUND_UP((x), sizeof(uintptr_t))
+EFI_STATUS fs_multiboot_perpare_fn(struct hagfish_loader *loader,
+                                   struct multiboot_emitter *mb) {
+    // todo: there's no DHCP ack, so leave the packet empty.
+    multiboot_emit(mb, MULTIBOOT_TAG_TYPE_NETWORK,
+                   sizeof(struct multiboot_tag_network)
+                   + sizeof(EFI_PXE_BASE_CODE_PACKET));
 
-EFI_STATUS fs_multiboot_perpare_fn(struct hagfish_loader *loader, void **cursor) {
-    // todo
-    struct multiboot_tag_network * mbnet = (struct multiboot_tag_network*)(*cursor);
-    size_t size = ALIGN(sizeof(struct multiboot_tag_network)+sizeof(EFI_PXE_BASE_CODE_PACKET));
-
-    mbnet->type = MULTIBOOT_TAG_TYPE_NETWORK;
-    mbnet->size = size;
-    *cursor += size;
-    
     return EFI_SUCCESS;
 }
 
@@ -16,19 +16,20 @@
 #include <Protocol/SimpleFileSystem.h>
 
 struct hagfish_loader;
+struct multiboot_emitter;
 
 typedef EFI_STATUS (*loader_file_size_fn)
         (struct hagfish_loader *, char *path, UINT64 *size);
 typedef EFI_STATUS (*loader_file_read_fn)
         (struct hagfish_loader *, char *path, UINT64 *size, UINT8 *buffer);
 typedef EFI_STATUS (*loader_multiboot_prepare)
-        (struct hagfish_loader *, void **cursor);
+        (struct hagfish_loader *, struct multiboot_emitter *mb);
 typedef EFI_STATUS (*loader_config_file_name_fn)
         (struct hagfish_loader *, char *config_file_name, UINT64 size);
 typedef EFI_STATUS (*loader_done_fn)
         (struct hagfish_loader *loader);
 typedef EFI_STATUS (*loader_prepare_multiboot_fn)
-        (struct hagfish_loader *loader, void **cursor);
+        (struct hagfish_loader *loader, struct multiboot_emitter *mb);
 
 enum hagfish_loader_type {
     HAGFISH_LOADER_NONE, HAGFISH_LOADER_PXE, HAGFISH_LOADER_FS
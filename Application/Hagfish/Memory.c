@@ -8,27 +8,38 @@
  */
 
 #include <errno.h>
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 /* EDK headers */
+#include <Library/BaseLib.h>
 #include <Library/DebugLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Uefi.h>
 
+/* Package headers */
+#include <multiboot2.h>
+
 /* Application headers */
 #include <Allocation.h>
 #include <Config.h>
 #include <Memory.h>
+#include <Util.h>
 
-/* The current UEFI memory map.  This is statically allocated, as it needs to
- * persist after we've cleaned up all of our heap allocations. */
-char mmap[MEM_MAP_SIZE];
+/* Our shadow of the UEFI memory map.  It's fetched from the firmware once,
+ * and then kept up to date by memory_map_note(), as we allocate and free
+ * pages, until exit_boot_services() replaces it with the firmware's final
+ * map.  The buffer is never freed, as it needs to persist after we've
+ * cleaned up all of our other heap allocations. */
+char *mmap;
+UINTN mmap_capacity;
 
 UINTN mmap_size, mmap_key, mmap_d_size;
 UINT32 mmap_d_ver;
 
+/* Does the shadow map reflect the firmware's? */
+static int mmap_shadowed;
+
 static const char *mmap_types[] = {
     "reserved",
     "LD code",
@@ -131,70 +142,243 @@ void print_meomry_map_addr(uint64_t addr){
     }    
 }
 
-static int compare_efi_mmap_entry(const void *p1, const void *p2) {
-    const EFI_MEMORY_DESCRIPTOR *d1 = p1;
-    const EFI_MEMORY_DESCRIPTOR *d2 = p2;
-    if (d1->PhysicalStart < d2->PhysicalStart) {
-        return -1;
-    } else if (d1->PhysicalStart > d2->PhysicalStart) {
-        return 1;
-    } else {
-        return 0;
+static int
+compare_descriptors(const void *a, const void *b) {
+    const EFI_MEMORY_DESCRIPTOR *da= a, *db= b;
+
+    if(da->PhysicalStart < db->PhysicalStart) return -1;
+    if(da->PhysicalStart > db->PhysicalStart) return 1;
+    return 0;
+}
+
+/* Sort the map by base address.  Firmware almost always hands us a sorted
+ * map, so check that first, in one pass.  Otherwise, sort it in place with
+ * the runtime's heapsort, which is O(n log n) however the map is ordered,
+ * and works for any mmap_d_size. */
+static void
+sort_memory_map(void) {
+    size_t n= mmap_size / mmap_d_size;
+    size_t i;
+
+    for(i= 1; i < n; i++) {
+        if(compare_descriptors(mmap + (i-1) * mmap_d_size,
+                               mmap + i * mmap_d_size) > 0)
+            break;
     }
+    if(i >= n) return;
+
+    qsort(mmap, n, mmap_d_size, compare_descriptors);
 }
 
-EFI_STATUS
-update_memory_map(void) {
+/* Get the firmware's map into the shadow buffer, growing the buffer if need
+ * be.  Growing it is itself an allocation, which may add descriptors, so we
+ * always leave MMAP_SLACK spare.  This doesn't print, or sort the map, so
+ * that it can be used between failed calls to ExitBootServices. */
+static EFI_STATUS
+get_firmware_map(void) {
     EFI_STATUS status;
 
-    /* Grab the current table from UEFI. */
-    mmap_size= MEM_MAP_SIZE;
-    status= gST->BootServices->GetMemoryMap(
-                &mmap_size, (void *)mmap,
-                &mmap_key,  &mmap_d_size,
-                &mmap_d_ver);
-    if(status == EFI_BUFFER_TOO_SMALL) {
-        DebugPrint(DEBUG_ERROR,
-                   "The memory map is %dB, but MEM_MAP_SIZE is %d.\n",
-                   mmap_size, MEM_MAP_SIZE);
-        DebugPrint(DEBUG_ERROR,
-                   "This is compile-time limit in Hagfish - please report "
-                   "this overflow, it's a bug.\n");
-        return status;
+    while(1) {
+        mmap_size= mmap_capacity;
+        status= gST->BootServices->GetMemoryMap(
+                    &mmap_size, (void *)mmap,
+                    &mmap_key,  &mmap_d_size,
+                    &mmap_d_ver);
+        if(status != EFI_BUFFER_TOO_SMALL) break;
+
+        free(mmap);
+        mmap_capacity= mmap_size + MMAP_SLACK * mmap_d_size;
+        mmap= malloc(mmap_capacity);
+        if(!mmap) {
+            mmap_capacity= 0;
+            mmap_size= 0;
+            return EFI_OUT_OF_RESOURCES;
+        }
     }
-    else if(EFI_ERROR(status)) {
+    if(EFI_ERROR(status)) mmap_size= 0;
+
+    return status;
+}
+
+/* Fetch the map from the firmware into the shadow, and sort it. */
+static EFI_STATUS
+fetch_memory_map(void) {
+    EFI_STATUS status;
+
+    status= get_firmware_map();
+    if(EFI_ERROR(status)) {
         DebugPrint(DEBUG_ERROR, "GetMemoryMap: %r\n", status);
         return status;
     }
 
-    qsort(mmap, mmap_size / mmap_d_size, mmap_d_size, compare_efi_mmap_entry);
+    sort_memory_map();
+    mmap_shadowed= 1;
 
     return EFI_SUCCESS;
 }
 
-/* this updates the memory map and immediately calls ExitBootServices */
+/* Make sure that the shadow map is current.  Only the first call, or the
+ * first after memory_map_note() gave up, actually asks the firmware. */
+EFI_STATUS
+update_memory_map(void) {
+    if(mmap_shadowed) return EFI_SUCCESS;
+
+    return fetch_memory_map();
+}
+
+/* Ask the firmware how large its map is now, including the allocations
+ * that we didn't make ourselves, without fetching it. */
 EFI_STATUS
-update_memory_map_and_exit_boot_services(void) {
+measure_memory_map(UINTN *size, UINTN *d_size) {
+    UINTN key;
+    UINT32 d_ver;
     EFI_STATUS status;
 
-    /* Grab the current table from UEFI. */
-    mmap_size= MEM_MAP_SIZE;
-    status= gST->BootServices->GetMemoryMap(
-                &mmap_size, (void *)&mmap,
-                &mmap_key,  &mmap_d_size,
-                &mmap_d_ver);
-    if(EFI_ERROR(status)) {
-        DebugPrint(DEBUG_ERROR, "GetMemoryMap: %r\n", status);
-        return status;
+    *size= 0;
+    status= gST->BootServices->GetMemoryMap(size, NULL, &key, d_size,
+                                            &d_ver);
+    if(status == EFI_BUFFER_TOO_SMALL) status= EFI_SUCCESS;
+
+    return status;
+}
+
+static EFI_MEMORY_DESCRIPTOR *
+mmap_desc(size_t i) {
+    return (EFI_MEMORY_DESCRIPTOR *)(mmap + i * mmap_d_size);
+}
+
+static uint64_t
+mmap_desc_end(size_t i) {
+    return mmap_desc(i)->PhysicalStart + mmap_desc(i)->NumberOfPages * PAGE_4k;
+}
+
+/* Split descriptor i at 'addr', which must lie strictly within it.  Returns
+ * FALSE if there's no room. */
+static BOOLEAN
+split_descriptor(size_t i, uint64_t addr) {
+    size_t n= mmap_size / mmap_d_size;
+    uint64_t end= mmap_desc_end(i);
+
+    if(mmap_size + mmap_d_size > mmap_capacity) return FALSE;
+
+    memmove(mmap_desc(i+1), mmap_desc(i), (n - i) * mmap_d_size);
+    mmap_size+= mmap_d_size;
+
+    mmap_desc(i)->NumberOfPages=
+        (addr - mmap_desc(i)->PhysicalStart) / PAGE_4k;
+    mmap_desc(i+1)->VirtualStart+= addr - mmap_desc(i+1)->PhysicalStart;
+    mmap_desc(i+1)->PhysicalStart= addr;
+    mmap_desc(i+1)->NumberOfPages= (end - addr) / PAGE_4k;
+
+    return TRUE;
+}
+
+/* Coalesce any runs of identical descriptors in [lo, hi), as the firmware
+ * would, so that repeated small allocations don't fragment the shadow. */
+static void
+coalesce_descriptors(size_t lo, size_t hi) {
+    size_t n= mmap_size / mmap_d_size;
+    size_t i, w;
+
+    if(hi - lo < 2) return;
+
+    for(i= lo + 1, w= lo + 1; i < hi; i++) {
+        EFI_MEMORY_DESCRIPTOR *last= mmap_desc(w-1), *desc= mmap_desc(i);
+
+        if(last->Type == desc->Type && last->Attribute == desc->Attribute &&
+           mmap_desc_end(w-1) == desc->PhysicalStart) {
+            last->NumberOfPages+= desc->NumberOfPages;
+            continue;
+        }
+
+        if(w < i) memcpy(mmap_desc(w), desc, mmap_d_size);
+        w++;
     }
-    status= gST->BootServices->ExitBootServices(
-            gImageHandle, mmap_key);
-    if(EFI_ERROR(status)) {
-        DebugPrint(DEBUG_ERROR, "ExitBootServices: ERROR %r, %x\n", status, mmap_key);
-        return status;
+
+    if(w < hi) {
+        memmove(mmap_desc(w), mmap_desc(hi), (n - hi) * mmap_d_size);
+        mmap_size-= (hi - w) * mmap_d_size;
     }
+}
 
-    return EFI_SUCCESS;
+/* Record in the shadow map that the pages [base, base + npages * 4k) now
+ * have the given type.  If the shadow can't follow, because the range isn't
+ * all in the map or we've run out of room to split descriptors, it's marked
+ * stale, and the next update_memory_map() refetches it. */
+void
+memory_map_note(EFI_PHYSICAL_ADDRESS base, size_t npages, UINT32 type) {
+    uint64_t end= base + npages * PAGE_4k;
+    size_t lo, hi, i;
+
+    if(!mmap_shadowed || npages == 0) return;
+
+    /* Find the first descriptor that ends above base. */
+    lo= 0;
+    hi= mmap_size / mmap_d_size;
+    while(lo < hi) {
+        size_t mid= lo + (hi - lo) / 2;
+
+        if(mmap_desc_end(mid) <= base) lo= mid + 1;
+        else hi= mid;
+    }
+
+    for(i= lo; base < end; i++) {
+        /* { [original base, base) is retyped, and ends at descriptor i. } */
+        if(i >= mmap_size / mmap_d_size ||
+           mmap_desc(i)->PhysicalStart > base)
+            goto note_stale;
+
+        if(mmap_desc(i)->PhysicalStart < base) {
+            if(!split_descriptor(i, base)) goto note_stale;
+            continue;
+        }
+
+        if(mmap_desc_end(i) > end && !split_descriptor(i, end))
+            goto note_stale;
+
+        mmap_desc(i)->Type= type;
+        base= mmap_desc_end(i);
+    }
+
+    /* Merge with the neighbours on either side. */
+    coalesce_descriptors(lo > 0 ? lo - 1 : 0,
+                         MIN(i + 1, mmap_size / mmap_d_size));
+    return;
+
+note_stale:
+    mmap_shadowed= 0;
+}
+
+/* Take the final memory map, and exit boot services.  Nothing between the
+ * two calls may print or allocate, as either could change the map and
+ * invalidate its key.  The firmware may still change it behind our back
+ * e.g. from a timer event, in which case ExitBootServices fails with
+ * EFI_INVALID_PARAMETER, and we try again with a fresh map.  Between
+ * attempts, only GetMemoryMap and the allocation services are available.
+ *
+ * The final map must fit in 'max_size' bytes, the space set aside for it,
+ * or we don't exit at all, and fail with EFI_BUFFER_TOO_SMALL: dropping
+ * descriptors would hide our own allocations from the kernel.  On success,
+ * the map is left as the firmware gave it to us, for relocate_memory_map()
+ * to finish once we're on our own.  Nothing here prints, so the caller must
+ * report any failure. */
+EFI_STATUS
+exit_boot_services(size_t max_size) {
+    EFI_STATUS status;
+    size_t tries;
+
+    mmap_shadowed= 0;
+
+    for(tries= 0; tries < EXIT_BOOT_SERVICES_TRIES; tries++) {
+        status= get_firmware_map();
+        if(EFI_ERROR(status)) return status;
+        if(mmap_size > max_size) return EFI_BUFFER_TOO_SMALL;
+
+        status= gST->BootServices->ExitBootServices(gImageHandle, mmap_key);
+        if(status != EFI_INVALID_PARAMETER) return status;
+    }
+
+    return status;
 }
 
 EFI_STATUS
@@ -236,90 +420,34 @@ get_region_list(struct hagfish_config *cfg) {
     }
     list->nregions= 0;
 
+    /* The map is sorted, so each descriptor either extends the last region,
+     * or starts a new one after it. */
     for(i= 0; i < mmap_n_desc; i++) {
         /* { regions are non-overlapping and sorted by base address. } */
         EFI_MEMORY_DESCRIPTOR *desc=
             (EFI_MEMORY_DESCRIPTOR *)(mmap + i * mmap_d_size);
+        struct ram_region *last=
+            list->nregions > 0 ? &list->regions[list->nregions-1] : NULL;
 
         /* We're only looking for RAM. */
         if(desc->Type == EfiMemoryMappedIO ||
            desc->Type == EfiMemoryMappedIOPortSpace)
             continue;
 
-        size_t j;
-        for(j= list->nregions;
-            j > 0 && list->regions[j-1].base > desc->PhysicalStart;
-            j--) {
-        }
-        ASSERT(j == 0 || list->regions[j-1].base <= desc->PhysicalStart);
         /* Descriptors should not overlap. */
-        ASSERT(j == 0 ||
-               list->regions[j-1].base + list->regions[j-1].npages * PAGE_4k <=
-               desc->PhysicalStart);
-        ASSERT(j == list->nregions ||
-               desc->PhysicalStart + desc->NumberOfPages * PAGE_4k <=
-               list->regions[j].base);
-
-        /* The new descriptor extends the previous region.  This is the common
-         * case if the descriptor list is sorted.  Merge them. */
-        int merge_left= j > 0 &&
-            list->regions[j-1].base +
-            list->regions[j-1].npages * PAGE_4k == 
-            desc->PhysicalStart;
-        /* We're plugging the hole before an existing region.  This should be
-         * rare, but we'll handle it. */
-        int merge_right= j < list->nregions &&
-            desc->PhysicalStart + desc->NumberOfPages * PAGE_4k ==
-            list->regions[j].base;
-
-        if(merge_left) {
-            if(merge_right) {
-                size_t k;
-
-                ASSERT(j > 0);
-                ASSERT(j < list->nregions);
-
-                /* Absorb the new descriptor and the existing region. */
-                list->regions[j-1].npages +=
-                    desc->NumberOfPages + list->regions[j].npages;
-
-                /* Remove the right-hand descriptor. */
-                for(k= j; k < list->nregions - 1; k++)
-                    list->regions[k]= list->regions[k+1];
-
-            }
-            else {
-                ASSERT(j > 0);
+        ASSERT(!last ||
+               last->base + last->npages * PAGE_4k <= desc->PhysicalStart);
 
-                /* Absorb the new descriptor.  The number of regions is
-                 * unchanged. */
-                list->regions[j-1].npages += desc->NumberOfPages;
-            }
+        if(last && last->base + last->npages * PAGE_4k ==
+                   desc->PhysicalStart) {
+            last->npages+= desc->NumberOfPages;
         }
         else {
-            if(merge_right) {
-                /* Absorb the new descriptor, and update the base address of
-                 * the right-hand region.  The number of regions remains
-                 * unchanged.  */
-                ASSERT(j < list->nregions);
-                list->regions[j].base-= desc->NumberOfPages * PAGE_4k;
-                ASSERT(list->regions[j].base == desc->PhysicalStart);
-                list->regions[j].npages+= desc->NumberOfPages;
-            }
-            else {
-                size_t k;
-
-                ASSERT(list->nregions + 1 <= mmap_n_desc);
-
-                /* Make room for a new region. */
-                for(k= list->nregions; k > j; k--)
-                    list->regions[k]= list->regions[k-1];
-
-                list->regions[j].base= desc->PhysicalStart;
-                list->regions[j].npages= desc->NumberOfPages;
+            ASSERT(list->nregions + 1 <= mmap_n_desc);
 
-                list->nregions++;
-            }
+            list->regions[list->nregions].base= desc->PhysicalStart;
+            list->regions[list->nregions].npages= desc->NumberOfPages;
+            list->nregions++;
         }
     }
 
@@ -337,18 +465,25 @@ free_region_list(struct region_list *list) {
     free(list);
 }
 
+/* Find the region containing 'addr', or return list->nregions if there's
+ * none.  The regions are sorted and disjoint, so we can bisect. */
 size_t
 search_region_list(struct region_list *list, uint64_t addr) {
-    size_t i;
+    size_t lo= 0, hi= list->nregions;
 
-    for(i= 0; i < list->nregions; i++) {
-        if(list->regions[i].base <= addr &&
-           addr < list->regions[i].base + list->regions[i].npages * PAGE_4k) {
-            break;
-        }
+    /* { regions[0..lo) start at or below addr, regions[hi..) above it. } */
+    while(lo < hi) {
+        size_t mid= lo + (hi - lo) / 2;
+
+        if(list->regions[mid].base <= addr) lo= mid + 1;
+        else hi= mid;
     }
 
-    return i;
+    if(lo > 0 &&
+       addr < list->regions[lo-1].base + list->regions[lo-1].npages * PAGE_4k)
+        return lo - 1;
+
+    return list->nregions;
 }
 
 void
@@ -369,52 +504,161 @@ print_ram_regions(struct region_list *region_list) {
     AsciiPrint("%lldkB total\n", total / 1024);
 }
 
-void mmap_table_remove(EFI_MEMORY_DESCRIPTOR* mmap, int i, size_t total)
-{
-    for(;i<total-1;i++){
-        *(mmap+i) = *(mmap+i+1);
-    }
+/* Is this memory free once boot services have exited? */
+static int
+memory_type_free(UINT32 type) {
+    return type == EfiConventionalMemory ||
+           type == EfiBootServicesCode ||
+           type == EfiBootServicesData;
 }
 
-EFI_STATUS
-relocate_memory_map(void) {
-    EFI_STATUS status;
+/* Split the free run [base, end) at 2MiB and 1GiB boundaries, so that each
+ * piece can be used with the largest page size possible, and append the
+ * pieces to 'ranges'.  Nothing is written beyond 'max', but the count keeps
+ * going. */
+static size_t
+split_free_run(struct multiboot_free_range *ranges, size_t n, size_t max,
+               uint64_t base, uint64_t end) {
+    while(base < end) {
+        uint64_t page, limit;
+
+        if(base % PAGE_1G == 0 && end - base >= PAGE_1G) {
+            page= PAGE_1G;
+            limit= ROUNDDOWN(end, PAGE_1G);
+        }
+        else if(base % PAGE_2M == 0 && end - base >= PAGE_2M) {
+            page= PAGE_2M;
+            limit= MIN(ROUNDDOWN(end, PAGE_2M),
+                       ROUNDDOWN(base, PAGE_1G) + PAGE_1G);
+        }
+        else {
+            page= PAGE_4k;
+            limit= MIN(end, ROUNDDOWN(base, PAGE_2M) + PAGE_2M);
+        }
 
-    if (!mmap_size) {
-        DebugPrint(DEBUG_ERROR, "NULL memory map!\n");
-        return EFI_LOAD_ERROR;
+        /* A piece that ends at a boundary may be followed by another with
+         * the same page size e.g. 2M pages either side of a 1G boundary
+         * with less than 1G beyond it.  Merge them. */
+        if(n > 0 && n <= max && ranges[n-1].page_size == page &&
+           ranges[n-1].base + ranges[n-1].size == base) {
+            ranges[n-1].size+= limit - base;
+        }
+        else {
+            if(n < max) {
+                ranges[n].base= base;
+                ranges[n].size= limit - base;
+                ranges[n].page_size= page;
+                ranges[n].reserved= 0;
+            }
+            n++;
+        }
+
+        base= limit;
     }
 
-    size_t mmap_n_desc = mmap_size / mmap_d_size;
+    return n;
+}
+
+/* Digest the current (sorted) memory map into free RAM ranges, for the
+ * MULTIBOOT_TAG_TYPE_FREE_MEMORY tag.  Returns the number of ranges, which
+ * may be more than 'max', in which case only the first 'max' are written. */
+size_t
+get_free_memory(struct multiboot_free_range *ranges, size_t max) {
+    size_t mmap_n_desc= mmap_size / mmap_d_size;
+    uint64_t run_base= 0, run_end= 0;
+    size_t i, n= 0;
 
-    for (size_t i= 0; i < mmap_n_desc; i++) {
+    for(i= 0; i < mmap_n_desc; i++) {
         EFI_MEMORY_DESCRIPTOR *desc=
             (EFI_MEMORY_DESCRIPTOR *)(mmap + i * mmap_d_size);
-        desc->VirtualStart |= KERNEL_OFFSET;
+        uint64_t base= desc->PhysicalStart;
+        uint64_t end= base + desc->NumberOfPages * PAGE_4k;
+
+        if(!memory_type_free(desc->Type)) continue;
+        ASSERT(base >= run_end);
+
+        /* A free descriptor either extends the current run, or, if there's
+         * anything else in between, starts a new one. */
+        if(run_end > run_base && base == run_end) {
+            run_end= end;
+            continue;
+        }
 
+        n= split_free_run(ranges, n, max, run_base, run_end);
+        run_base= base;
+        run_end= end;
     }
+    n= split_free_run(ranges, n, max, run_base, run_end);
+
+    return n;
+}
+
+/* Can these two descriptors be coalesced into one? */
+static int
+descriptors_mergeable(EFI_MEMORY_DESCRIPTOR *a, EFI_MEMORY_DESCRIPTOR *b) {
+    return a->Type == b->Type &&
+           a->Attribute == b->Attribute &&
+           a->PhysicalStart + a->NumberOfPages * PAGE_4k == b->PhysicalStart &&
+           a->VirtualStart + a->NumberOfPages * PAGE_4k == b->VirtualStart;
+}
+
+/* Post-process the final memory map for the kernel, in place, and without
+ * printing or allocating, as this runs after we've exited boot services.
+ * The map is sorted, and then, in a single pass, each descriptor's virtual
+ * address is set to where the kernel will see it, and runs of adjacent
+ * descriptors with the same type and attributes are coalesced.  If
+ * 'reclaim_boot_services' is set, boot services code and data, which are
+ * free once we've exited boot services, are retyped as conventional memory
+ * first, so that they coalesce with it.
+ *
+ * Descriptors are read at index i and written back at index n <= i, always
+ * stepping by mmap_d_size, as the firmware's descriptors may be larger than
+ * EFI_MEMORY_DESCRIPTOR.  The descriptor counts are left in 'stats'. */
+EFI_STATUS
+relocate_memory_map(int reclaim_boot_services,
+                    struct multiboot_tag_mmap_stats *stats) {
+    size_t mmap_n_desc, i, n;
+
+    if (!mmap_size) return EFI_LOAD_ERROR;
+
+    sort_memory_map();
+
+    mmap_n_desc= mmap_size / mmap_d_size;
+    stats->descriptors_in= mmap_n_desc;
+    stats->merged= 0;
+    stats->reclaimed= 0;
 
-    for(size_t i = 0; i< mmap_n_desc -1 ;){
-        EFI_MEMORY_DESCRIPTOR *desc = (EFI_MEMORY_DESCRIPTOR *)mmap + i;
-        EFI_MEMORY_DESCRIPTOR *desc_n = desc + 1;
-
-        //(desc->Type == EfiBarrelfishBootPageTable || desc->Type == EfiConventionalMemory) &&
-        if( (desc->Type == desc_n->Type) &&
-            (desc->PhysicalStart + (desc->NumberOfPages<<12) == desc_n->PhysicalStart) &&
-            (desc->Attribute == desc_n->Attribute) )
-        {
-            desc->NumberOfPages += desc_n->NumberOfPages;
-            mmap_table_remove((EFI_MEMORY_DESCRIPTOR*)mmap, i + 1, mmap_n_desc);
-            mmap_n_desc--;
+    for(i= 0, n= 0; i < mmap_n_desc; i++) {
+        /* { mmap[0..n) is the processed map, and n <= i. } */
+        EFI_MEMORY_DESCRIPTOR *desc=
+            (EFI_MEMORY_DESCRIPTOR *)(mmap + i * mmap_d_size);
+
+        desc->VirtualStart= desc->PhysicalStart + KERNEL_OFFSET;
+
+        if(reclaim_boot_services &&
+           (desc->Type == EfiBootServicesCode ||
+            desc->Type == EfiBootServicesData)) {
+            desc->Type= EfiConventionalMemory;
+            stats->reclaimed++;
         }
-        else{
-            i++;
+
+        if(n > 0) {
+            EFI_MEMORY_DESCRIPTOR *last=
+                (EFI_MEMORY_DESCRIPTOR *)(mmap + (n-1) * mmap_d_size);
+
+            if(descriptors_mergeable(last, desc)) {
+                last->NumberOfPages+= desc->NumberOfPages;
+                stats->merged++;
+                continue;
+            }
         }
+
+        if(n < i) memcpy(mmap + n * mmap_d_size, desc, mmap_d_size);
+        n++;
     }
-    mmap_size = mmap_n_desc * mmap_d_size;
-    DebugPrint(DEBUG_INFO,"mmap_size(merged) %d, page_num(merged) %d\n",mmap_size, mmap_n_desc);
 
-    print_meomry_map_addr((uint64_t)mmap);
+    mmap_size= n * mmap_d_size;
+    stats->descriptors_out= n;
 
     return EFI_SUCCESS;
 }
@@ -427,5 +671,5 @@ set_memory_map(void) {
     }
 
     return gST->RuntimeServices->SetVirtualAddressMap(mmap_size, mmap_d_size,
-            mmap_d_ver, (void *) &mmap);
+            mmap_d_ver, (void *) mmap);
 }
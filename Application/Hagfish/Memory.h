@@ -16,13 +16,19 @@
 #include <Uefi.h>
 
 #define PAGE_4k (1<<12)
+#define PAGE_2M (1ULL<<21)
+#define PAGE_1G (1ULL<<30)
 
-/* We preallocate space for the memory map, to avoid the recursion between
- * checking the memory map size and allocating memory for it.  This will
- * obviously fail if the memory map is particularly big. */
-#define MEM_MAP_SIZE 81920
-extern char mmap[];
-extern UINTN mmap_size, mmap_key, mmap_d_size;
+/* The memory map buffer is sized to the firmware's map, plus room for this
+ * many more descriptors, for those that allocating it, and our own later
+ * allocations, add. */
+#define MMAP_SLACK 64
+
+/* How often exit_boot_services() will refetch the map, if the firmware keeps
+ * changing it. */
+#define EXIT_BOOT_SERVICES_TRIES 8
+extern char *mmap;
+extern UINTN mmap_capacity, mmap_size, mmap_key, mmap_d_size;
 extern UINT32 mmap_d_ver;
 
 struct ram_region {
@@ -35,6 +41,12 @@ struct region_list {
     struct ram_region regions[0];
 };
 
+/* Splitting at 2MiB and 1GiB boundaries turns a run of free memory into at
+ * most this many ranges: 4k, 2M, 1G, 2M and 4k pages. */
+#define FREE_RANGES_PER_RUN 5
+
+struct multiboot_free_range;
+
 /* Application headers */
 #include <Config.h>
 
@@ -43,13 +55,17 @@ struct region_list *get_region_list(struct hagfish_config *cfg);
 void free_region_list(struct region_list *list);
 size_t search_region_list(struct region_list *list, uint64_t addr);
 void print_ram_regions(struct region_list *region_list);
+size_t get_free_memory(struct multiboot_free_range *ranges, size_t max);
 EFI_STATUS update_memory_map(void);
-EFI_STATUS update_memory_map_and_exit_boot_services(void);
+EFI_STATUS measure_memory_map(UINTN *size, UINTN *d_size);
+void memory_map_note(EFI_PHYSICAL_ADDRESS base, size_t npages, UINT32 type);
+EFI_STATUS exit_boot_services(size_t max_size);
 
 void print_memory_map(int update_map);
 void print_meomry_map_addr(uint64_t addr);
 
-EFI_STATUS relocate_memory_map(void);
+EFI_STATUS relocate_memory_map(int reclaim_boot_services,
+                               struct multiboot_tag_mmap_stats *stats);
 EFI_STATUS set_memory_map(void);
 
 #endif /* __HAGFISH_MEMORY_H */
@@ -0,0 +1,558 @@
+/*
+ * Copyright (c) 2017, ETH Zuerich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <string.h>
+
+/* EDK headers */
+#include <Uefi.h>
+#include <Library/DebugLib.h>
+#include <Library/UefiLib.h>
+
+/* Package headers */
+#include <libelf.h>
+#include <multiboot2.h>
+
+/* Application headers */
+#include <Allocation.h>
+#include <Config.h>
+#include <Hardware.h>
+#include <Memory.h>
+#include <Multiboot.h>
+#include <Timestamp.h>
+#include <Util.h>
+
+#define MULTIBOOT_ALIGN(x) ROUNDUP((x), MULTIBOOT_TAG_ALIGN)
+
+/* Extra memory map descriptors to allow for, after we size the free memory
+ * tag. */
+#define FREE_MEMORY_SLACK 16
+
+/* Reserve 'size' bytes, rounded up to the tag alignment.  Returns NULL when
+ * sizing. */
+static void *
+multiboot_reserve(struct multiboot_emitter *mb, size_t size) {
+    void *p= mb->base ? (char *)mb->base + mb->size : NULL;
+
+    mb->size+= MULTIBOOT_ALIGN(size);
+    return p;
+}
+
+/* Reserve a tag, and fill in its header.  The caller fills in the rest, if
+ * we're not sizing.  The recorded size includes the padding, so a kernel can
+ * step from tag to tag without rounding. */
+void *
+multiboot_emit(struct multiboot_emitter *mb, uint32_t type, size_t size) {
+    struct multiboot_tag *tag= multiboot_reserve(mb, size);
+
+    if(tag) {
+        tag->type= type;
+        tag->size= MULTIBOOT_ALIGN(size);
+    }
+    return tag;
+}
+
+/* A module tag holds only the command line; it refers to the image, which
+ * stays in its own EfiBarrelfishELFData pages. */
+static void
+emit_module(struct multiboot_emitter *mb, struct hagfish_config *cfg,
+            struct component_config *cmp) {
+    struct multiboot_tag_module_64 *module=
+        multiboot_emit(mb, MULTIBOOT_TAG_TYPE_MODULE_64,
+                       sizeof(struct multiboot_tag_module_64)
+                       + cmp->args_len+1);
+    if(!module) return;
+
+    module->mod_start= (multiboot_uint64_t)cmp->image_address;
+    module->mod_end=
+        (multiboot_uint64_t)(cmp->image_address + (cmp->image_size - 1));
+    memcpy(module->cmdline, cfg->buf + cmp->args_start, cmp->args_len);
+    module->cmdline[cmp->args_len]= '\0';
+}
+
+/* Emit every tag, in order.  This is run once to size the structure, and once
+ * to fill it. */
+static EFI_STATUS
+emit_multiboot_tags(struct multiboot_emitter *mb, struct hagfish_config *cfg,
+                    struct hagfish_loader *loader,
+                    const Elf64_View *cpu_elf) {
+    struct component_config *cmp;
+    EFI_STATUS status;
+
+    /* CPU driver entry point */
+    struct multiboot_tag_efi64 *efi=
+        multiboot_emit(mb, MULTIBOOT_TAG_TYPE_EFI64,
+                       sizeof(struct multiboot_tag_efi64));
+    if(efi) efi->pointer= (uint64_t)cfg->cpu_driver_entry;
+
+    /* CPU driver command line */
+    struct multiboot_tag_string *bootcmd=
+        multiboot_emit(mb, MULTIBOOT_TAG_TYPE_CMDLINE,
+                       sizeof(struct multiboot_tag_string)
+                       + cfg->cpu_driver->args_len+1);
+    if(bootcmd) {
+        memcpy(bootcmd->string, cfg->buf + cfg->cpu_driver->args_start,
+               cfg->cpu_driver->args_len);
+        bootcmd->string[cfg->cpu_driver->args_len]= '\0';
+    }
+
+    /* DHCP ack packet */
+    status= loader->prepare_multiboot_fn(loader, mb);
+    if(EFI_ERROR(status)) {
+        DebugPrint(DEBUG_ERROR, "prepare_multiboot_fn: %r\n", status);
+        return status;
+    }
+
+    /* ACPI 1.0 header */
+    if(cfg->acpi1_header) {
+        struct multiboot_tag_old_acpi *acpi=
+            multiboot_emit(mb, MULTIBOOT_TAG_TYPE_ACPI_OLD,
+                sizeof(struct multiboot_tag_old_acpi)
+                + sizeof(EFI_ACPI_1_0_ROOT_SYSTEM_DESCRIPTION_POINTER));
+        if(acpi) {
+            memcpy(&acpi->rsdp[0], cfg->acpi1_header,
+                   sizeof(EFI_ACPI_1_0_ROOT_SYSTEM_DESCRIPTION_POINTER));
+        }
+    }
+
+    /* ACPI 2.0+ header */
+    if(cfg->acpi2_header) {
+        struct multiboot_tag_new_acpi *acpi=
+            multiboot_emit(mb, MULTIBOOT_TAG_TYPE_ACPI_NEW,
+                sizeof(struct multiboot_tag_new_acpi)
+                + sizeof(EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER));
+        if(acpi) {
+            memcpy(&acpi->rsdp[0], cfg->acpi2_header,
+                   sizeof(EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER));
+        }
+    }
+
+    /* The CPU and interrupt controller digest of the MADT. */
+    if(cfg->madt) {
+        void *madt= multiboot_emit(mb, MULTIBOOT_TAG_TYPE_MADT,
+                                   cfg->madt->size);
+        if(madt) memcpy(madt, cfg->madt, cfg->madt->size);
+    }
+
+    /* The CPU and cache topology, in the same CPU order. */
+    if(cfg->topology) {
+        void *topology= multiboot_emit(mb, MULTIBOOT_TAG_TYPE_TOPOLOGY,
+                                       cfg->topology->size);
+        if(topology) memcpy(topology, cfg->topology, cfg->topology->size);
+    }
+
+    /* The NUMA affinity map. */
+    if(cfg->numa) {
+        void *numa= multiboot_emit(mb, MULTIBOOT_TAG_TYPE_NUMA,
+                                   cfg->numa->size);
+        if(numa) memcpy(numa, cfg->numa, cfg->numa->size);
+    }
+
+    /* The kernel's initial page tables.  arch_init() says whether it
+     * installed the high half. */
+    cfg->page_tables_tag=
+        multiboot_emit(mb, MULTIBOOT_TAG_TYPE_PAGE_TABLES,
+                       sizeof(struct multiboot_tag_page_tables));
+    if(cfg->page_tables_tag) fill_page_tables_tag(cfg, cfg->page_tables_tag);
+
+    /* The boot driver, CPU driver, and all other modules, in that order. */
+    emit_module(mb, cfg, cfg->boot_driver);
+    emit_module(mb, cfg, cfg->cpu_driver);
+    for(cmp= cfg->first_module; cmp; cmp= cmp->next)
+        emit_module(mb, cfg, cmp);
+
+    /* CPU driver ELF section headers */
+    struct multiboot_tag_elf_sections *sections=
+        multiboot_emit(mb, MULTIBOOT_TAG_TYPE_ELF_SECTIONS,
+                       sizeof(struct multiboot_tag_elf_sections)
+                       + cpu_elf->ev_shnum * sizeof(Elf64_Shdr));
+    if(sections) {
+        sections->num= cpu_elf->ev_shnum;
+        sections->entsize= sizeof(Elf64_Shdr);
+        sections->shndx= cpu_elf->ev_shstrndx;
+        if(cpu_elf->ev_shnum > 0) {
+            memcpy(sections->sections, cpu_elf->ev_shdr,
+                   cpu_elf->ev_shnum * sizeof(Elf64_Shdr));
+        }
+    }
+
+    /* CPU driver symbol table.  The tables themselves stay where
+     * build_kernel_symbols() put them. */
+    if(cfg->kernel_symbols) {
+        void *symtab=
+            multiboot_emit(mb, MULTIBOOT_TAG_TYPE_SYMTAB_64,
+                           sizeof(struct multiboot_tag_symtab_64));
+        if(symtab) {
+            memcpy(symtab, cfg->kernel_symbols,
+                   sizeof(struct multiboot_tag_symtab_64));
+        }
+    }
+
+    /* Boot phase timestamps.  The last are taken after ExitBootServices(), so
+     * these are filled in by complete_timestamps(). */
+    cfg->timestamps_tag=
+        multiboot_emit(mb, MULTIBOOT_TAG_TYPE_TIMESTAMPS,
+                       sizeof(struct multiboot_tag_timestamps)
+                       + BOOT_TIMESTAMPS_TAG_MAX
+                         * sizeof(struct multiboot_timestamp));
+
+    /* What relocate_memory_map() did to the final memory map. */
+    cfg->mmap_stats_tag=
+        multiboot_emit(mb, MULTIBOOT_TAG_TYPE_MMAP_STATS,
+                       sizeof(struct multiboot_tag_mmap_stats));
+
+    /* Free memory, digested from the final memory map, and so also filled
+     * in later. */
+    cfg->free_memory_tag=
+        multiboot_emit(mb, MULTIBOOT_TAG_TYPE_FREE_MEMORY,
+                       sizeof(struct multiboot_tag_free_memory)
+                       + cfg->free_memory_max
+                         * sizeof(struct multiboot_free_range));
+
+    /* EFI memory map.  This must be last, and is filled in after we've
+     * finished doing allocations. */
+    cfg->mmap_tag=
+        multiboot_emit(mb, MULTIBOOT_TAG_TYPE_EFI_MMAP,
+                       sizeof(struct multiboot_tag_efi_mmap) + cfg->mmap_max);
+    if(cfg->mmap_tag) cfg->mmap_start= cfg->mmap_tag->efi_mmap;
+
+    return EFI_SUCCESS;
+}
+
+/* Allocate and fill the Multiboot information structure.  The memory map is
+ * preallocated, but left empty until all allocations are finished. */
+void *
+create_multiboot_info(struct hagfish_config *cfg,
+                      struct hagfish_loader *loader) {
+    struct multiboot_emitter mb;
+    struct multiboot_header *hdr;
+    size_t size, npages;
+    UINTN fw_size, fw_d_size;
+    EFI_STATUS status;
+
+    /* We pass on the CPU driver's section headers. */
+    Elf64_View cpu_elf;
+    if(elf64_view(&cpu_elf, cfg->cpu_driver->image_address,
+                  cfg->cpu_driver->image_size)) {
+        DebugPrint(DEBUG_ERROR, "elf64_view: %a\n", elf_errmsg(elf_errno()));
+        return NULL;
+    }
+
+    /* Size the memory map tag from the firmware's own map, not our shadow,
+     * which doesn't see allocations that the firmware makes itself, and
+     * leave room for the descriptors that our remaining allocations, and
+     * the firmware's, will add.  exit_boot_services() fails if the final
+     * map still doesn't fit.  Leave room for the free memory ranges, too. */
+    status= measure_memory_map(&fw_size, &fw_d_size);
+    if(EFI_ERROR(status)) {
+        DebugPrint(DEBUG_ERROR, "GetMemoryMap: %r\n", status);
+        return NULL;
+    }
+    cfg->mmap_max= fw_size + MMAP_SLACK * fw_d_size;
+    cfg->free_memory_max= FREE_RANGES_PER_RUN
+                        * (fw_size / fw_d_size + FREE_MEMORY_SLACK);
+
+    /* Measure. */
+    mb.base= NULL;
+    mb.size= 0;
+    multiboot_reserve(&mb, sizeof(struct multiboot_header));
+    if(EFI_ERROR(emit_multiboot_tags(&mb, cfg, loader, &cpu_elf)))
+        return NULL;
+    size= mb.size;
+
+    /* Round up to a page size and allocate. */
+    npages= COVER(size, PAGE_4k);
+    cfg->multiboot= allocate_pages(npages, EfiBarrelfishMultibootData);
+    if(!cfg->multiboot) {
+        DebugPrint(DEBUG_ERROR, "allocate_pages: failed\n");
+        return NULL;
+    }
+    memset(cfg->multiboot, 0, size);
+    arch_handoff_range(cfg->multiboot, npages * PAGE_4k, HANDOFF_INVALIDATE);
+    AsciiPrint("Allocated %d pages for %dB multiboot info at %p.\n",
+               npages, size, cfg->multiboot);
+
+    /* Fill in. */
+    mb.base= cfg->multiboot;
+    mb.size= 0;
+    hdr= multiboot_reserve(&mb, sizeof(struct multiboot_header));
+    if(EFI_ERROR(emit_multiboot_tags(&mb, cfg, loader, &cpu_elf)))
+        return NULL;
+    ASSERT(mb.size == size);
+
+    hdr->magic= MULTIBOOT2_BOOTLOADER_MAGIC;
+    hdr->architecture= MULTIBOOT_ARCHITECTURE_AARCH64;
+    hdr->header_length= size;
+    hdr->checksum= -(hdr->magic + hdr->architecture + hdr->header_length);
+
+    return cfg->multiboot;
+}
+
+/* Fill in the tags that describe the final memory map.  This runs after
+ * we've exited boot services, so mustn't allocate or print.  Note that the
+ * tags are *inside* the structure pointed to by 'cfg->multiboot'. */
+void
+complete_multiboot_info(struct hagfish_config *cfg) {
+    struct multiboot_tag_free_memory *fm= cfg->free_memory_tag;
+    size_t n;
+
+    /* exit_boot_services() made sure that the map fits. */
+    ASSERT(mmap_size <= cfg->mmap_max);
+
+    /* We can't use GetMemoryMap to fill these directly, as the multiboot
+     * specification requires them to be 32 bit, while EFI may return 64-bit
+     * values. */
+    cfg->mmap_tag->type= MULTIBOOT_TAG_TYPE_EFI_MMAP;
+    cfg->mmap_tag->size= sizeof(struct multiboot_tag_efi_mmap) + mmap_size;
+    cfg->mmap_tag->descr_size= mmap_d_size;
+    cfg->mmap_tag->descr_vers= mmap_d_ver;
+    memcpy(cfg->mmap_start, mmap, mmap_size);
+
+    /* If the ranges don't fit, leave the tag empty, and the kernel will fall
+     * back to the EFI memory map. */
+    n= get_free_memory(fm->ranges, cfg->free_memory_max);
+    if(n > cfg->free_memory_max) n= 0;
+    fm->num_ranges= n;
+}
+
+static void
+print_multiboot_tag(struct multiboot_tag *tag) {
+    switch(tag->type) {
+        case MULTIBOOT_TAG_TYPE_EFI64: {
+            struct multiboot_tag_efi64 *data=
+                (struct multiboot_tag_efi64 *)tag;
+            AsciiPrint("multiboot_tag_efi64--------------------------\n");
+            AsciiPrint("%-10a:%016lx\n","addr",data);
+            AsciiPrint("%-10a:%d\n","type",data->type);
+            AsciiPrint("%-10a:%d\n","size",data->size);
+            AsciiPrint("%-10a:%016lx\n","pointer",data->pointer);
+            break;
+        }
+        case MULTIBOOT_TAG_TYPE_CMDLINE: {
+            struct multiboot_tag_string *data=
+                (struct multiboot_tag_string *)tag;
+            AsciiPrint("multiboot_tag_string-------------------------\n");
+            AsciiPrint("%-10a:%016lx\n","addr",data);
+            AsciiPrint("%-10a:%d\n","type",data->type);
+            AsciiPrint("%-10a:%d\n","size",data->size);
+            AsciiPrint("%-10a:%a\n","cmdline",data->string);
+            break;
+        }
+        case MULTIBOOT_TAG_TYPE_NETWORK: {
+            AsciiPrint("multiboot_tag_network------------------------\n");
+            AsciiPrint("%-10a:%016lx\n","addr",tag);
+            AsciiPrint("%-10a:%d\n","type",tag->type);
+            AsciiPrint("%-10a:%d\n","size",tag->size);
+            break;
+        }
+        case MULTIBOOT_TAG_TYPE_ACPI_OLD:
+        case MULTIBOOT_TAG_TYPE_ACPI_NEW: {
+            if(tag->type == MULTIBOOT_TAG_TYPE_ACPI_OLD)
+                AsciiPrint("multiboot_tag_old_acpi-----------------------\n");
+            else
+                AsciiPrint("multiboot_tag_new_acpi-----------------------\n");
+            AsciiPrint("%-10a:%016lx\n","addr",tag);
+            AsciiPrint("%-10a:%d\n","type",tag->type);
+            AsciiPrint("%-10a:%d\n","size",tag->size);
+            break;
+        }
+        case MULTIBOOT_TAG_TYPE_MADT: {
+            struct multiboot_tag_madt *data=
+                (struct multiboot_tag_madt *)tag;
+            size_t i;
+            AsciiPrint("multiboot_tag_madt---------------------------\n");
+            AsciiPrint("%-10a:%016lx\n","addr",data);
+            AsciiPrint("%-10a:%d\n","type",data->type);
+            AsciiPrint("%-10a:%d\n","size",data->size);
+            AsciiPrint("%-10a:%016lx\n","gicd_base",data->gicd_base);
+            AsciiPrint("%-10a:%d\n","num_its",data->num_its);
+            AsciiPrint("%-10a:%d\n","num_cpus",data->num_cpus);
+            for(i= 0; i < data->num_cpus; i++) {
+                AsciiPrint("mpidr %010lx uid %4d gicr %016lx parked %016lx\n",
+                           data->cpus[i].mpidr, data->cpus[i].acpi_uid,
+                           data->cpus[i].gicr_base,
+                           data->cpus[i].parked_address);
+            }
+            break;
+        }
+        case MULTIBOOT_TAG_TYPE_TOPOLOGY: {
+            struct multiboot_tag_topology *data=
+                (struct multiboot_tag_topology *)tag;
+            struct multiboot_topology_cache *caches=
+                (struct multiboot_topology_cache *)
+                &data->cpus[data->num_cpus];
+            size_t i;
+            AsciiPrint("multiboot_tag_topology-----------------------\n");
+            AsciiPrint("%-10a:%016lx\n","addr",data);
+            AsciiPrint("%-10a:%d\n","type",data->type);
+            AsciiPrint("%-10a:%d\n","size",data->size);
+            AsciiPrint("%-10a:%d\n","num_cpus",data->num_cpus);
+            AsciiPrint("%-10a:%d\n","num_caches",data->num_caches);
+            for(i= 0; i < data->num_caches; i++) {
+                AsciiPrint("L%d type %d %8dB %4d sets %2d ways %3dB lines\n",
+                           caches[i].level, caches[i].type, caches[i].size,
+                           caches[i].sets, caches[i].ways,
+                           caches[i].line_size);
+            }
+            break;
+        }
+        case MULTIBOOT_TAG_TYPE_NUMA: {
+            struct multiboot_tag_numa *data=
+                (struct multiboot_tag_numa *)tag;
+            size_t i;
+            AsciiPrint("multiboot_tag_numa---------------------------\n");
+            AsciiPrint("%-10a:%016lx\n","addr",data);
+            AsciiPrint("%-10a:%d\n","type",data->type);
+            AsciiPrint("%-10a:%d\n","size",data->size);
+            AsciiPrint("%-10a:%d\n","num_nodes",data->num_nodes);
+            AsciiPrint("%-10a:%d\n","boot_node",data->boot_node);
+            for(i= 0; i < data->num_memory; i++) {
+                AsciiPrint("%016lx-%016lx node %d\n",
+                           data->memory[i].base,
+                           data->memory[i].base + data->memory[i].size - 1,
+                           data->memory[i].node);
+            }
+            break;
+        }
+        case MULTIBOOT_TAG_TYPE_PAGE_TABLES: {
+            struct multiboot_tag_page_tables *data=
+                (struct multiboot_tag_page_tables *)tag;
+            AsciiPrint("multiboot_tag_page_tables--------------------\n");
+            AsciiPrint("%-10a:%016lx\n","addr",data);
+            AsciiPrint("%-10a:%d\n","type",data->type);
+            AsciiPrint("%-10a:%d\n","size",data->size);
+            AsciiPrint("%-10a:%d\n","granule",data->granule);
+            AsciiPrint("%-10a:%d\n","root_level",data->root_level);
+            AsciiPrint("%-10a:%016lx\n","ttbr0",data->ttbr0);
+            AsciiPrint("%-10a:%016lx\n","ttbr1",data->ttbr1);
+            AsciiPrint("%-10a:%016lx\n","offset",data->kernel_offset);
+            AsciiPrint("%-10a:%016lx\n","mair",data->mair);
+            AsciiPrint("%-10a:%d\n","pa_bits",data->pa_bits);
+            AsciiPrint("%-10a:%x\n","flags",data->flags);
+            AsciiPrint("%-10a:%d\n","attr_cached",data->attr_cached);
+            AsciiPrint("%-10a:%d\n","attr_device",data->attr_device);
+            break;
+        }
+        case MULTIBOOT_TAG_TYPE_MODULE_64: {
+            struct multiboot_tag_module_64 *data=
+                (struct multiboot_tag_module_64 *)tag;
+            AsciiPrint("multiboot_tag_module_64----------------------\n");
+            AsciiPrint("%-10a:%016lx\n","addr",data);
+            AsciiPrint("%-10a:%d\n","type",data->type);
+            AsciiPrint("%-10a:%d\n","size",data->size);
+            AsciiPrint("%-10a:%016lx\n","mod_start",data->mod_start);
+            AsciiPrint("%-10a:%016lx\n","mod_end",data->mod_end);
+            AsciiPrint("%-10a:%a\n","cmdline",data->cmdline);
+            break;
+        }
+        case MULTIBOOT_TAG_TYPE_ELF_SECTIONS: {
+            struct multiboot_tag_elf_sections *data=
+                (struct multiboot_tag_elf_sections *)tag;
+            AsciiPrint("multiboot_tag_elf_sections-------------------\n");
+            AsciiPrint("%-10a:%016lx\n","addr",data);
+            AsciiPrint("%-10a:%d\n","type",data->type);
+            AsciiPrint("%-10a:%d\n","size",data->size);
+            AsciiPrint("%-10a:%d\n","num",data->num);
+            AsciiPrint("%-10a:%d\n","shndx",data->shndx);
+            break;
+        }
+        case MULTIBOOT_TAG_TYPE_SYMTAB_64: {
+            struct multiboot_tag_symtab_64 *data=
+                (struct multiboot_tag_symtab_64 *)tag;
+            AsciiPrint("multiboot_tag_symtab_64----------------------\n");
+            AsciiPrint("%-10a:%016lx\n","addr",data);
+            AsciiPrint("%-10a:%d\n","type",data->type);
+            AsciiPrint("%-10a:%d\n","size",data->size);
+            AsciiPrint("%-10a:%d\n","num_syms",data->num_syms);
+            AsciiPrint("%-10a:%016lx\n","syms",data->syms);
+            break;
+        }
+        case MULTIBOOT_TAG_TYPE_TIMESTAMPS: {
+            struct multiboot_tag_timestamps *data=
+                (struct multiboot_tag_timestamps *)tag;
+            AsciiPrint("multiboot_tag_timestamps---------------------\n");
+            AsciiPrint("%-10a:%016lx\n","addr",data);
+            AsciiPrint("%-10a:%d\n","type",data->type);
+            AsciiPrint("%-10a:%d\n","size",data->size);
+            AsciiPrint("%-10a:%ld\n","frequency",data->frequency);
+            AsciiPrint("%-10a:%d\n","num_stamps",data->num_stamps);
+            break;
+        }
+        case MULTIBOOT_TAG_TYPE_MMAP_STATS: {
+            struct multiboot_tag_mmap_stats *data=
+                (struct multiboot_tag_mmap_stats *)tag;
+            AsciiPrint("multiboot_tag_mmap_stats---------------------\n");
+            AsciiPrint("%-10a:%016lx\n","addr",data);
+            AsciiPrint("%-10a:%d\n","type",data->type);
+            AsciiPrint("%-10a:%d\n","size",data->size);
+            break;
+        }
+        case MULTIBOOT_TAG_TYPE_FREE_MEMORY: {
+            struct multiboot_tag_free_memory *data=
+                (struct multiboot_tag_free_memory *)tag;
+            size_t i;
+            AsciiPrint("multiboot_tag_free_memory--------------------\n");
+            AsciiPrint("%-10a:%016lx\n","addr",data);
+            AsciiPrint("%-10a:%d\n","type",data->type);
+            AsciiPrint("%-10a:%d\n","size",data->size);
+            AsciiPrint("%-10a:%d\n","num_ranges",data->num_ranges);
+            for(i= 0; i < data->num_ranges; i++) {
+                AsciiPrint("%016lx-%016lx %8dkB pages\n",
+                           data->ranges[i].base,
+                           data->ranges[i].base + data->ranges[i].size - 1,
+                           data->ranges[i].page_size / 1024);
+            }
+            break;
+        }
+        case MULTIBOOT_TAG_TYPE_EFI_MMAP: {
+            struct multiboot_tag_efi_mmap *data=
+                (struct multiboot_tag_efi_mmap *)tag;
+            AsciiPrint("multiboot_tag_efi_mmap-----------------------\n");
+            AsciiPrint("%-10a:%016lx\n","addr",data);
+            AsciiPrint("%-10a:%d\n","type",data->type);
+            AsciiPrint("%-10a:%d\n","size",data->size);
+            AsciiPrint("%-10a:%d\n","descr_size",data->descr_size);
+            AsciiPrint("%-10a:%d\n","descr_ver",data->descr_vers);
+            AsciiPrint("%-10a:%016lx\n","mmap_addr",data->efi_mmap);
+
+            AsciiPrint("efi_mmap_content-----------------------------\n");
+            print_meomry_map_addr((uint64_t)data->efi_mmap);
+            break;
+        }
+        default: {
+            AsciiPrint("multiboot_tag----------------------------\n");
+            AsciiPrint("%-10a:%016lx\n","addr",tag);
+            AsciiPrint("%-10a:%d\n","type",tag->type);
+            AsciiPrint("%-10a:%d\n","size",tag->size);
+            break;
+        }
+    }
+}
+
+/* Walk the tags actually present, rather than assuming a layout. */
+void
+print_multiboot_layout(struct hagfish_config *cfg) {
+    struct multiboot_header *hdr= cfg->multiboot;
+    char *end= (char *)hdr + hdr->header_length;
+    struct multiboot_tag *tag;
+
+    AsciiPrint("multiboot_header ----------------------------\n");
+    AsciiPrint("%-10a:%016lx\n","addr",hdr);
+    AsciiPrint("%-10a:%d\n","magic",hdr->magic);
+    AsciiPrint("%-10a:%d\n","arch",hdr->architecture);
+    AsciiPrint("%-10a:%d\n","len",hdr->header_length);
+    AsciiPrint("%-10a:%08x\n","checksum",hdr->checksum);
+
+    for(tag= (struct multiboot_tag *)
+             ((char *)hdr + MULTIBOOT_ALIGN(sizeof(struct multiboot_header)));
+        (char *)tag < end && tag->size > 0;
+        tag= (struct multiboot_tag *)
+             ((char *)tag + MULTIBOOT_ALIGN(tag->size))) {
+        print_multiboot_tag(tag);
+    }
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2017, ETH Zuerich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef __HAGFISH_MULTIBOOT_H
+#define __HAGFISH_MULTIBOOT_H
+
+#include <sys/types.h>
+
+/* Application headers */
+#include <Config.h>
+#include <Loader.h>
+
+/* The multiboot information is built by running the same code twice, through
+ * an emitter: first with no buffer, which only measures it, and then for real
+ * into a buffer of exactly that size.  The sizes can't disagree. */
+struct multiboot_emitter {
+    void *base;     /* The structure being filled in, or NULL if sizing. */
+    size_t size;    /* The bytes emitted so far. */
+};
+
+void *multiboot_emit(struct multiboot_emitter *mb, uint32_t type,
+                     size_t size);
+
+void *create_multiboot_info(struct hagfish_config *cfg,
+                            struct hagfish_loader *loader);
+void complete_multiboot_info(struct hagfish_config *cfg);
+void print_multiboot_layout(struct hagfish_config *cfg);
+
+#endif /* __HAGFISH_MULTIBOOT_H */
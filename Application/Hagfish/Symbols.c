@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2017, ETH Zuerich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+/* EDK headers */
+#include <Uefi.h>
+#include <Library/DebugLib.h>
+#include <Library/UefiLib.h>
+
+/* Package headers */
+#include <gelf.h>
+#include <libelf.h>
+#include <multiboot2.h>
+
+/* Application headers */
+#include <Allocation.h>
+#include <Config.h>
+#include <Hardware.h>
+#include <Memory.h>
+#include <Symbols.h>
+#include <Util.h>
+
+#define SYMTAB_ALIGN(x) ROUNDUP((x), sizeof(uint64_t))
+
+/* Bloom filter parameters, as used by the GNU linker. */
+#define SYMTAB_BLOOM_SHIFT 26
+#define SYMTAB_BLOOM_BITS  64
+
+#define SYMTAB_EMPTY_BUCKET 0xffffffff
+
+/* Is this a symbol that we'd want to resolve a PC or a name to? */
+static int
+symbol_wanted(GElf_Sym *sym) {
+    int type= GELF_ST_TYPE(sym->st_info);
+
+    if(type != STT_FUNC && type != STT_OBJECT) return 0;
+    if(sym->st_name == 0) return 0;
+    if(sym->st_shndx == SHN_UNDEF || sym->st_shndx >= SHN_LORESERVE)
+        return 0;
+
+    return 1;
+}
+
+static int
+symbol_compare(const void *a, const void *b) {
+    const struct multiboot_symbol_64 *sa= a, *sb= b;
+
+    if(sa->addr < sb->addr) return -1;
+    if(sa->addr > sb->addr) return 1;
+    return 0;
+}
+
+/* Find the symbol table, and its associated string table. */
+static Elf_Scn *
+find_symtab(Elf *elf, GElf_Shdr *shdr) {
+    Elf_Scn *scn= NULL;
+
+    while((scn= elf_nextscn(elf, scn)) != NULL) {
+        if(!gelf_getshdr(scn, shdr)) return NULL;
+        if(shdr->sh_type == SHT_SYMTAB) return scn;
+    }
+
+    return NULL;
+}
+
+/* Build the hash index over the (already address-sorted) symbols.  The
+ * positions are grouped by bucket with a counting sort, so each bucket's
+ * chain is contiguous, as for DT_GNU_HASH. */
+static void
+build_symbol_hash(struct multiboot_tag_symtab_64 *tag,
+                  const char *strings) {
+    struct multiboot_symbol_64 *syms=
+        (struct multiboot_symbol_64 *)tag->syms;
+    uint64_t *bloom= (uint64_t *)tag->bloom;
+    uint32_t *buckets= (uint32_t *)tag->buckets;
+    uint32_t *chain= (uint32_t *)tag->chain;
+    uint32_t *order= (uint32_t *)tag->order;
+    uint32_t nsyms= tag->num_syms, nbuckets= tag->num_buckets;
+    uint32_t i, b, pos;
+
+    /* Count each bucket's symbols, and set the bloom filter bits. */
+    for(i= 0; i < nsyms; i++) {
+        uint32_t h= elf_gnu_hash(strings + syms[i].name);
+
+        buckets[h % nbuckets]++;
+        bloom[(h / SYMTAB_BLOOM_BITS) & (tag->bloom_size - 1)]|=
+            (1ULL << (h % SYMTAB_BLOOM_BITS)) |
+            (1ULL << ((h >> tag->bloom_shift) % SYMTAB_BLOOM_BITS));
+    }
+
+    /* Turn the counts into end positions. */
+    for(b= 0, pos= 0; b < nbuckets; b++) {
+        pos+= buckets[b];
+        buckets[b]= pos;
+    }
+
+    /* Fill backwards, leaving each bucket holding its start position. */
+    for(i= nsyms; i > 0; i--) {
+        uint32_t h= elf_gnu_hash(strings + syms[i-1].name);
+
+        pos= --buckets[h % nbuckets];
+        chain[pos]= h & ~1U;
+        order[pos]= i-1;
+    }
+
+    /* Terminate the chains, and mark the empty buckets. */
+    for(b= 0; b < nbuckets; b++) {
+        uint32_t end= b + 1 < nbuckets ? buckets[b+1] : nsyms;
+
+        if(buckets[b] == end) buckets[b]= SYMTAB_EMPTY_BUCKET;
+        else chain[end-1]|= 1;
+    }
+}
+
+/* Extract the CPU driver's function and object symbols into an
+ * EfiBarrelfishMultibootData region, sorted by their relocated addresses and
+ * indexed by name, to be passed to the kernel in a MULTIBOOT_TAG_TYPE_SYMTAB_64
+ * tag.  An image without a symbol table isn't an error; it just gets no tag.
+ */
+EFI_STATUS
+build_kernel_symbols(struct hagfish_config *cfg, uint64_t kernel_offset) {
+    struct component_config *cpu_driver= cfg->cpu_driver;
+    EFI_STATUS status= EFI_LOAD_ERROR;
+    size_t i;
+
+    cfg->kernel_symbols= NULL;
+
+    elf_version(EV_CURRENT);
+    Elf *elf= elf_memory((char *)cpu_driver->image_address,
+                         cpu_driver->image_size);
+    if(!elf) {
+        DebugPrint(DEBUG_ERROR, "elf_memory: %a\n", elf_errmsg(elf_errno()));
+        return EFI_LOAD_ERROR;
+    }
+
+    /* Relocated symbols move with the first loadable segment, just as in
+     * relocate_elf(). */
+    size_t phnum;
+    if(elf_getphdrnum(elf, &phnum)) {
+        DebugPrint(DEBUG_ERROR, "elf_getphdrnum: %a\n",
+                   elf_errmsg(elf_errno()));
+        goto elf_fail;
+    }
+
+    GElf_Phdr phdr;
+    for(i= 0; i < phnum; i++) {
+        if(!gelf_getphdr(elf, i, &phdr)) {
+            DebugPrint(DEBUG_ERROR, "gelf_getphdr: %a\n",
+                       elf_errmsg(elf_errno()));
+            goto elf_fail;
+        }
+        if(phdr.p_type == PT_LOAD) break;
+    }
+    if(i == phnum || cfg->cpu_driver_segments->nregions == 0) {
+        DebugPrint(DEBUG_ERROR, "No loadable segment.\n");
+        goto elf_fail;
+    }
+
+    uint64_t delta= cfg->cpu_driver_segments->regions[0].base
+                  + (phdr.p_vaddr & (PAGE_4k - 1))
+                  - phdr.p_vaddr + kernel_offset;
+
+    GElf_Shdr shdr;
+    Elf_Scn *symtab= find_symtab(elf, &shdr);
+    if(!symtab || shdr.sh_entsize == 0) {
+        DebugPrint(DEBUG_WARN,
+                   "Warning: CPU driver has no symbol table.\n");
+        status= EFI_SUCCESS;
+        goto elf_fail;
+    }
+    size_t strndx= shdr.sh_link;
+    size_t nelfsyms= shdr.sh_size / shdr.sh_entsize;
+
+    Elf_Data *data= elf_getdata(symtab, NULL);
+    if(!data) {
+        DebugPrint(DEBUG_ERROR, "elf_getdata: %a\n",
+                   elf_errmsg(elf_errno()));
+        goto elf_fail;
+    }
+
+    /* Count the symbols we'll keep, and the space for their names. */
+    GElf_Sym sym;
+    size_t nsyms= 0, strings_size= 0;
+    for(i= 1; i < nelfsyms; i++) {
+        if(!gelf_getsym(data, i, &sym)) {
+            DebugPrint(DEBUG_ERROR, "gelf_getsym: %a\n",
+                       elf_errmsg(elf_errno()));
+            goto elf_fail;
+        }
+        if(!symbol_wanted(&sym)) continue;
+
+        const char *name= elf_strptr(elf, strndx, sym.st_name);
+        if(!name) {
+            DebugPrint(DEBUG_ERROR, "elf_strptr: %a\n",
+                       elf_errmsg(elf_errno()));
+            goto elf_fail;
+        }
+
+        nsyms++;
+        strings_size+= strlen(name) + 1;
+    }
+
+    if(nsyms == 0) {
+        status= EFI_SUCCESS;
+        goto elf_fail;
+    }
+
+    /* Size the tables.  Each symbol sets two bits of the bloom filter, and
+     * we aim for around one in eight bits set. */
+    uint32_t nbuckets= nsyms / 4 + 1;
+    uint32_t bloom_size= 1;
+    while(bloom_size * SYMTAB_BLOOM_BITS < nsyms * 8) bloom_size*= 2;
+
+    size_t syms_off= SYMTAB_ALIGN(sizeof(struct multiboot_tag_symtab_64));
+    size_t bloom_off= syms_off
+                    + SYMTAB_ALIGN(nsyms * sizeof(struct multiboot_symbol_64));
+    size_t buckets_off= bloom_off + bloom_size * sizeof(uint64_t);
+    size_t chain_off= buckets_off
+                    + SYMTAB_ALIGN(nbuckets * sizeof(uint32_t));
+    size_t order_off= chain_off + SYMTAB_ALIGN(nsyms * sizeof(uint32_t));
+    size_t strings_off= order_off + SYMTAB_ALIGN(nsyms * sizeof(uint32_t));
+    size_t total= strings_off + strings_size;
+
+    size_t npages= COVER(total, PAGE_4k);
+    void *base= allocate_pages(npages, EfiBarrelfishMultibootData);
+    if(!base) {
+        DebugPrint(DEBUG_ERROR, "allocate_pages: failed\n");
+        status= EFI_OUT_OF_RESOURCES;
+        goto elf_fail;
+    }
+    memset(base, 0, npages * PAGE_4k);
+    arch_handoff_range(base, npages * PAGE_4k, HANDOFF_CLEAN);
+
+    /* The region starts with a copy of its own tag. */
+    struct multiboot_tag_symtab_64 *tag= base;
+    tag->type= MULTIBOOT_TAG_TYPE_SYMTAB_64;
+    tag->size= sizeof(struct multiboot_tag_symtab_64);
+    tag->num_syms= nsyms;
+    tag->num_buckets= nbuckets;
+    tag->bloom_size= bloom_size;
+    tag->bloom_shift= SYMTAB_BLOOM_SHIFT;
+    tag->syms= (uint64_t)base + syms_off;
+    tag->bloom= (uint64_t)base + bloom_off;
+    tag->buckets= (uint64_t)base + buckets_off;
+    tag->chain= (uint64_t)base + chain_off;
+    tag->order= (uint64_t)base + order_off;
+    tag->strings= (uint64_t)base + strings_off;
+    tag->strings_size= strings_size;
+
+    struct multiboot_symbol_64 *syms=
+        (struct multiboot_symbol_64 *)tag->syms;
+    char *strings= (char *)tag->strings;
+    size_t j, str;
+    for(i= 1, j= 0, str= 0; i < nelfsyms; i++) {
+        gelf_getsym(data, i, &sym);
+        if(!symbol_wanted(&sym)) continue;
+
+        const char *name= elf_strptr(elf, strndx, sym.st_name);
+        size_t len= strlen(name) + 1;
+
+        syms[j].addr= sym.st_value + delta;
+        syms[j].size= sym.st_size;
+        syms[j].name= str;
+        syms[j].info= sym.st_info;
+        memcpy(strings + str, name, len);
+
+        j++;
+        str+= len;
+    }
+
+    qsort(syms, nsyms, sizeof(struct multiboot_symbol_64), symbol_compare);
+
+    build_symbol_hash(tag, strings);
+
+    DebugPrint(DEBUG_INFO,
+               "Kernel symbol table: %d symbols, %d buckets, %dB at %p\n",
+               nsyms, nbuckets, total, base);
+
+    cfg->kernel_symbols= tag;
+    status= EFI_SUCCESS;
+
+elf_fail:
+    elf_end(elf);
+    return status;
+}
@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) 2017, ETH Zuerich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef __HAGFISH_SYMBOLS_H
+#define __HAGFISH_SYMBOLS_H
+
+#include <Library/UefiLib.h>
+
+#include <sys/types.h>
+
+/* Application headers */
+#include <Config.h>
+
+EFI_STATUS build_kernel_symbols(struct hagfish_config *cfg,
+                                uint64_t kernel_offset);
+
+#endif /* __HAGFISH_SYMBOLS_H */
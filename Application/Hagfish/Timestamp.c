@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2017, ETH Zuerich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <string.h>
+
+/* EDK headers */
+#include <Uefi.h>
+#include <Library/DebugLib.h>
+#include <Library/UefiLib.h>
+
+/* Package headers */
+#include <multiboot2.h>
+
+/* Application headers */
+#include <Hardware.h>
+#include <Timestamp.h>
+
+/* The records are kept here until the multiboot tag is completed, as the
+ * last ones are taken after boot services have exited. */
+static struct multiboot_timestamp stamps[BOOT_TIMESTAMPS_MAX];
+static size_t nstamps, ndropped;
+static BOOLEAN pmu_enabled;
+
+static const char *phase_names[]= {
+    [MULTIBOOT_PHASE_START]=               "start",
+    [MULTIBOOT_PHASE_CONFIG]=              "config",
+    [MULTIBOOT_PHASE_ACPI]=                "acpi",
+    [MULTIBOOT_PHASE_LOAD_BOOT_DRIVER]=    "load boot driver",
+    [MULTIBOOT_PHASE_LOAD_CPU_DRIVER]=     "load cpu driver",
+    [MULTIBOOT_PHASE_LOAD_MODULE]=         "load module",
+    [MULTIBOOT_PHASE_RAM_REGIONS]=         "ram regions",
+    [MULTIBOOT_PHASE_PAGE_TABLES]=         "page tables",
+    [MULTIBOOT_PHASE_PREPARE_BOOT_DRIVER]= "prepare boot driver",
+    [MULTIBOOT_PHASE_PREPARE_CPU_DRIVER]=  "prepare cpu driver",
+    [MULTIBOOT_PHASE_MULTIBOOT]=           "multiboot",
+    [MULTIBOOT_PHASE_EXIT_BOOT_SERVICES]=  "exit boot services",
+    [MULTIBOOT_PHASE_ARCH_INIT]=           "arch init",
+    [MULTIBOOT_PHASE_MEMORY_MAP]=          "memory map",
+};
+
+/* The phases after the modules are loaded, each taken once, that we keep
+ * room for. */
+#define LATE_PHASES \
+    (MULTIBOOT_PHASE_MEMORY_MAP - MULTIBOOT_PHASE_LOAD_MODULE)
+
+/* Start the PMU, if there is one, and take the first timestamp. */
+void
+start_timestamps(void) {
+    nstamps= 0;
+    ndropped= 0;
+    pmu_enabled= arch_pmu_start();
+    timestamp(MULTIBOOT_PHASE_START);
+}
+
+/* Record the end of a phase.  This must be safe to call after
+ * ExitBootServices(), so doesn't print.  Once a module stamp would eat into
+ * the room kept for the late phases, it replaces the previous module's
+ * instead, which then covers both. */
+void
+timestamp(uint32_t phase) {
+    struct multiboot_timestamp *ts;
+
+    if(phase == MULTIBOOT_PHASE_LOAD_MODULE &&
+       nstamps >= BOOT_TIMESTAMPS_MAX - LATE_PHASES) {
+        ndropped++;
+        if(stamps[nstamps-1].phase != phase) return;
+        ts= &stamps[nstamps-1];
+    }
+    else if(nstamps == BOOT_TIMESTAMPS_MAX) {
+        ndropped++;
+        return;
+    }
+    else ts= &stamps[nstamps++];
+
+    ts->phase= phase;
+    ts->counter= arch_counter();
+    if(pmu_enabled) arch_pmu_read(&ts->cycles, &ts->instructions);
+}
+
+/* Print each phase's duration, so far. */
+void
+print_timestamps(void) {
+    uint64_t frequency= arch_counter_frequency();
+    size_t i;
+
+    if(frequency == 0) return;
+
+    AsciiPrint("Boot phase              us      cycles    instructions\n");
+    for(i= 1; i < nstamps; i++) {
+        struct multiboot_timestamp *prev= &stamps[i-1], *ts= &stamps[i];
+
+        AsciiPrint("%-20a %8ld %11ld %15ld\n",
+                   ts->phase < sizeof(phase_names) / sizeof(phase_names[0]) ?
+                       phase_names[ts->phase] : "?",
+                   (ts->counter - prev->counter) * 1000000 / frequency,
+                   ts->cycles - prev->cycles,
+                   ts->instructions - prev->instructions);
+    }
+    if(ndropped > 0) AsciiPrint("%d timestamps dropped.\n", ndropped);
+}
+
+/* Copy the records into the multiboot tag.  This runs after
+ * ExitBootServices(). */
+void
+complete_timestamps(struct multiboot_tag_timestamps *tag) {
+    tag->frequency= arch_counter_frequency();
+    tag->flags= pmu_enabled ? MULTIBOOT_TIMESTAMPS_PMU : 0;
+    tag->max_stamps= BOOT_TIMESTAMPS_TAG_MAX;
+    tag->num_stamps= nstamps;
+    tag->num_dropped= ndropped;
+    memcpy(tag->stamps, stamps, nstamps * sizeof(struct multiboot_timestamp));
+}
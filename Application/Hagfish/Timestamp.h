@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2017, ETH Zuerich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef __HAGFISH_TIMESTAMP_H
+#define __HAGFISH_TIMESTAMP_H
+
+#include <Library/UefiLib.h>
+
+#include <sys/types.h>
+
+/* The most timestamps Hagfish itself records.  Room is kept for the phases
+ * after the modules are loaded, so it's module stamps that are dropped. */
+#define BOOT_TIMESTAMPS_MAX 32
+
+/* The room in the multiboot tag, leaving the rest for the kernel. */
+#define BOOT_TIMESTAMPS_TAG_MAX 64
+
+struct multiboot_tag_timestamps;
+
+void start_timestamps(void);
+void timestamp(uint32_t phase);
+void print_timestamps(void);
+void complete_timestamps(struct multiboot_tag_timestamps *tag);
+
+#endif /* __HAGFISH_TIMESTAMP_H */
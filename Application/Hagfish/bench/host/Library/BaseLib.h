@@ -0,0 +1,2 @@
+/* See Uefi.h. */
+#include <Uefi.h>
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2017, ETH Zuerich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+/*
+ * Just enough of the EDK2 environment to build Memory.c on a host, for the
+ * benchmarks in this directory.  All of the EDK headers that Memory.c and
+ * its application headers include lead here.
+ */
+
+#ifndef __HAGFISH_BENCH_UEFI_H
+#define __HAGFISH_BENCH_UEFI_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef uint8_t  UINT8;
+typedef uint16_t UINT16;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef uint64_t UINTN;
+typedef unsigned char BOOLEAN;
+typedef void VOID;
+
+#define TRUE  1
+#define FALSE 0
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+typedef UINTN EFI_STATUS;
+typedef void *EFI_HANDLE;
+typedef UINT64 EFI_PHYSICAL_ADDRESS;
+typedef UINT64 EFI_VIRTUAL_ADDRESS;
+
+#define EFI_ERROR_BIT        (1ULL << 63)
+#define EFI_ERROR(s)         (((s) & EFI_ERROR_BIT) != 0)
+#define EFI_SUCCESS          0
+#define EFI_LOAD_ERROR       (EFI_ERROR_BIT | 1)
+#define EFI_INVALID_PARAMETER (EFI_ERROR_BIT | 2)
+#define EFI_BUFFER_TOO_SMALL (EFI_ERROR_BIT | 5)
+#define EFI_OUT_OF_RESOURCES (EFI_ERROR_BIT | 9)
+
+typedef enum {
+    EfiReservedMemoryType,
+    EfiLoaderCode,
+    EfiLoaderData,
+    EfiBootServicesCode,
+    EfiBootServicesData,
+    EfiRuntimeServicesCode,
+    EfiRuntimeServicesData,
+    EfiConventionalMemory,
+    EfiUnusableMemory,
+    EfiACPIReclaimMemory,
+    EfiACPIMemoryNVS,
+    EfiMemoryMappedIO,
+    EfiMemoryMappedIOPortSpace,
+    EfiPalCode,
+    EfiPersistentMemory,
+    EfiMaxMemoryType
+} EFI_MEMORY_TYPE;
+
+typedef struct {
+    UINT32               Type;
+    EFI_PHYSICAL_ADDRESS PhysicalStart;
+    EFI_VIRTUAL_ADDRESS  VirtualStart;
+    UINT64               NumberOfPages;
+    UINT64               Attribute;
+} EFI_MEMORY_DESCRIPTOR;
+
+typedef struct {
+    EFI_STATUS (*GetMemoryMap)(UINTN *size, EFI_MEMORY_DESCRIPTOR *map,
+                               UINTN *key, UINTN *d_size, UINT32 *d_ver);
+    EFI_STATUS (*ExitBootServices)(EFI_HANDLE image, UINTN key);
+} EFI_BOOT_SERVICES;
+
+typedef struct {
+    EFI_STATUS (*SetVirtualAddressMap)(UINTN size, UINTN d_size,
+                                       UINT32 d_ver,
+                                       EFI_MEMORY_DESCRIPTOR *map);
+} EFI_RUNTIME_SERVICES;
+
+typedef struct {
+    EFI_BOOT_SERVICES *BootServices;
+    EFI_RUNTIME_SERVICES *RuntimeServices;
+} EFI_SYSTEM_TABLE;
+
+extern EFI_SYSTEM_TABLE *gST;
+extern EFI_HANDLE gImageHandle;
+
+/* ACPI pointers only appear in the configuration structure. */
+typedef struct EFI_ACPI_1_0_ROOT_SYSTEM_DESCRIPTION_POINTER
+    EFI_ACPI_1_0_ROOT_SYSTEM_DESCRIPTION_POINTER;
+typedef struct EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER
+    EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER;
+
+/* Printing is quiet, and assertions are checked. */
+#define DEBUG_ERROR 0x80000000
+#define DEBUG_INFO  0x00000040
+#define DEBUG_VERBOSE 0x00400000
+#define DebugPrint(level, ...) do { } while(0)
+#define AsciiPrint(...) ((void)0)
+#define ASSERT(x) do { if(!(x)) { \
+    fprintf(stderr, "%s:%d: ASSERT(%s)\n", __FILE__, __LINE__, #x); \
+    abort(); } } while(0)
+
+#endif /* __HAGFISH_BENCH_UEFI_H */
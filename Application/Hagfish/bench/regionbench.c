@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2017, ETH Zuerich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+/*
+ * Host benchmark for the RAM region list.
+ *
+ * Feeds synthetic, heavily fragmented EFI memory maps through Memory.c's
+ * get_region_list(), and then looks up random addresses with
+ * search_region_list(), reporting the time taken per descriptor and per
+ * lookup.  Each map is built sorted, reversed and shuffled, and a sample of
+ * lookups is checked against a linear scan.
+ *
+ * This isn't part of the UEFI build; to build it on a Linux host, from
+ * Application/Hagfish:
+ *
+ *   cc -O2 -Ibench/host -I. -I../../Include \
+ *      bench/regionbench.c Memory.c -o regionbench
+ *
+ *   ./regionbench [descriptors...]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <Uefi.h>
+
+#include <Memory.h>
+
+/* Larger than the architectural descriptor, as some firmware uses. */
+#define BENCH_D_SIZE 48
+#define BENCH_LOOKUPS 1000000
+#define BENCH_CHECKS 10000
+
+EFI_SYSTEM_TABLE *gST;
+EFI_HANDLE gImageHandle;
+
+static char *bench_map;
+static UINTN bench_map_size;
+
+static EFI_STATUS
+bench_get_memory_map(UINTN *size, EFI_MEMORY_DESCRIPTOR *map, UINTN *key,
+                     UINTN *d_size, UINT32 *d_ver) {
+    if(*size < bench_map_size) {
+        *size= bench_map_size;
+        return EFI_BUFFER_TOO_SMALL;
+    }
+
+    memcpy(map, bench_map, bench_map_size);
+    *size= bench_map_size;
+    *key= 0;
+    *d_size= BENCH_D_SIZE;
+    *d_ver= 1;
+    return EFI_SUCCESS;
+}
+
+static EFI_BOOT_SERVICES bench_bs= { bench_get_memory_map, NULL };
+static EFI_SYSTEM_TABLE bench_st= { &bench_bs, NULL };
+
+static EFI_MEMORY_DESCRIPTOR *
+bench_desc(size_t i) {
+    return (EFI_MEMORY_DESCRIPTOR *)(bench_map + i * BENCH_D_SIZE);
+}
+
+static void
+swap_desc(size_t i, size_t j) {
+    char t[BENCH_D_SIZE];
+
+    memcpy(t, bench_desc(i), BENCH_D_SIZE);
+    memcpy(bench_desc(i), bench_desc(j), BENCH_D_SIZE);
+    memcpy(bench_desc(j), t, BENCH_D_SIZE);
+}
+
+/* A fragmented map: mostly small runs of assorted types, with the
+ * occasional MMIO window and gap. */
+static uint64_t
+build_map(size_t n) {
+    uint64_t addr= 0x80000000;
+    size_t i;
+
+    for(i= 0; i < n; i++) {
+        EFI_MEMORY_DESCRIPTOR *desc= bench_desc(i);
+        uint32_t r= rand();
+
+        memset(desc, 0, BENCH_D_SIZE);
+        if(r % 64 == 0) addr+= (uint64_t)(1 + r % 16) * 4096;
+        desc->PhysicalStart= addr;
+        desc->NumberOfPages= 1 + (r >> 8) % 32;
+        desc->Type= r % 97 == 0 ? EfiMemoryMappedIO
+                                : (EFI_MEMORY_TYPE)((r >> 16) % 8);
+        addr+= desc->NumberOfPages * 4096;
+    }
+    bench_map_size= n * BENCH_D_SIZE;
+
+    return addr;
+}
+
+/* The answer search_region_list() should give, by linear scan. */
+static size_t
+search_linear(struct region_list *list, uint64_t addr) {
+    size_t i;
+
+    for(i= 0; i < list->nregions; i++) {
+        if(list->regions[i].base <= addr &&
+           addr < list->regions[i].base + list->regions[i].npages * 4096)
+            break;
+    }
+
+    return i;
+}
+
+static double
+elapsed_ns(struct timespec *t0, struct timespec *t1) {
+    return (double)(t1->tv_sec - t0->tv_sec) * 1e9 +
+           (double)(t1->tv_nsec - t0->tv_nsec);
+}
+
+static int
+run(size_t n, const char *order) {
+    struct timespec t0, t1;
+    struct region_list *list;
+    uint64_t top, found;
+    size_t i;
+
+    top= build_map(n);
+    if(!strcmp(order, "reversed")) {
+        for(i= 0; i < n / 2; i++) swap_desc(i, n - 1 - i);
+    }
+    else if(!strcmp(order, "shuffled")) {
+        for(i= n - 1; i > 0; i--) swap_desc(i, rand() % (i + 1));
+    }
+
+    /* Noting a page outside the map leaves the shadow stale, so that
+     * get_region_list() fetches and sorts this one. */
+    memory_map_note(0, 1, EfiLoaderData);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    list= get_region_list(NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if(!list) {
+        fprintf(stderr, "get_region_list failed\n");
+        return 1;
+    }
+    printf("%6zu descriptors, %-8s: %6zu regions, %8.1f ns/descriptor",
+           n, order, list->nregions, elapsed_ns(&t0, &t1) / (double)n);
+
+    for(i= 0; i < BENCH_CHECKS; i++) {
+        uint64_t addr= 0x80000000 + (uint64_t)rand() * 4096 %
+                       (top - 0x80000000) + rand() % 4096;
+        if(search_region_list(list, addr) != search_linear(list, addr)) {
+            fprintf(stderr, "\nlookup of %#llx disagrees\n",
+                    (unsigned long long)addr);
+            return 1;
+        }
+    }
+
+    found= 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for(i= 0; i < BENCH_LOOKUPS; i++) {
+        uint64_t addr= 0x80000000 + (uint64_t)rand() * 4096 %
+                       (top - 0x80000000);
+        if(search_region_list(list, addr) < list->nregions) found++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf(", %6.1f ns/lookup (%lu hits)\n",
+           elapsed_ns(&t0, &t1) / BENCH_LOOKUPS, (unsigned long)found);
+
+    free_region_list(list);
+    return 0;
+}
+
+int
+main(int argc, char **argv) {
+    static const char *orders[]= { "sorted", "reversed", "shuffled" };
+    size_t sizes[]= { 1000, 10000, 100000 };
+    size_t nsizes= sizeof(sizes) / sizeof(sizes[0]);
+    size_t i, j, max= 0;
+
+    if(argc > 1) {
+        nsizes= 0;
+        for(i= 1; i < (size_t)argc && nsizes < 3; i++)
+            sizes[nsizes++]= strtoul(argv[i], NULL, 0);
+    }
+
+    for(i= 0; i < nsizes; i++) max= MAX(max, sizes[i]);
+
+    bench_map= malloc(max * BENCH_D_SIZE);
+    if(!bench_map) return 1;
+    gST= &bench_st;
+    srand(1);
+
+    for(i= 0; i < nsizes; i++) {
+        for(j= 0; j < 3; j++) {
+            if(run(sizes[i], orders[j])) return 1;
+        }
+    }
+
+    free(bench_map);
+    return 0;
+}
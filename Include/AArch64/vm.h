@@ -40,6 +40,32 @@
 #define ARMv8_TOP_TABLE_MASK                  (ARMv8_TOP_TABLE_SIZE - 1)
 #define ARMv8_TOP_TABLE_OFFSET(a)             ((a) & ARMv8_TOP_TABLE_MASK)
 
+/* Translation granules.  A table is one granule of 8-byte descriptors, and
+ * each level of the walk translates that many more address bits. */
+#define ARMv8_GRANULE_4K_BITS                 12
+#define ARMv8_GRANULE_16K_BITS                14
+#define ARMv8_GRANULE_64K_BITS                16
+
+#define ARMv8_TABLE_BITS(g)                   ((g) - 3)
+#define ARMv8_TABLE_ENTRIES(g)                (1ULL << ARMv8_TABLE_BITS(g))
+
+/* The lowest address bit translated at a level (0-3) of the walk. */
+#define ARMv8_LEVEL_SHIFT(g, level) \
+    ((g) + (3 - (level)) * ARMv8_TABLE_BITS(g))
+#define ARMv8_LEVEL_SIZE(g, level) \
+    (1ULL << ARMv8_LEVEL_SHIFT(g, level))
+
+/* Raw descriptor fields, common to all granules, for up to 48-bit output
+ * addresses.  The output address is granule-aligned. */
+#define ARMv8_DESC_VALID                      (1ULL << 0)
+#define ARMv8_DESC_TABLE                      (1ULL << 1) /* Or L3 page. */
+#define ARMv8_DESC_ATTRINDEX(i)               ((uint64_t)(i) << 2)
+#define ARMv8_DESC_ATTRINDEX_OF(d)            (((d) >> 2) & 0x7)
+#define ARMv8_DESC_SH(sh)                     ((uint64_t)(sh) << 8)
+#define ARMv8_DESC_AF                         (1ULL << 10)
+#define ARMv8_DESC_CONTIGUOUS                 (1ULL << 52)
+#define ARMv8_DESC_ADDRESS_MASK               0x0000fffffffff000ULL
+
 /* These descriptors formats are valid for a 4kB translation granule. */
 union aarch64_descriptor {
     uint64_t raw;
@@ -0,0 +1,17 @@
+/*
+ * Copyright (c) 2017, ETH Zuerich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef __HAGFISH_RUNTIME_ASSERT_H
+#define __HAGFISH_RUNTIME_ASSERT_H
+
+#include <Library/DebugLib.h>
+
+#define assert(e) ASSERT(e)
+
+#endif /* __HAGFISH_RUNTIME_ASSERT_H */
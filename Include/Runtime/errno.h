@@ -0,0 +1,19 @@
+/*
+ * Copyright (c) 2017, ETH Zuerich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef __HAGFISH_RUNTIME_ERRNO_H
+#define __HAGFISH_RUNTIME_ERRNO_H
+
+extern int errno;
+
+#define EINVAL 22
+#define ENOMEM 12
+#define ERANGE 34
+
+#endif /* __HAGFISH_RUNTIME_ERRNO_H */
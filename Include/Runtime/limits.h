@@ -0,0 +1,22 @@
+/*
+ * Copyright (c) 2017, ETH Zuerich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef __HAGFISH_RUNTIME_LIMITS_H
+#define __HAGFISH_RUNTIME_LIMITS_H
+
+#define CHAR_BIT   8
+
+#define INT_MAX    0x7fffffff
+#define INT_MIN    (-INT_MAX - 1)
+#define UINT_MAX   0xffffffffU
+#define LONG_MAX   0x7fffffffffffffffL
+#define LONG_MIN   (-LONG_MAX - 1)
+#define ULONG_MAX  0xffffffffffffffffUL
+
+#endif /* __HAGFISH_RUNTIME_LIMITS_H */
@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) 2017, ETH Zuerich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+/* The subset of the C runtime used by Hagfish and libelf, built directly on
+ * the EDK base types and libraries.  See Library/Runtime. */
+
+#ifndef __HAGFISH_RUNTIME_STDDEF_H
+#define __HAGFISH_RUNTIME_STDDEF_H
+
+#include <Base.h>
+
+typedef UINTN size_t;
+typedef INTN  ptrdiff_t;
+
+#define offsetof(type, member) OFFSET_OF(type, member)
+
+#endif /* __HAGFISH_RUNTIME_STDDEF_H */
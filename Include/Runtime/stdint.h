@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2017, ETH Zuerich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef __HAGFISH_RUNTIME_STDINT_H
+#define __HAGFISH_RUNTIME_STDINT_H
+
+#include <Base.h>
+
+typedef INT8   int8_t;
+typedef INT16  int16_t;
+typedef INT32  int32_t;
+typedef INT64  int64_t;
+typedef UINT8  uint8_t;
+typedef UINT16 uint16_t;
+typedef UINT32 uint32_t;
+typedef UINT64 uint64_t;
+
+typedef INTN   intptr_t;
+typedef UINTN  uintptr_t;
+
+#define INT8_MIN   (-INT8_MAX - 1)
+#define INT16_MIN  (-INT16_MAX - 1)
+#define INT32_MIN  (-INT32_MAX - 1)
+#define INT64_MIN  (-INT64_MAX - 1)
+#define INT8_MAX   0x7f
+#define INT16_MAX  0x7fff
+#define INT32_MAX  0x7fffffff
+#define INT64_MAX  0x7fffffffffffffffLL
+#define UINT8_MAX  0xff
+#define UINT16_MAX 0xffff
+#define UINT32_MAX 0xffffffffU
+#define UINT64_MAX 0xffffffffffffffffULL
+
+#define SIZE_MAX   MAX_UINTN
+
+#endif /* __HAGFISH_RUNTIME_STDINT_H */
@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) 2017, ETH Zuerich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef __HAGFISH_RUNTIME_STDLIB_H
+#define __HAGFISH_RUNTIME_STDLIB_H
+
+#include <stddef.h>
+
+/* Pool-backed heap, on gBS->AllocatePool. */
+void *malloc(size_t size);
+void *calloc(size_t n, size_t size);
+void *realloc(void *ptr, size_t size);
+void free(void *ptr);
+
+/* In-place heapsort; needs no memory beyond the stack. */
+void qsort(void *base, size_t n, size_t size,
+           int (*compar)(const void *, const void *));
+
+#endif /* __HAGFISH_RUNTIME_STDLIB_H */
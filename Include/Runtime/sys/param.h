@@ -0,0 +1,19 @@
+/*
+ * Copyright (c) 2017, ETH Zuerich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef __HAGFISH_RUNTIME_SYS_PARAM_H
+#define __HAGFISH_RUNTIME_SYS_PARAM_H
+
+#include <sys/types.h>
+
+/* MIN() and MAX() come from Base.h. */
+#define howmany(x, y) (((x) + ((y) - 1)) / (y))
+#define roundup(x, y) ((((x) + ((y) - 1)) / (y)) * (y))
+
+#endif /* __HAGFISH_RUNTIME_SYS_PARAM_H */
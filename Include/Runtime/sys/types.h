@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) 2017, ETH Zuerich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef __HAGFISH_RUNTIME_SYS_TYPES_H
+#define __HAGFISH_RUNTIME_SYS_TYPES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef INTN   ssize_t;
+typedef INT64  off_t;
+typedef INT64  time_t;
+typedef UINT32 mode_t;
+typedef UINT32 uid_t;
+typedef UINT32 gid_t;
+
+#endif /* __HAGFISH_RUNTIME_SYS_TYPES_H */
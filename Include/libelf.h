@@ -142,6 +142,23 @@ typedef struct {
 	char		*as_name; 	/* null terminated symbol name */
 } Elf_Arsym;
 
+/*
+ * An `Elf64_View' is a read-only view of a native-endian ELF64 image
+ * in memory.  It is validated once, when created, and thereafter
+ * hands out pointers directly into the image, without translation or
+ * allocation.
+ */
+typedef struct {
+	const unsigned char *ev_image;	/* start of the image */
+	size_t		ev_size;	/* size of the image */
+	const Elf64_Ehdr *ev_ehdr;
+	const Elf64_Phdr *ev_phdr;
+	size_t		ev_phnum;
+	const Elf64_Shdr *ev_shdr;
+	size_t		ev_shnum;
+	size_t		ev_shstrndx;
+} Elf64_View;
+
 /*
  * Error numbers.
  */
@@ -206,6 +223,7 @@ int		elf_getshdrnum(Elf *_elf, size_t *_dst);
 int		elf_getshnum(Elf *_elf, size_t *_dst);	/* Deprecated */
 int		elf_getshdrstrndx(Elf *_elf, size_t *_dst);
 int		elf_getshstrndx(Elf *_elf, size_t *_dst); /* Deprecated */
+unsigned long	elf_gnu_hash(const char *_name);
 unsigned long	elf_hash(const char *_name);
 Elf_Kind	elf_kind(Elf *_elf);
 Elf		*elf_memory(char *_image, size_t _size);
@@ -249,6 +267,14 @@ Elf_Data	*elf64_xlatetof(Elf_Data *_dst, const Elf_Data *_src,
 			unsigned int _enc);
 Elf_Data	*elf64_xlatetom(Elf_Data *_dst, const Elf_Data *_src,
 			unsigned int _enc);
+
+int		elf64_view(Elf64_View *_v, const char *_image, size_t _size);
+const Elf64_Shdr *elf64_view_getshdr(const Elf64_View *_v, size_t _index);
+const void	*elf64_view_getsection(const Elf64_View *_v,
+			const Elf64_Shdr *_shdr, size_t _entsize,
+			size_t *_count);
+const Elf64_Rela *elf64_view_getrela(const Elf64_View *_v,
+			const Elf64_Shdr *_shdr, size_t *_count);
 #ifdef __cplusplus
 }
 #endif
@@ -61,6 +61,14 @@
 #define MULTIBOOT_TAG_TYPE_EFI_MMAP          17
 #define MULTIBOOT_TAG_TYPE_EFI_BS            18
 #define MULTIBOOT_TAG_TYPE_MODULE_64         19
+#define MULTIBOOT_TAG_TYPE_SYMTAB_64         20
+#define MULTIBOOT_TAG_TYPE_FREE_MEMORY       21
+#define MULTIBOOT_TAG_TYPE_MADT              22
+#define MULTIBOOT_TAG_TYPE_TIMESTAMPS        23
+#define MULTIBOOT_TAG_TYPE_TOPOLOGY          24
+#define MULTIBOOT_TAG_TYPE_NUMA              25
+#define MULTIBOOT_TAG_TYPE_PAGE_TABLES       26
+#define MULTIBOOT_TAG_TYPE_MMAP_STATS        27
 
 #define MULTIBOOT_HEADER_TAG_END  0
 #define MULTIBOOT_HEADER_TAG_INFORMATION_REQUEST  1
@@ -212,6 +220,280 @@ struct multiboot_tag_module_64
   char cmdline[0];
 };
 
+/* A symbol from the kernel's symbol table, at its relocated address. */
+struct multiboot_symbol_64
+{
+  multiboot_uint64_t addr;
+  multiboot_uint64_t size;
+  multiboot_uint32_t name;      /* Offset into the string table. */
+  multiboot_uint32_t info;      /* ELF st_info */
+};
+
+/* The kernel's function and object symbols.  The tables themselves are
+ * outside the multiboot structure, and all pointers are physical addresses.
+ *
+ * syms is sorted by address.  The hash index is laid out as for DT_GNU_HASH
+ * (see elf_gnu_hash()), except that chain and order are indexed by position
+ * in hash order, and order maps each position to its index in syms.  An empty
+ * bucket holds 0xffffffff. */
+struct multiboot_tag_symtab_64
+{
+  multiboot_uint32_t type;
+  multiboot_uint32_t size;
+  multiboot_uint32_t num_syms;
+  multiboot_uint32_t num_buckets;
+  multiboot_uint32_t bloom_size;    /* In 64-bit words, a power of two. */
+  multiboot_uint32_t bloom_shift;
+  multiboot_uint64_t syms;          /* struct multiboot_symbol_64[num_syms] */
+  multiboot_uint64_t bloom;         /* multiboot_uint64_t[bloom_size] */
+  multiboot_uint64_t buckets;       /* multiboot_uint32_t[num_buckets] */
+  multiboot_uint64_t chain;         /* multiboot_uint32_t[num_syms] */
+  multiboot_uint64_t order;         /* multiboot_uint32_t[num_syms] */
+  multiboot_uint64_t strings;
+  multiboot_uint64_t strings_size;
+};
+
+/* What the loader did to the final EFI memory map before passing it on:
+ * descriptors_in were returned by the firmware, and descriptors_out are in
+ * the EFI memory map tag.  merged descriptors were coalesced into their
+ * predecessor, and reclaimed boot services descriptors retyped as
+ * conventional memory. */
+struct multiboot_tag_mmap_stats
+{
+  multiboot_uint32_t type;
+  multiboot_uint32_t size;
+  multiboot_uint32_t descriptors_in;
+  multiboot_uint32_t descriptors_out;
+  multiboot_uint32_t merged;
+  multiboot_uint32_t reclaimed;
+};
+
+/* A range of free RAM.  base and size are multiples of page_size, which is
+ * the largest of 4kiB, 2MiB and 1GiB that the range allows. */
+struct multiboot_free_range
+{
+  multiboot_uint64_t base;
+  multiboot_uint64_t size;
+  multiboot_uint32_t page_size;
+  multiboot_uint32_t reserved;
+};
+
+/* The RAM that's free once boot services have exited, taken from the final
+ * EFI memory map: conventional memory and boot services code and data, less
+ * everything else, including all EfiBarrelfish* regions.  The ranges are
+ * sorted by base and don't overlap, and adjacent free descriptors have been
+ * merged before splitting at 2MiB and 1GiB boundaries.  If num_ranges is
+ * zero, the kernel must classify the EFI memory map itself. */
+struct multiboot_tag_free_memory
+{
+  multiboot_uint32_t type;
+  multiboot_uint32_t size;
+  multiboot_uint32_t num_ranges;
+  multiboot_uint32_t reserved;
+  struct multiboot_free_range ranges[0];
+};
+
+/* One enabled GICC, from the MADT.  The parked address is zero if the CPU
+ * doesn't use the parking protocol. */
+struct multiboot_madt_cpu
+{
+  multiboot_uint64_t mpidr;
+  multiboot_uint64_t gicr_base;
+  multiboot_uint64_t parked_address;
+  multiboot_uint32_t acpi_uid;
+  multiboot_uint32_t flags;
+  multiboot_uint32_t parking_version;
+  multiboot_uint32_t reserved;
+};
+
+/* A digest of the MADT, enough to start the secondary cores without parsing
+ * ACPI.  cpus[] holds every enabled GICC, in table order, and is followed by
+ * num_its multiboot_uint64_t ITS base addresses.  gicd_base is zero if the
+ * table has no GICD. */
+struct multiboot_tag_madt
+{
+  multiboot_uint32_t type;
+  multiboot_uint32_t size;
+  multiboot_uint32_t num_cpus;
+  multiboot_uint32_t num_its;
+  multiboot_uint64_t gicd_base;
+  struct multiboot_madt_cpu cpus[0];
+};
+
+/* Boot phases, each timestamped as it ends.  Phases from
+ * MULTIBOOT_PHASE_KERNEL up are the kernel's own. */
+#define MULTIBOOT_PHASE_START                0
+#define MULTIBOOT_PHASE_CONFIG               1
+#define MULTIBOOT_PHASE_ACPI                 2
+#define MULTIBOOT_PHASE_LOAD_BOOT_DRIVER     3
+#define MULTIBOOT_PHASE_LOAD_CPU_DRIVER      4
+#define MULTIBOOT_PHASE_LOAD_MODULE          5
+#define MULTIBOOT_PHASE_RAM_REGIONS          6
+#define MULTIBOOT_PHASE_PAGE_TABLES          7
+#define MULTIBOOT_PHASE_PREPARE_BOOT_DRIVER  8
+#define MULTIBOOT_PHASE_PREPARE_CPU_DRIVER   9
+#define MULTIBOOT_PHASE_MULTIBOOT            10
+#define MULTIBOOT_PHASE_EXIT_BOOT_SERVICES   11
+#define MULTIBOOT_PHASE_ARCH_INIT            12
+#define MULTIBOOT_PHASE_MEMORY_MAP           13
+#define MULTIBOOT_PHASE_KERNEL               0x1000
+
+/* The PMU counts are valid. */
+#define MULTIBOOT_TIMESTAMPS_PMU             1
+
+struct multiboot_timestamp
+{
+  multiboot_uint64_t counter;       /* CNTVCT_EL0 */
+  multiboot_uint64_t cycles;        /* PMCCNTR_EL0 */
+  multiboot_uint64_t instructions;  /* Instructions retired. */
+  multiboot_uint32_t phase;
+  multiboot_uint32_t reserved;
+};
+
+/* Timestamps taken at the end of each boot phase, in order.  counter ticks at
+ * frequency Hz.  The tag has room for max_stamps entries, so that the kernel
+ * can append its own.  num_dropped stamps didn't fit, and were merged into
+ * the stamp before them, of the same phase, or lost. */
+struct multiboot_tag_timestamps
+{
+  multiboot_uint32_t type;
+  multiboot_uint32_t size;
+  multiboot_uint64_t frequency;     /* CNTFRQ_EL0 */
+  multiboot_uint32_t flags;
+  multiboot_uint32_t num_stamps;
+  multiboot_uint32_t max_stamps;
+  multiboot_uint32_t num_dropped;
+  struct multiboot_timestamp stamps[0];
+};
+
+#define MULTIBOOT_CACHE_INSTRUCTION          1
+#define MULTIBOOT_CACHE_DATA                 2
+#define MULTIBOOT_CACHE_UNIFIED              3
+
+/* Some of the geometry was read from the boot core's CCSIDR_EL1, as the PPTT
+ * didn't give it. */
+#define MULTIBOOT_CACHE_FROM_CPU             1
+/* This cache comes only from the boot core's CLIDR_EL1, and so its sharing
+ * is unknown.  No CPU refers to it. */
+#define MULTIBOOT_CACHE_BOOT_CORE            2
+
+/* A cache.  Fields that are unknown are zero. */
+struct multiboot_topology_cache
+{
+  multiboot_uint32_t level;
+  multiboot_uint32_t type;
+  multiboot_uint32_t size;
+  multiboot_uint32_t sets;
+  multiboot_uint32_t ways;
+  multiboot_uint32_t line_size;
+  multiboot_uint32_t flags;
+  multiboot_uint32_t reserved;
+};
+
+#define MULTIBOOT_TOPOLOGY_UNKNOWN           0xffffffff
+#define MULTIBOOT_TOPOLOGY_MAX_CACHES        8
+
+/* The hardware thread is one of several sharing a core. */
+#define MULTIBOOT_TOPOLOGY_THREAD            1
+
+/* One enabled CPU, in the same order as in the MADT tag.  package, cluster
+ * and core are opaque identifiers: two CPUs share one iff the identifiers are
+ * equal.  caches[] holds indices into the tag's caches, innermost first,
+ * padded with MULTIBOOT_TOPOLOGY_UNKNOWN; two CPUs sharing a cache refer to
+ * the same index. */
+struct multiboot_topology_cpu
+{
+  multiboot_uint64_t mpidr;
+  multiboot_uint32_t package;
+  multiboot_uint32_t cluster;
+  multiboot_uint32_t core;
+  multiboot_uint32_t flags;
+  multiboot_uint32_t caches[MULTIBOOT_TOPOLOGY_MAX_CACHES];
+};
+
+/* The processor and cache topology, from the PPTT, filled out with the boot
+ * core's cache geometry.  cpus[] is followed by num_caches
+ * multiboot_topology_cache entries.  Without a PPTT, the CPUs' identifiers
+ * are unknown, and the caches are the boot core's. */
+struct multiboot_tag_topology
+{
+  multiboot_uint32_t type;
+  multiboot_uint32_t size;
+  multiboot_uint32_t num_cpus;
+  multiboot_uint32_t num_caches;
+  struct multiboot_topology_cpu cpus[0];
+};
+
+#define MULTIBOOT_NUMA_UNKNOWN               0xffffffff
+
+#define MULTIBOOT_NUMA_HOTPLUG               1
+#define MULTIBOOT_NUMA_NONVOLATILE           2
+
+/* A range of memory in one NUMA node, from the SRAT. */
+struct multiboot_numa_memory
+{
+  multiboot_uint64_t base;
+  multiboot_uint64_t size;
+  multiboot_uint32_t node;
+  multiboot_uint32_t flags;
+};
+
+/* The NUMA affinity of memory and CPUs.  Nodes are ACPI proximity domains.
+ * memory[] is followed, at the given offsets from the start of the tag, by:
+ *  - multiboot_uint32_t cpu_nodes[num_cpus], the node of each CPU, in MADT
+ *    tag order.
+ *  - multiboot_uint8_t distances[num_nodes][num_nodes], from the SLIT, if
+ *    distances_offset is non-zero.
+ *  - multiboot_uint32_t latencies[num_nodes][num_nodes], the access latency
+ *    in picoseconds from initiator to memory node, from the HMAT, if
+ *    latencies_offset is non-zero.  Zero means unknown.
+ * boot_node is the node of the boot core, whose memory holds the kernel's
+ * own regions, if it had room. */
+struct multiboot_tag_numa
+{
+  multiboot_uint32_t type;
+  multiboot_uint32_t size;
+  multiboot_uint32_t num_nodes;
+  multiboot_uint32_t num_memory;
+  multiboot_uint32_t num_cpus;
+  multiboot_uint32_t boot_node;
+  multiboot_uint32_t cpu_nodes_offset;
+  multiboot_uint32_t distances_offset;
+  multiboot_uint32_t latencies_offset;
+  multiboot_uint32_t reserved;
+  struct multiboot_numa_memory memory[0];
+};
+
+#define MULTIBOOT_PAGE_TABLES_HIGH_HALF      1
+
+/* The kernel's initial page tables, as installed by the loader.  granule is
+ * the translation granule in bytes, and root_level the level of the tables
+ * that ttbr0 and ttbr1 point to, which depends on it (0 for 4kB and 16kB, 1
+ * for 64kB).  ttbr0 maps physical memory 1-1, and ttbr1 maps the same window
+ * at kernel_offset, sharing all but the root table.  pa_bits is the boot
+ * core's physical address size, which TCR is configured for, and which the
+ * window covers unless that would take too many tables.  mair holds the
+ * memory attributes that the tables were installed with: RAM uses index
+ * attr_cached, and everything else attr_device.
+ * MULTIBOOT_PAGE_TABLES_HIGH_HALF is set in flags if ttbr1 is live,
+ * which it can't be at EL2 without VHE: a kernel that drops to EL1 can
+ * install it itself. */
+struct multiboot_tag_page_tables
+{
+  multiboot_uint32_t type;
+  multiboot_uint32_t size;
+  multiboot_uint32_t granule;
+  multiboot_uint32_t root_level;
+  multiboot_uint64_t ttbr0;
+  multiboot_uint64_t ttbr1;
+  multiboot_uint64_t kernel_offset;
+  multiboot_uint64_t mair;
+  multiboot_uint32_t pa_bits;
+  multiboot_uint32_t flags;
+  multiboot_uint32_t attr_cached;
+  multiboot_uint32_t attr_device;
+};
+
 struct multiboot_tag_basic_meminfo
 {
   multiboot_uint32_t type;
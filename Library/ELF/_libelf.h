@@ -79,6 +79,7 @@ extern struct _libelf_globals _libelf;
 #define	LIBELF_F_RAWFILE_MMAP	0x100000U /* whether e_rawfile was mmap'ed */
 #define	LIBELF_F_SHDRS_LOADED	0x200000U /* whether all shdrs were read in */
 #define	LIBELF_F_SPECIAL_FILE	0x400000U /* non-regular file */
+#define	LIBELF_F_DATA_SHARED	0x800000U /* data points into e_rawfile */
 
 struct _Elf {
 	int		e_activations;	/* activation count */
@@ -92,6 +93,7 @@ struct _Elf {
 	unsigned char	*e_rawfile;	/* uninterpreted bytes */
 	size_t		e_rawsize;	/* size of uninterpreted bytes */
 	unsigned int	e_version;	/* file version */
+	struct _Libelf_Chunk *e_arena;	/* descriptor storage */
 
 	/*
 	 * Header information for archive members.  See the
@@ -123,6 +125,8 @@ struct _Elf {
 				Elf64_Phdr *e_phdr64;
 			} e_phdr;
 			STAILQ_HEAD(, _Elf_Scn)	e_scn;	/* section list */
+			Elf_Scn	**e_scnindex;	/* sections by index */
+			size_t	e_scnindexsz;	/* size of e_scnindex */
 			size_t	e_nphdr;	/* number of Phdr entries */
 			size_t	e_nscn;		/* number of sections */
 			size_t	e_strndx;	/* string table section index */
@@ -198,8 +202,12 @@ enum {
 extern "C" {
 #endif
 struct _Libelf_Data *_libelf_allocate_data(Elf_Scn *_s);
+void	*_libelf_arena_alloc(Elf *_e, size_t _sz);
+Elf	*_libelf_arena_new_elf(void);
+void	_libelf_arena_release(Elf *_e);
 Elf	*_libelf_allocate_elf(void);
 Elf_Scn	*_libelf_allocate_scn(Elf *_e, size_t _ndx);
+int	_libelf_allocate_scnindex(Elf *_e, size_t _count);
 Elf_Arhdr *_libelf_ar_gethdr(Elf *_e);
 Elf	*_libelf_ar_open(Elf *_e, int _reporterror);
 Elf	*_libelf_ar_open_member(int _fd, Elf_Cmd _c, Elf *_ar);
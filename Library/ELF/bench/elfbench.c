@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2017, ETH Zuerich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+/*
+ * Host benchmark for libelf descriptor handling.
+ *
+ * Repeatedly opens an in-memory ELF image, walks every section, fetches
+ * its data and closes it again, reporting the time taken and the number
+ * of heap calls made per iteration.  This isn't part of the UEFI build;
+ * to build it on a Linux host, from Library/ELF:
+ *
+ *   for f in *.c; do
+ *     cc -c -O2 -U__linux__ -DLIBELF_ARCH=EM_X86_64 \
+ *        -DLIBELF_BYTEORDER=ELFDATA2LSB -DLIBELF_CLASS=ELFCLASS64 \
+ *        -I../../Include -I. $f || break
+ *   done
+ *   ar rcs libelf.a *.o
+ *   cc -O2 -I../../Include bench/elfbench.c libelf.a -o elfbench \
+ *      -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free
+ *
+ *   ./elfbench [-n iterations] file...
+ */
+
+#include <gelf.h>
+#include <libelf.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static unsigned long nmalloc, nfree;
+
+void *__real_malloc(size_t);
+void *__real_calloc(size_t, size_t);
+void *__real_realloc(void *, size_t);
+void __real_free(void *);
+
+void *
+__wrap_malloc(size_t sz)
+{
+	nmalloc++;
+	return (__real_malloc(sz));
+}
+
+void *
+__wrap_calloc(size_t n, size_t sz)
+{
+	nmalloc++;
+	return (__real_calloc(n, sz));
+}
+
+void *
+__wrap_realloc(void *p, size_t sz)
+{
+	nmalloc++;
+	return (__real_realloc(p, sz));
+}
+
+void
+__wrap_free(void *p)
+{
+	if (p != NULL)
+		nfree++;
+	__real_free(p);
+}
+
+static char *
+load_file(const char *name, size_t *size)
+{
+	FILE *f;
+	char *buf;
+	long sz;
+
+	if ((f = fopen(name, "rb")) == NULL)
+		return (NULL);
+
+	buf = NULL;
+	if (fseek(f, 0, SEEK_END) == 0 && (sz = ftell(f)) > 0 &&
+	    fseek(f, 0, SEEK_SET) == 0 &&
+	    (buf = malloc((size_t) sz)) != NULL &&
+	    fread(buf, 1, (size_t) sz, f) != (size_t) sz) {
+		free(buf);
+		buf = NULL;
+	}
+	fclose(f);
+
+	if (buf != NULL)
+		*size = (size_t) sz;
+
+	return (buf);
+}
+
+/*
+ * Open the image, touch every section's data, and close it again.
+ * Returns the number of bytes of section data seen, or -1 on error.
+ */
+static long
+walk_image(char *image, size_t size)
+{
+	Elf *e;
+	Elf_Scn *scn;
+	Elf_Data *data;
+	size_t i, shnum;
+	long bytes;
+
+	if ((e = elf_memory(image, size)) == NULL)
+		return (-1);
+
+	bytes = -1;
+	if (elf_getshdrnum(e, &shnum) != 0)
+		goto done;
+
+	bytes = 0;
+	for (i = 1; i < shnum; i++) {
+		if ((scn = elf_getscn(e, i)) == NULL) {
+			bytes = -1;
+			goto done;
+		}
+		data = NULL;
+		while ((data = elf_getdata(scn, data)) != NULL)
+			bytes += (long) data->d_size;
+	}
+
+done:
+	(void) elf_end(e);
+	return (bytes);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct timespec t0, t1;
+	unsigned long iterations, it, m0, f0;
+	size_t size;
+	char *image;
+	double ns;
+	long bytes;
+	int i;
+
+	iterations = 10000;
+	i = 1;
+	if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+		iterations = strtoul(argv[2], NULL, 0);
+		i = 3;
+	}
+
+	if (i >= argc || iterations == 0) {
+		fprintf(stderr, "usage: %s [-n iterations] file...\n", argv[0]);
+		return (1);
+	}
+
+	if (elf_version(EV_CURRENT) == EV_NONE) {
+		fprintf(stderr, "elf_version: %s\n", elf_errmsg(-1));
+		return (1);
+	}
+
+	for (; i < argc; i++) {
+		if ((image = load_file(argv[i], &size)) == NULL) {
+			fprintf(stderr, "%s: can't read\n", argv[i]);
+			return (1);
+		}
+
+		bytes = 0;
+		m0 = nmalloc;
+		f0 = nfree;
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for (it = 0; it < iterations && bytes >= 0; it++)
+			bytes = walk_image(image, size);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+
+		if (bytes < 0) {
+			fprintf(stderr, "%s: %s\n", argv[i], elf_errmsg(-1));
+			free(image);
+			return (1);
+		}
+
+		ns = (double) (t1.tv_sec - t0.tv_sec) * 1e9 +
+		    (double) (t1.tv_nsec - t0.tv_nsec);
+		printf("%s: %zu bytes, %ld bytes of section data\n",
+		    argv[i], size, bytes);
+		printf("  %.0f ns/iteration, %.1f allocations/iteration,"
+		    " %.1f frees/iteration\n", ns / (double) iterations,
+		    (double) (nmalloc - m0) / (double) iterations,
+		    (double) (nfree - f0) / (double) iterations);
+
+		free(image);
+	}
+
+	return (0);
+}
@@ -82,8 +82,10 @@ elf_begin(int fd, Elf_Cmd c, Elf *a)
 
 	if (a == NULL)
 		e = _libelf_open_object(fd, c, 1);
+#ifndef	LIBELF_NATIVE_READONLY
 	else if (a->e_kind == ELF_K_AR)
 		e = _libelf_ar_open_member(a->e_fd, c, a);
+#endif
 	else
 		(e = a)->e_activations++;
 
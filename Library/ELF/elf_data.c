@@ -143,6 +143,24 @@ elf_getdata(Elf_Scn *s, Elf_Data *ed)
 		return (&d->d_data);
         }
 
+	/*
+	 * A read-only descriptor whose file image is already in the
+	 * in-memory representation can hand out the image directly,
+	 * provided it is suitably aligned.  The copy is deferred until
+	 * the application marks the data dirty; see elf_flagdata().
+	 */
+	if (e->e_cmd == ELF_C_READ &&
+	    e->e_byteorder == LIBELF_PRIVATE(byteorder) &&
+	    elftype != ELF_T_GNUHASH && elftype != ELF_T_NOTE &&
+	    msz == fsz &&
+	    ((uintptr_t) (e->e_rawfile + sh_offset) %
+	    _libelf_malign(elftype, elfclass)) == 0) {
+		d->d_data.d_buf = e->e_rawfile + sh_offset;
+		d->d_flags |= LIBELF_F_DATA_SHARED;
+		STAILQ_INSERT_TAIL(&s->s_data, d, d_next);
+		return (&d->d_data);
+	}
+
 	if ((d->d_data.d_buf = malloc(msz * count)) == NULL) {
 		(void) _libelf_release_data(d);
 		LIBELF_SET_ERROR(RESOURCE, 0);
@@ -152,6 +170,11 @@ elf_getdata(Elf_Scn *s, Elf_Data *ed)
 	d->d_flags  |= LIBELF_F_DATA_MALLOCED;
 
 	xlate = _libelf_get_translator(elftype, ELF_TOMEMORY, elfclass);
+	if (xlate == NULL) {
+		_libelf_release_data(d);
+		LIBELF_SET_ERROR(UNIMPL, 0);
+		return (NULL);
+	}
 	if (!(*xlate)(d->d_data.d_buf, (size_t) d->d_data.d_size,
 	    e->e_rawfile + sh_offset, count,
 	    e->e_byteorder != LIBELF_PRIVATE(byteorder))) {
@@ -165,6 +188,7 @@ elf_getdata(Elf_Scn *s, Elf_Data *ed)
 	return (&d->d_data);
 }
 
+#ifndef	LIBELF_NATIVE_READONLY
 Elf_Data *
 elf_newdata(Elf_Scn *s)
 {
@@ -202,6 +226,7 @@ elf_newdata(Elf_Scn *s)
 
 	return (&d->d_data);
 }
+#endif	/* !LIBELF_NATIVE_READONLY */
 
 /*
  * Retrieve a data descriptor for raw (untranslated) data for section
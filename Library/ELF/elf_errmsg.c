@@ -25,9 +25,14 @@
  */
 
 #include <libelf.h>
-#include <stdio.h>
 #include <string.h>
 
+#ifdef	LIBELF_UEFI
+#include <Library/PrintLib.h>
+#else
+#include <stdio.h>
+#endif
+
 #include "_libelf.h"
 
 ELFTC_VCSID("$Id: elf_errmsg.c 3174 2015-03-27 17:13:41Z emaste $");
@@ -74,9 +79,15 @@ elf_errmsg(int error)
 	if (error < ELF_E_NONE || error >= ELF_E_NUM)
 		return _libelf_errors[ELF_E_NUM];
 	if (oserr) {
+#ifdef	LIBELF_UEFI
+		(void) AsciiSPrint((char *) LIBELF_PRIVATE(msg),
+		    sizeof(LIBELF_PRIVATE(msg)), "%a: %a",
+		    _libelf_errors[error], strerror(oserr));
+#else
 		(void) snprintf((char *) LIBELF_PRIVATE(msg),
 		    sizeof(LIBELF_PRIVATE(msg)), "%s: %s",
 		    _libelf_errors[error], strerror(oserr));
+#endif
 		return (const char *)&LIBELF_PRIVATE(msg);
 	}
 	return _libelf_errors[error];
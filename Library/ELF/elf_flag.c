@@ -25,6 +25,8 @@
  */
 
 #include <libelf.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "_libelf.h"
 
@@ -55,6 +57,7 @@ elf_flagarhdr(Elf_Arhdr *a, Elf_Cmd c, unsigned int flags)
 unsigned int
 elf_flagdata(Elf_Data *d, Elf_Cmd c, unsigned int flags)
 {
+	void *buf;
 	unsigned int r;
 	struct _Libelf_Data *ld;
 
@@ -69,6 +72,22 @@ elf_flagdata(Elf_Data *d, Elf_Cmd c, unsigned int flags)
 
 	ld = (struct _Libelf_Data *) d;
 
+	/*
+	 * Data shared with the file image gets a private copy before
+	 * the application is allowed to modify it.
+	 */
+	if (c == ELF_C_SET && (flags & ELF_F_DIRTY) &&
+	    (ld->d_flags & LIBELF_F_DATA_SHARED)) {
+		if ((buf = malloc(d->d_size)) == NULL) {
+			LIBELF_SET_ERROR(RESOURCE, 0);
+			return (0);
+		}
+		(void) memcpy(buf, d->d_buf, d->d_size);
+		d->d_buf = buf;
+		ld->d_flags &= ~LIBELF_F_DATA_SHARED;
+		ld->d_flags |= LIBELF_F_DATA_MALLOCED;
+	}
+
 	if (c == ELF_C_SET)
 		r = ld->d_flags |= flags;
 	else
@@ -25,6 +25,7 @@
  */
 
 #include <libelf.h>
+#include <stdint.h>
 
 #include "_libelf.h"
 
@@ -52,3 +53,21 @@ elf_hash(const char *name)
 
 	return (h);
 }
+
+/*
+ * The hash function used by the GNU DT_GNU_HASH section.
+ */
+
+unsigned long
+elf_gnu_hash(const char *name)
+{
+	uint32_t h;
+	const unsigned char *s;
+
+	s = (const unsigned char *) name;
+
+	for (h = 5381; *s != '\0'; s++)
+		h = (h << 5) + h + *s;
+
+	return (h);
+}
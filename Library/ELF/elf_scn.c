@@ -94,6 +94,10 @@ _libelf_load_section_headers(Elf *e, void *ehdr)
 	 * would have already been read in.
 	 */
 
+	/* Size the section index once, rather than growing it per section. */
+	if (_libelf_allocate_scnindex(e, shnum) == 0)
+		return (0);
+
 	i = 0;
 	if (!STAILQ_EMPTY(&e->e_u.e_elf.e_scn)) {
 		assert(STAILQ_FIRST(&e->e_u.e_elf.e_scn) ==
@@ -148,9 +152,9 @@ elf_getscn(Elf *e, size_t index)
 	    _libelf_load_section_headers(e, ehdr) == 0)
 		return (NULL);
 
-	STAILQ_FOREACH(s, &e->e_u.e_elf.e_scn, s_next)
-		if (s->s_ndx == index)
-			return (s);
+	if (index < e->e_u.e_elf.e_scnindexsz &&
+	    (s = e->e_u.e_elf.e_scnindex[index]) != NULL)
+		return (s);
 
 	LIBELF_SET_ERROR(ARGUMENT, 0);
 	return (NULL);
@@ -166,6 +170,7 @@ elf_ndxscn(Elf_Scn *s)
 	return (s->s_ndx);
 }
 
+#ifndef	LIBELF_NATIVE_READONLY
 Elf_Scn *
 elf_newscn(Elf *e)
 {
@@ -220,6 +225,7 @@ elf_newscn(Elf *e)
 
 	return (scn);
 }
+#endif	/* !LIBELF_NATIVE_READONLY */
 
 Elf_Scn *
 elf_nextscn(Elf *e, Elf_Scn *s)
@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2017, ETH Zuerich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+/*
+ * Read-only views of in-memory ELF64 images.
+ *
+ * The regular ELF(3) API allocates an Elf descriptor, translated copies
+ * of the headers, and a list of section descriptors.  When the image is
+ * already in memory, and of the host's class and byte order, none of
+ * that is necessary: once the header tables have been bounds-checked,
+ * they can be used where they lie.
+ */
+
+#include <libelf.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "_libelf.h"
+
+#define	VIEW_ALIGNED(P, T)	((((uintptr_t) (P)) & (sizeof(T) - 1)) == 0)
+
+/*
+ * Check that the table of `count' entries of size `entsize' at file
+ * offset `off' lies within the image, and is suitably aligned for
+ * direct access.
+ */
+static int
+_elf64_view_check(const Elf64_View *v, uint64_t off, size_t entsize,
+    size_t count)
+{
+	if (off > v->ev_size || (count > 0 && entsize > SIZE_MAX / count) ||
+	    entsize * count > v->ev_size - off)
+		return (0);
+
+	/* All ELF64 tables are 8-byte aligned in memory. */
+	if (!VIEW_ALIGNED(v->ev_image + off, uint64_t))
+		return (0);
+
+	return (1);
+}
+
+int
+elf64_view(Elf64_View *v, const char *image, size_t sz)
+{
+	const Elf64_Ehdr *eh;
+	const unsigned char *p;
+
+	if (v == NULL || image == NULL) {
+		LIBELF_SET_ERROR(ARGUMENT, 0);
+		return (-1);
+	}
+
+	(void) memset(v, 0, sizeof(*v));
+
+	p = (const unsigned char *) image;
+	if (sz < sizeof(Elf64_Ehdr) || !VIEW_ALIGNED(p, uint64_t) ||
+	    p[EI_MAG0] != ELFMAG0 || p[EI_MAG1] != ELFMAG1 ||
+	    p[EI_MAG2] != ELFMAG2 || p[EI_MAG3] != ELFMAG3) {
+		LIBELF_SET_ERROR(HEADER, 0);
+		return (-1);
+	}
+
+	if (p[EI_CLASS] != ELFCLASS64) {
+		LIBELF_SET_ERROR(CLASS, 0);
+		return (-1);
+	}
+
+	if (p[EI_VERSION] != EV_CURRENT) {
+		LIBELF_SET_ERROR(VERSION, 0);
+		return (-1);
+	}
+
+	/* Views never translate, so the byte order must be our own. */
+	if (p[EI_DATA] != LIBELF_PRIVATE(byteorder)) {
+		LIBELF_SET_ERROR(HEADER, 0);
+		return (-1);
+	}
+
+	eh = (const Elf64_Ehdr *) p;
+
+	v->ev_image = p;
+	v->ev_size = sz;
+	v->ev_ehdr = eh;
+	v->ev_phnum = eh->e_phnum;
+	v->ev_shnum = eh->e_shnum;
+	v->ev_shstrndx = eh->e_shstrndx;
+
+	if (eh->e_shoff != 0) {
+		if (eh->e_shentsize != sizeof(Elf64_Shdr) ||
+		    !_elf64_view_check(v, eh->e_shoff, sizeof(Elf64_Shdr), 1)) {
+			LIBELF_SET_ERROR(HEADER, 0);
+			return (-1);
+		}
+
+		v->ev_shdr = (const Elf64_Shdr *) (p + eh->e_shoff);
+
+		/* Extended numbering keeps the real counts in section 0. */
+		if (eh->e_shnum == 0)
+			v->ev_shnum = (size_t) v->ev_shdr[0].sh_size;
+		if (eh->e_phnum == PN_XNUM)
+			v->ev_phnum = v->ev_shdr[0].sh_info;
+		if (eh->e_shstrndx == SHN_XINDEX)
+			v->ev_shstrndx = v->ev_shdr[0].sh_link;
+
+		if (!_elf64_view_check(v, eh->e_shoff, sizeof(Elf64_Shdr),
+		    v->ev_shnum)) {
+			LIBELF_SET_ERROR(HEADER, 0);
+			return (-1);
+		}
+	} else if (eh->e_shnum != 0 || eh->e_phnum == PN_XNUM) {
+		LIBELF_SET_ERROR(HEADER, 0);
+		return (-1);
+	}
+
+	if (v->ev_phnum > 0) {
+		if (eh->e_phentsize != sizeof(Elf64_Phdr) ||
+		    !_elf64_view_check(v, eh->e_phoff, sizeof(Elf64_Phdr),
+		    v->ev_phnum)) {
+			LIBELF_SET_ERROR(HEADER, 0);
+			return (-1);
+		}
+
+		v->ev_phdr = (const Elf64_Phdr *) (p + eh->e_phoff);
+	}
+
+	return (0);
+}
+
+const Elf64_Shdr *
+elf64_view_getshdr(const Elf64_View *v, size_t ndx)
+{
+	if (v == NULL || v->ev_shdr == NULL || ndx >= v->ev_shnum) {
+		LIBELF_SET_ERROR(ARGUMENT, 0);
+		return (NULL);
+	}
+
+	return (&v->ev_shdr[ndx]);
+}
+
+/*
+ * Return a pointer to the contents of a section holding `entsize'-byte
+ * entries, and the number of entries.  Sections without file contents
+ * yield NULL with a count of zero.
+ */
+const void *
+elf64_view_getsection(const Elf64_View *v, const Elf64_Shdr *sh,
+    size_t entsize, size_t *count)
+{
+	if (v == NULL || sh == NULL || count == NULL || entsize == 0) {
+		LIBELF_SET_ERROR(ARGUMENT, 0);
+		return (NULL);
+	}
+
+	*count = 0;
+
+	if (sh->sh_type == SHT_NULL) {
+		LIBELF_SET_ERROR(SECTION, 0);
+		return (NULL);
+	}
+
+	if (sh->sh_type == SHT_NOBITS || sh->sh_size == 0)
+		return (NULL);
+
+	if ((sh->sh_entsize != 0 && sh->sh_entsize != entsize) ||
+	    sh->sh_size % entsize != 0 ||
+	    sh->sh_offset > v->ev_size ||
+	    sh->sh_size > v->ev_size - sh->sh_offset ||
+	    (entsize > 1 && !VIEW_ALIGNED(v->ev_image + sh->sh_offset,
+	    uint64_t))) {
+		LIBELF_SET_ERROR(SECTION, 0);
+		return (NULL);
+	}
+
+	*count = (size_t) (sh->sh_size / entsize);
+
+	return (v->ev_image + sh->sh_offset);
+}
+
+const Elf64_Rela *
+elf64_view_getrela(const Elf64_View *v, const Elf64_Shdr *sh, size_t *count)
+{
+	if (sh != NULL && sh->sh_type != SHT_RELA) {
+		LIBELF_SET_ERROR(SECTION, 0);
+		return (NULL);
+	}
+
+	return (elf64_view_getsection(v, sh, sizeof(Elf64_Rela), count));
+}
@@ -93,6 +93,7 @@ gelf_getcap(Elf_Data *ed, int ndx, GElf_Cap *dst)
 	return (dst);
 }
 
+#ifndef	LIBELF_NATIVE_READONLY
 int
 gelf_update_cap(Elf_Data *ed, int ndx, GElf_Cap *gc)
 {
@@ -148,3 +149,4 @@ gelf_update_cap(Elf_Data *ed, int ndx, GElf_Cap *gc)
 
 	return (1);
 }
+#endif	/* !LIBELF_NATIVE_READONLY */
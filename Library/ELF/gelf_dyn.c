@@ -93,6 +93,7 @@ gelf_getdyn(Elf_Data *ed, int ndx, GElf_Dyn *dst)
 	return (dst);
 }
 
+#ifndef	LIBELF_NATIVE_READONLY
 int
 gelf_update_dyn(Elf_Data *ed, int ndx, GElf_Dyn *ds)
 {
@@ -150,3 +151,4 @@ gelf_update_dyn(Elf_Data *ed, int ndx, GElf_Dyn *ds)
 
 	return (1);
 }
+#endif	/* !LIBELF_NATIVE_READONLY */
@@ -92,6 +92,7 @@ gelf_getehdr(Elf *e, GElf_Ehdr *d)
 	return (d);
 }
 
+#ifndef	LIBELF_NATIVE_READONLY
 Elf32_Ehdr *
 elf32_newehdr(Elf *e)
 {
@@ -165,3 +166,4 @@ gelf_update_ehdr(Elf *e, GElf_Ehdr *s)
 
 	return (1);
 }
+#endif	/* !LIBELF_NATIVE_READONLY */
@@ -96,6 +96,7 @@ gelf_getmove(Elf_Data *ed, int ndx, GElf_Move *dst)
 	return (dst);
 }
 
+#ifndef	LIBELF_NATIVE_READONLY
 int
 gelf_update_move(Elf_Data *ed, int ndx, GElf_Move *gm)
 {
@@ -157,3 +158,4 @@ gelf_update_move(Elf_Data *ed, int ndx, GElf_Move *gm)
 
 	return (1);
 }
+#endif	/* !LIBELF_NATIVE_READONLY */
@@ -100,6 +100,7 @@ gelf_getphdr(Elf *e, int index, GElf_Phdr *d)
 	return (d);
 }
 
+#ifndef	LIBELF_NATIVE_READONLY
 Elf32_Phdr *
 elf32_newphdr(Elf *e, size_t count)
 {
@@ -175,3 +176,4 @@ gelf_update_phdr(Elf *e, int ndx, GElf_Phdr *s)
 
 	return (1);
 }
+#endif	/* !LIBELF_NATIVE_READONLY */
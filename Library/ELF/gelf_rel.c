@@ -95,6 +95,7 @@ gelf_getrel(Elf_Data *ed, int ndx, GElf_Rel *dst)
 	return (dst);
 }
 
+#ifndef	LIBELF_NATIVE_READONLY
 int
 gelf_update_rel(Elf_Data *ed, int ndx, GElf_Rel *dr)
 {
@@ -160,3 +161,4 @@ gelf_update_rel(Elf_Data *ed, int ndx, GElf_Rel *dr)
 
 	return (1);
 }
+#endif	/* !LIBELF_NATIVE_READONLY */
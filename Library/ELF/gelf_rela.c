@@ -96,6 +96,7 @@ gelf_getrela(Elf_Data *ed, int ndx, GElf_Rela *dst)
 	return (dst);
 }
 
+#ifndef	LIBELF_NATIVE_READONLY
 int
 gelf_update_rela(Elf_Data *ed, int ndx, GElf_Rela *dr)
 {
@@ -163,3 +164,4 @@ gelf_update_rela(Elf_Data *ed, int ndx, GElf_Rela *dr)
 
 	return (1);
 }
+#endif	/* !LIBELF_NATIVE_READONLY */
@@ -86,6 +86,7 @@ gelf_getshdr(Elf_Scn *s, GElf_Shdr *d)
 	return (d);
 }
 
+#ifndef	LIBELF_NATIVE_READONLY
 int
 gelf_update_shdr(Elf_Scn *scn, GElf_Shdr *s)
 {
@@ -128,3 +129,4 @@ gelf_update_shdr(Elf_Scn *scn, GElf_Shdr *s)
 
 	return (1);
 }
+#endif	/* !LIBELF_NATIVE_READONLY */
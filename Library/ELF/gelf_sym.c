@@ -95,6 +95,7 @@ gelf_getsym(Elf_Data *ed, int ndx, GElf_Sym *dst)
 	return (dst);
 }
 
+#ifndef	LIBELF_NATIVE_READONLY
 int
 gelf_update_sym(Elf_Data *ed, int ndx, GElf_Sym *gs)
 {
@@ -157,3 +158,4 @@ gelf_update_sym(Elf_Data *ed, int ndx, GElf_Sym *gs)
 
 	return (1);
 }
+#endif	/* !LIBELF_NATIVE_READONLY */
@@ -92,6 +92,7 @@ gelf_getsyminfo(Elf_Data *ed, int ndx, GElf_Syminfo *dst)
 	return (dst);
 }
 
+#ifndef	LIBELF_NATIVE_READONLY
 int
 gelf_update_syminfo(Elf_Data *ed, int ndx, GElf_Syminfo *gs)
 {
@@ -150,3 +151,4 @@ gelf_update_syminfo(Elf_Data *ed, int ndx, GElf_Syminfo *gs)
 
 	return (1);
 }
+#endif	/* !LIBELF_NATIVE_READONLY */
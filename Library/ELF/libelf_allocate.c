@@ -31,6 +31,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <libelf.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -43,10 +44,8 @@ _libelf_allocate_elf(void)
 {
 	Elf *e;
 
-	if ((e = malloc(sizeof(*e))) == NULL) {
-		LIBELF_SET_ERROR(RESOURCE, errno);
+	if ((e = _libelf_arena_new_elf()) == NULL)
 		return NULL;
-	}
 
 	e->e_activations = 1;
 	e->e_hdr.e_rawhdr = NULL;
@@ -112,6 +111,7 @@ _libelf_release_elf(Elf *e)
 		}
 
 		assert(STAILQ_EMPTY(&e->e_u.e_elf.e_scn));
+		FREE(e->e_u.e_elf.e_scnindex);
 
 		if (e->e_flags & LIBELF_F_AR_HEADER) {
 			arh = e->e_hdr.e_arhdr;
@@ -126,7 +126,7 @@ _libelf_release_elf(Elf *e)
 		break;
 	}
 
-	free(e);
+	_libelf_arena_release(e);
 
 	return (NULL);
 }
@@ -136,10 +136,8 @@ _libelf_allocate_data(Elf_Scn *s)
 {
 	struct _Libelf_Data *d;
 
-	if ((d = calloc((size_t) 1, sizeof(*d))) == NULL) {
-		LIBELF_SET_ERROR(RESOURCE, 0);
+	if ((d = _libelf_arena_alloc(s->s_elf, sizeof(*d))) == NULL)
 		return (NULL);
-	}
 
 	d->d_scn = s;
 
@@ -153,20 +151,64 @@ _libelf_release_data(struct _Libelf_Data *d)
 	if (d->d_flags & LIBELF_F_DATA_MALLOCED)
 		free(d->d_data.d_buf);
 
-	free(d);
+	/* The descriptor itself goes away with its Elf's arena. */
 
 	return (NULL);
 }
 
+/*
+ * Ensure that the section index of an ELF descriptor has room for at
+ * least `count' entries.  New slots are cleared.
+ */
+int
+_libelf_allocate_scnindex(Elf *e, size_t count)
+{
+	Elf_Scn **ndx;
+	size_t sz;
+
+	sz = e->e_u.e_elf.e_scnindexsz;
+	if (count <= sz)
+		return (1);
+
+	if (count > SIZE_MAX / sizeof(Elf_Scn *)) {
+		LIBELF_SET_ERROR(RESOURCE, 0);
+		return (0);
+	}
+
+	if ((ndx = realloc(e->e_u.e_elf.e_scnindex,
+	    count * sizeof(Elf_Scn *))) == NULL) {
+		LIBELF_SET_ERROR(RESOURCE, errno);
+		return (0);
+	}
+
+	(void) memset(ndx + sz, 0, (count - sz) * sizeof(Elf_Scn *));
+
+	e->e_u.e_elf.e_scnindex = ndx;
+	e->e_u.e_elf.e_scnindexsz = count;
+
+	return (1);
+}
+
 Elf_Scn *
 _libelf_allocate_scn(Elf *e, size_t ndx)
 {
 	Elf_Scn *s;
+	size_t sz;
+
+	/*
+	 * Sections are created in ascending index order, so growing
+	 * the index geometrically keeps elf_newscn() amortized O(1).
+	 */
+	if (ndx >= e->e_u.e_elf.e_scnindexsz) {
+		sz = 2 * e->e_u.e_elf.e_scnindexsz;
+		if (sz <= ndx)
+			sz = ndx + 16;
+		if (_libelf_allocate_scnindex(e, sz) == 0)
+			return (NULL);
+	}
 
-	if ((s = calloc((size_t) 1, sizeof(Elf_Scn))) == NULL) {
-		LIBELF_SET_ERROR(RESOURCE, errno);
+	if ((s = _libelf_arena_alloc(e, sizeof(Elf_Scn))) == NULL)
 		return (NULL);
-	}
 
 	s->s_elf = e;
 	s->s_ndx = ndx;
@@ -175,6 +217,7 @@ _libelf_allocate_scn(Elf *e, size_t ndx)
 	STAILQ_INIT(&s->s_rawdata);
 
 	STAILQ_INSERT_TAIL(&e->e_u.e_elf.e_scn, s, s_next);
+	e->e_u.e_elf.e_scnindex[ndx] = s;
 
 	return (s);
 }
@@ -204,7 +247,9 @@ _libelf_release_scn(Elf_Scn *s)
 
 	STAILQ_REMOVE(&e->e_u.e_elf.e_scn, s, _Elf_Scn, s_next);
 
-	free(s);
+	if (s->s_ndx < e->e_u.e_elf.e_scnindexsz &&
+	    e->e_u.e_elf.e_scnindex[s->s_ndx] == s)
+		e->e_u.e_elf.e_scnindex[s->s_ndx] = NULL;
 
 	return (NULL);
 }
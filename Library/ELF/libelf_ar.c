@@ -25,7 +25,6 @@
  */
 
 #include <assert.h>
-#include <ctype.h>
 #include <libelf.h>
 #include <stdlib.h>
 #include <string.h>
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2017, ETH Zuerich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+/*
+ * Per-descriptor arenas.
+ *
+ * An Elf descriptor, and the section and data descriptors hanging off
+ * it, all live exactly as long as the Elf itself.  Rather than going to
+ * the heap for each of them, they are carved out of page-sized chunks
+ * owned by the Elf, and the whole lot is dropped at once by elf_end().
+ * Individual descriptors are never returned to the arena.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <libelf.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "_libelf.h"
+
+/*
+ * Under UEFI, take chunks straight from the boot services pool rather
+ * than through the C library heap.
+ */
+#ifdef	LIBELF_UEFI
+#include <Library/MemoryAllocationLib.h>
+#define	LIBELF_CHUNK_ALLOC(SZ)	AllocatePool(SZ)
+#define	LIBELF_CHUNK_FREE(P)	FreePool(P)
+#else
+#define	LIBELF_CHUNK_ALLOC(SZ)	malloc(SZ)
+#define	LIBELF_CHUNK_FREE(P)	free(P)
+#endif
+
+#define	LIBELF_CHUNK_SIZE	4096
+#define	LIBELF_CHUNK_ALIGN	16
+
+struct _Libelf_Chunk {
+	struct _Libelf_Chunk	*c_next;	/* older chunks */
+	size_t			c_used;		/* bytes handed out */
+	size_t			c_size;		/* usable bytes */
+};
+
+#define	LIBELF_CHUNK_HDRSZ						\
+	((sizeof(struct _Libelf_Chunk) + LIBELF_CHUNK_ALIGN - 1) &	\
+	    ~((size_t) LIBELF_CHUNK_ALIGN - 1))
+
+/*
+ * Allocate a new chunk with room for at least `sz' bytes, and push it
+ * onto the list at `*head'.
+ */
+static struct _Libelf_Chunk *
+_libelf_chunk_new(struct _Libelf_Chunk **head, size_t sz)
+{
+	struct _Libelf_Chunk *c;
+	size_t csz;
+
+	if (sz > SIZE_MAX - LIBELF_CHUNK_HDRSZ) {
+		LIBELF_SET_ERROR(RESOURCE, 0);
+		return (NULL);
+	}
+
+	csz = LIBELF_CHUNK_HDRSZ + sz;
+	if (csz < LIBELF_CHUNK_SIZE)
+		csz = LIBELF_CHUNK_SIZE;
+
+	if ((c = LIBELF_CHUNK_ALLOC(csz)) == NULL) {
+		LIBELF_SET_ERROR(RESOURCE, errno);
+		return (NULL);
+	}
+
+	c->c_used = 0;
+	c->c_size = csz - LIBELF_CHUNK_HDRSZ;
+	c->c_next = *head;
+	*head = c;
+
+	return (c);
+}
+
+static void *
+_libelf_chunk_carve(struct _Libelf_Chunk *c, size_t sz)
+{
+	void *p;
+
+	assert(c->c_size - c->c_used >= sz);
+
+	p = (unsigned char *) c + LIBELF_CHUNK_HDRSZ + c->c_used;
+	c->c_used += (sz + LIBELF_CHUNK_ALIGN - 1) &
+	    ~((size_t) LIBELF_CHUNK_ALIGN - 1);
+	if (c->c_used > c->c_size)
+		c->c_used = c->c_size;
+
+	(void) memset(p, 0, sz);
+
+	return (p);
+}
+
+/*
+ * Allocate a zeroed Elf descriptor, together with the first chunk of
+ * its arena.
+ */
+Elf *
+_libelf_arena_new_elf(void)
+{
+	struct _Libelf_Chunk *c;
+	Elf *e;
+
+	c = NULL;
+	if (_libelf_chunk_new(&c, sizeof(Elf)) == NULL)
+		return (NULL);
+
+	e = _libelf_chunk_carve(c, sizeof(Elf));
+	e->e_arena = c;
+
+	return (e);
+}
+
+/*
+ * Allocate `sz' zeroed bytes from the arena of descriptor `e'.
+ */
+void *
+_libelf_arena_alloc(Elf *e, size_t sz)
+{
+	struct _Libelf_Chunk *c;
+
+	assert(e != NULL && e->e_arena != NULL);
+
+	c = e->e_arena;
+	if (c->c_size - c->c_used < sz) {
+		/*
+		 * Oversized requests get a chunk of their own, behind
+		 * the current one, so that the latter's free space isn't
+		 * wasted.
+		 */
+		if (sz > LIBELF_CHUNK_SIZE / 4) {
+			if (_libelf_chunk_new(&c->c_next, sz) == NULL)
+				return (NULL);
+			return (_libelf_chunk_carve(c->c_next, sz));
+		}
+
+		if ((c = _libelf_chunk_new(&e->e_arena, sz)) == NULL)
+			return (NULL);
+	}
+
+	return (_libelf_chunk_carve(c, sz));
+}
+
+/*
+ * Release every chunk in the arena of `e', including the one holding
+ * `e' itself.
+ */
+void
+_libelf_arena_release(Elf *e)
+{
+	struct _Libelf_Chunk *c, *tc;
+
+	for (c = e->e_arena; c != NULL; c = tc) {
+		tc = c->c_next;
+		LIBELF_CHUNK_FREE(c);
+	}
+}
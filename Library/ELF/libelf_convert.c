@@ -205,6 +205,51 @@ ELFTC_VCSID("$Id: libelf_convert.m4 3174 2015-03-27 17:13:41Z emaste $");
 
 #define	ROUNDUP2(V,N)	(V) = ((((V) + (N) - 1)) & ~((N) - 1))
 
+#ifdef	LIBELF_NATIVE_READONLY
+
+/*
+ * A loader that only ever reads objects of its own class and byte
+ * order needs none of the byte-swapping or to-file converters.  Files
+ * in native order are laid out exactly as the in-memory structures,
+ * with the exception of a few types (Move, Verdef, Verneed) that have
+ * no converter at all in this configuration.
+ */
+
+#if	LIBELF_CLASS != ELFCLASS64
+#error	LIBELF_NATIVE_READONLY supports ELFCLASS64 only.
+#endif
+
+#define	NATIVE_TOM(N,T)							\
+static int								\
+_libelf_cvt_##N##_tom(unsigned char *dst, size_t dsz,			\
+    unsigned char *src, size_t count, int byteswap)			\
+{									\
+	if (byteswap || dsz < count * sizeof(T))			\
+		return (0);						\
+	(void) memcpy(dst, src, count * sizeof(T));			\
+	return (1);							\
+}
+
+NATIVE_TOM(ADDR64, Elf64_Addr)
+NATIVE_TOM(CAP64, Elf64_Cap)
+NATIVE_TOM(DYN64, Elf64_Dyn)
+NATIVE_TOM(EHDR64, Elf64_Ehdr)
+NATIVE_TOM(HALF, Elf64_Half)
+NATIVE_TOM(LWORD, Elf64_Lword)
+NATIVE_TOM(OFF64, Elf64_Off)
+NATIVE_TOM(PHDR64, Elf64_Phdr)
+NATIVE_TOM(REL64, Elf64_Rel)
+NATIVE_TOM(RELA64, Elf64_Rela)
+NATIVE_TOM(SHDR64, Elf64_Shdr)
+NATIVE_TOM(SWORD, Elf64_Sword)
+NATIVE_TOM(SXWORD, Elf64_Sxword)
+NATIVE_TOM(SYMINFO64, Elf64_Syminfo)
+NATIVE_TOM(SYM64, Elf64_Sym)
+NATIVE_TOM(WORD, Elf64_Word)
+NATIVE_TOM(XWORD, Elf64_Xword)
+
+#else	/* !LIBELF_NATIVE_READONLY */
+
 /*[*/
 
 static int
@@ -2851,6 +2896,8 @@ _libelf_cvt_VNEED64_tom(unsigned char *dst, size_t dsz, unsigned char *src,
 }
 /*]*/
 
+#endif	/* !LIBELF_NATIVE_READONLY */
+
 /*
  * Sections of type ELF_T_BYTE are never byteswapped, consequently a
  * simple memcpy suffices for both directions of conversion.
@@ -2880,7 +2927,7 @@ _libelf_cvt_BYTE_tox(unsigned char *dst, size_t dsz, unsigned char *src,
  * Argument srcsz denotes the number of bytes to be converted.  In the
  * 32-bit case we need to translate srcsz to a count of 32-bit words.
  */
-
+#ifndef	LIBELF_NATIVE_READONLY
 static int
 _libelf_cvt_GNUHASH32_tom(unsigned char *dst, size_t dsz, unsigned char *src,
     size_t srcsz, int byteswap)
@@ -2896,6 +2943,7 @@ _libelf_cvt_GNUHASH32_tof(unsigned char *dst, size_t dsz, unsigned char *src,
 	return (_libelf_cvt_WORD_tof(dst, dsz, src, srcsz / sizeof(uint32_t),
 		byteswap));
 }
+#endif	/* !LIBELF_NATIVE_READONLY */
 
 static int
 _libelf_cvt_GNUHASH64_tom(unsigned char *dst, size_t dsz, unsigned char *src,
@@ -2983,6 +3031,7 @@ _libelf_cvt_GNUHASH64_tom(unsigned char *dst, size_t dsz, unsigned char *src,
 	return (1);
 }
 
+#ifndef	LIBELF_NATIVE_READONLY
 static int
 _libelf_cvt_GNUHASH64_tof(unsigned char *dst, size_t dsz, unsigned char *src,
     size_t srcsz, int byteswap)
@@ -3061,6 +3110,7 @@ _libelf_cvt_GNUHASH64_tof(unsigned char *dst, size_t dsz, unsigned char *src,
 
 	return (1);
 }
+#endif	/* !LIBELF_NATIVE_READONLY */
 
 /*
  * Elf_Note structures comprise a fixed size header followed by variable
@@ -3132,6 +3182,7 @@ _libelf_cvt_NOTE_tom(unsigned char *dst, size_t dsz, unsigned char *src,
 	return (1);
 }
 
+#ifndef	LIBELF_NATIVE_READONLY
 static int
 _libelf_cvt_NOTE_tof(unsigned char *dst, size_t dsz, unsigned char *src,
     size_t count, int byteswap)
@@ -3182,6 +3233,7 @@ _libelf_cvt_NOTE_tof(unsigned char *dst, size_t dsz, unsigned char *src,
 
 	return (1);
 }
+#endif	/* !LIBELF_NATIVE_READONLY */
 
 struct converters {
 	int	(*tof32)(unsigned char *dst, size_t dsz, unsigned char *src,
@@ -3195,6 +3247,33 @@ struct converters {
 };
 
 
+#ifdef	LIBELF_NATIVE_READONLY
+
+static struct converters cvt[ELF_T_NUM] = {
+	[ELF_T_ADDR]	= { .tom64 = _libelf_cvt_ADDR64_tom },
+	[ELF_T_BYTE]	= { .tom64 = _libelf_cvt_BYTE_tox },
+	[ELF_T_CAP]	= { .tom64 = _libelf_cvt_CAP64_tom },
+	[ELF_T_DYN]	= { .tom64 = _libelf_cvt_DYN64_tom },
+	[ELF_T_EHDR]	= { .tom64 = _libelf_cvt_EHDR64_tom },
+	[ELF_T_GNUHASH]	= { .tom64 = _libelf_cvt_GNUHASH64_tom },
+	[ELF_T_HALF]	= { .tom64 = _libelf_cvt_HALF_tom },
+	[ELF_T_LWORD]	= { .tom64 = _libelf_cvt_LWORD_tom },
+	[ELF_T_NOTE]	= { .tom64 = _libelf_cvt_NOTE_tom },
+	[ELF_T_OFF]	= { .tom64 = _libelf_cvt_OFF64_tom },
+	[ELF_T_PHDR]	= { .tom64 = _libelf_cvt_PHDR64_tom },
+	[ELF_T_REL]	= { .tom64 = _libelf_cvt_REL64_tom },
+	[ELF_T_RELA]	= { .tom64 = _libelf_cvt_RELA64_tom },
+	[ELF_T_SHDR]	= { .tom64 = _libelf_cvt_SHDR64_tom },
+	[ELF_T_SWORD]	= { .tom64 = _libelf_cvt_SWORD_tom },
+	[ELF_T_SXWORD]	= { .tom64 = _libelf_cvt_SXWORD_tom },
+	[ELF_T_SYMINFO]	= { .tom64 = _libelf_cvt_SYMINFO64_tom },
+	[ELF_T_SYM]	= { .tom64 = _libelf_cvt_SYM64_tom },
+	[ELF_T_WORD]	= { .tom64 = _libelf_cvt_WORD_tom },
+	[ELF_T_XWORD]	= { .tom64 = _libelf_cvt_XWORD_tom }
+};
+
+#else	/* !LIBELF_NATIVE_READONLY */
+
 static struct converters cvt[ELF_T_NUM] = {
 	/*[*/
 	[ELF_T_ADDR] = {
@@ -3366,6 +3445,8 @@ static struct converters cvt[ELF_T_NUM] = {
 	}
 };
 
+#endif	/* !LIBELF_NATIVE_READONLY */
+
 int (*_libelf_get_translator(Elf_Type t, int direction, int elfclass))
  (unsigned char *_dst, size_t dsz, unsigned char *_src, size_t _cnt,
   int _byteswap)
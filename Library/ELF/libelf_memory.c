@@ -74,6 +74,11 @@ _libelf_memory(unsigned char *image, size_t sz, int reporterror)
  		    ELFDATA2MSB) || (e_class != ELFCLASS32 && e_class !=
 		    ELFCLASS64))
 			error = ELF_E_HEADER;
+#ifdef	LIBELF_NATIVE_READONLY
+		else if (e_byteorder != LIBELF_BYTEORDER ||
+		    e_class != LIBELF_CLASS)
+			error = ELF_E_CLASS;
+#endif
 
 		if (error != ELF_E_NONE) {
 			if (reporterror) {
@@ -88,9 +93,12 @@ _libelf_memory(unsigned char *image, size_t sz, int reporterror)
 			e->e_class = e_class;
 			e->e_version = e_version;
 		}
-	} else if (sz >= SARMAG &&
+	}
+#ifndef	LIBELF_NATIVE_READONLY
+	else if (sz >= SARMAG &&
 	    strncmp((const char *) image, ARMAG, (size_t) SARMAG) == 0)
 		return (_libelf_ar_open(e, reporterror));
+#endif
 
 	return (e);
 }
@@ -105,6 +105,7 @@ _libelf_getphdr(Elf *e, int ec)
 	return (phdr);
 }
 
+#ifndef	LIBELF_NATIVE_READONLY
 void *
 _libelf_newphdr(Elf *e, int ec, size_t count)
 {
@@ -151,3 +152,4 @@ _libelf_newphdr(Elf *e, int ec, size_t count)
 
 	return (newphdr);
 }
+#endif	/* !LIBELF_NATIVE_READONLY */
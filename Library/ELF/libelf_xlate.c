@@ -50,6 +50,8 @@ _libelf_xlate(Elf_Data *dst, const Elf_Data *src, unsigned int encoding,
 	int byteswap;
 	size_t cnt, dsz, fsz, msz;
 	uintptr_t sb, se, db, de;
+	int (*xlate)(unsigned char *_d, size_t _dsz, unsigned char *_s,
+	    size_t _c, int _swap);
 
 	if (encoding == ELFDATANONE)
 		encoding = LIBELF_PRIVATE(byteorder);
@@ -138,8 +140,13 @@ _libelf_xlate(Elf_Data *dst, const Elf_Data *src, unsigned int encoding,
 	    (db == sb && !byteswap && fsz == msz))
 		return (dst);	/* nothing more to do */
 
-	if (!(_libelf_get_translator(src->d_type, direction, elfclass))
-	    (dst->d_buf, dsz, src->d_buf, cnt, byteswap)) {
+	xlate = _libelf_get_translator(src->d_type, direction, elfclass);
+	if (xlate == NULL) {
+		LIBELF_SET_ERROR(UNIMPL, 0);
+		return (NULL);
+	}
+
+	if (!(*xlate)(dst->d_buf, dsz, src->d_buf, cnt, byteswap)) {
 		LIBELF_SET_ERROR(DATA, 0);
 		return (NULL);
 	}
@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) 2017, ETH Zuerich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+int errno;
+
+/* Only the errors that the runtime itself raises. */
+char *
+strerror(int errnum) {
+    switch(errnum) {
+        case 0:      return "No error";
+        case EINVAL: return "Invalid argument";
+        case ENOMEM: return "Out of memory";
+        case ERANGE: return "Result out of range";
+        default:     return "Unknown error";
+    }
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2017, ETH Zuerich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+/* EDK headers */
+#include <Uefi.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+/* The heap is just the boot services pool.  Each block is prefixed with its
+ * size, for realloc(); the header is 16 bytes, so as not to weaken the
+ * pool's alignment. */
+struct pool_header {
+    size_t size;
+    size_t pad;
+};
+
+void *
+malloc(size_t size) {
+    struct pool_header *h;
+    EFI_STATUS status;
+
+    if(size > MAX_UINTN - sizeof(struct pool_header)) {
+        errno= ENOMEM;
+        return NULL;
+    }
+
+    status= gBS->AllocatePool(EfiLoaderData,
+                              sizeof(struct pool_header) + size,
+                              (void **)&h);
+    if(EFI_ERROR(status)) {
+        errno= ENOMEM;
+        return NULL;
+    }
+
+    h->size= size;
+    return h + 1;
+}
+
+void *
+calloc(size_t n, size_t size) {
+    void *p;
+
+    if(size != 0 && n > MAX_UINTN / size) {
+        errno= ENOMEM;
+        return NULL;
+    }
+
+    p= malloc(n * size);
+    if(p) ZeroMem(p, n * size);
+
+    return p;
+}
+
+void *
+realloc(void *ptr, size_t size) {
+    struct pool_header *h;
+    void *p;
+
+    if(!ptr) return malloc(size);
+
+    if(size == 0) {
+        free(ptr);
+        return NULL;
+    }
+
+    /* Shrinking never moves the block. */
+    h= (struct pool_header *)ptr - 1;
+    if(size <= h->size) return ptr;
+
+    p= malloc(size);
+    if(!p) return NULL;
+
+    CopyMem(p, ptr, h->size);
+    free(ptr);
+
+    return p;
+}
+
+void
+free(void *ptr) {
+    if(!ptr) return;
+
+    gBS->FreePool((struct pool_header *)ptr - 1);
+}
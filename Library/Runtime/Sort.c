@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2017, ETH Zuerich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdlib.h>
+
+/* Swap two elements bytewise, so that we never need a temporary of the
+ * element's size. */
+static void
+swap(unsigned char *a, unsigned char *b, size_t size) {
+    size_t i;
+
+    for(i= 0; i < size; i++) {
+        unsigned char t= a[i];
+        a[i]= b[i];
+        b[i]= t;
+    }
+}
+
+/* Sift element 'root' down the max-heap of the first 'n' elements. */
+static void
+sift_down(unsigned char *base, size_t root, size_t n, size_t size,
+          int (*compar)(const void *, const void *)) {
+    size_t child;
+
+    while((child= 2 * root + 1) < n) {
+        if(child + 1 < n &&
+           compar(base + child * size, base + (child + 1) * size) < 0)
+            child++;
+
+        if(compar(base + root * size, base + child * size) >= 0) return;
+
+        swap(base + root * size, base + child * size, size);
+        root= child;
+    }
+}
+
+/* A heapsort: O(n log n) in the worst case, with no recursion and no
+ * allocation, unlike LibC's. */
+void
+qsort(void *base, size_t n, size_t size,
+      int (*compar)(const void *, const void *)) {
+    unsigned char *b= base;
+    size_t i;
+
+    if(n < 2 || size == 0) return;
+
+    for(i= n / 2; i > 0; i--) sift_down(b, i - 1, n, size, compar);
+
+    for(i= n - 1; i > 0; i--) {
+        swap(b, b + i * size, size);
+        sift_down(b, 0, i, size, compar);
+    }
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2017, ETH Zuerich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <string.h>
+
+/* EDK headers */
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+/* These are also the targets of the calls that the compiler emits for
+ * structure copies and initialisers, so they must exist as functions. */
+
+void *
+memcpy(void *dst, const void *src, size_t n) {
+    return CopyMem(dst, src, n);
+}
+
+void *
+memmove(void *dst, const void *src, size_t n) {
+    /* CopyMem() handles overlapping buffers. */
+    return CopyMem(dst, src, n);
+}
+
+void *
+memset(void *s, int c, size_t n) {
+    return SetMem(s, n, (UINT8)c);
+}
+
+int
+memcmp(const void *a, const void *b, size_t n) {
+    INTN r;
+
+    if(n == 0) return 0;
+
+    r= CompareMem(a, b, n);
+    return r < 0 ? -1 : r > 0 ? 1 : 0;
+}
+
+size_t
+strlen(const char *s) {
+    return AsciiStrLen(s);
+}
+
+int
+strcmp(const char *a, const char *b) {
+    INTN r= AsciiStrCmp(a, b);
+    return r < 0 ? -1 : r > 0 ? 1 : 0;
+}
+
+int
+strncmp(const char *a, const char *b, size_t n) {
+    INTN r;
+
+    if(n == 0) return 0;
+
+    r= AsciiStrnCmp(a, b, n);
+    return r < 0 ? -1 : r > 0 ? 1 : 0;
+}
+
+/* AsciiStrnCpy() doesn't pad, and is deprecated, so this one's by hand. */
+char *
+strncpy(char *dst, const char *src, size_t n) {
+    size_t i;
+
+    for(i= 0; i < n && src[i] != '\0'; i++) dst[i]= src[i];
+    for(; i < n; i++) dst[i]= '\0';
+
+    return dst;
+}